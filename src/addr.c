@@ -14,6 +14,8 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include "config.h"
+
 #include <netdb.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -22,6 +24,7 @@
 
 #include "addr.h"
 #include "log.h"
+#include "netlink.h"
 
 const char *inet_address(inet_addr_t *ss, char *buf, size_t len)
 {
@@ -81,7 +84,8 @@ short inet_addr_get_port(inet_addr_t *ss)
 	return sin->sin_port;
 }
 
-/* The BSD's or SVR4 systems like Solaris don't have /proc/net/route */
+#ifndef HAVE_LINUX_RTNETLINK_H
+/* The BSD's or SVR4 systems like Solaris don't have rtnetlink */
 static char *altdefault(char *iface, size_t len)
 {
 	char buf[256];
@@ -113,56 +117,19 @@ static char *altdefault(char *iface, size_t len)
 	pclose(fp);
 	return NULL;
 }
+#endif
 
-/* Find default outbound *LAN* interface, i.e. skipping tunnels */
+/*
+ * Find default outbound *LAN* interface, i.e. skipping tunnels.  On
+ * Linux both IPv4 and IPv6 default routes, from the netlink cache.
+ */
 char *ifdefault(char *iface, size_t len)
 {
-	uint32_t dest, gw, mask;
-	char buf[256], ifname[17];
-	char *ptr;
-	FILE *fp;
-	int rc, flags, cnt, use, metric, mtu, win, irtt;
-	int best = 100000, found = 0;
-
-	fp = fopen("/proc/net/route", "r");
-	if (!fp)
-		return altdefault(iface, len);
-
-	/* Skip heading */
-	ptr = fgets(buf, sizeof(buf), fp);
-	if (!ptr)
-		goto end;
-
-	while (fgets(buf, sizeof(buf), fp) != NULL) {
-		rc = sscanf(buf, "%16s %X %X %X %d %d %d %X %d %d %d\n",
-			   ifname, &dest, &gw, &flags, &cnt, &use, &metric,
-			   &mask, &mtu, &win, &irtt);
-
-		if (rc < 10 || !(flags & 1)) /* IFF_UP */
-			continue;
-
-		if (dest != 0 || mask != 0)
-			continue;
-
-		if (!iface[0] || !strncmp(iface, "tun", 3)) {
-			if (metric >= best)
-				continue;
-
-			strncpy(iface, ifname, len);
-			iface[len] = 0;
-			best = metric;
-			found = 1;
-
-			DEBUG("Found default intefaces %s", iface);
-		}
-	}
-
-end:
-	fclose(fp);
-	if (found)
-		return iface;
-
-	return NULL;
+#ifdef HAVE_LINUX_RTNETLINK_H
+	return nl_default(iface, len);
+#else
+	return altdefault(iface, len);
+#endif
 }
 
 /* XXX: old IPv4-only address validation, fixme!
@@ -183,19 +150,14 @@ static int valid_addr(struct in_addr *ina)
 }
 #endif
 
-/* Find IP address of default outbound LAN interface */
-int ifinfo(char *iface, inet_addr_t *addr, int family)
+#ifndef HAVE_LINUX_RTNETLINK_H
+/* Walk all addresses of all interfaces, without the netlink cache */
+static int altinfo(char *iface, inet_addr_t *addr, int family)
 {
 	struct ifaddrs *ifaddr, *ifa;
-	char ifname[17] = { 0 };
 	char buf[INET_ADDRSTR_LEN] = { 0 };
 	int rc = -1;
 
-	if (!iface || !iface[0])
-		iface = ifdefault(ifname, sizeof(ifname));
-	if (!iface)
-		return -2;
-
 	rc = getifaddrs(&ifaddr);
 	if (rc == -1)
 		return -3;
@@ -237,6 +199,25 @@ int ifinfo(char *iface, inet_addr_t *addr, int family)
 
 	return rc;
 }
+#endif
+
+/* Find IP address of default outbound LAN interface */
+int ifinfo(char *iface, inet_addr_t *addr, int family)
+{
+	char ifname[IFNAMSIZ] = { 0 };
+
+	if (!iface || !iface[0])
+		iface = ifdefault(ifname, sizeof(ifname));
+	if (!iface)
+		return -2;
+
+#ifdef HAVE_LINUX_RTNETLINK_H
+	/* Called per socket, the cache saves a walk of all addresses */
+	return nl_ifinfo(iface, addr, family);
+#else
+	return altinfo(iface, addr, family);
+#endif
+}
 
 /**
  * Local Variables:
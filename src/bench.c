@@ -0,0 +1,298 @@
+/* Loopback self-benchmark, max pps this host can both send and check
+ *
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+#include "mcjoin.h"
+#include "bench.h"
+
+#include <errno.h>
+#include <net/if.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* Receiver I/O backends to compare, see receiver() */
+static const struct {
+	const char *name;
+	int         busy_poll;
+} io[] = {
+	{ "poll", 0              },
+	{ "busy", BUSY_POLL_USEC },
+};
+
+/* Reported by the receiver process at the end of each trial */
+struct rx_result {
+	size_t    count;
+	size_t    drops;
+	uint64_t  cpu;		/* usec */
+	uint64_t  wall;		/* ns */
+};
+
+/* User + system time of this process, in usec */
+static uint64_t cpu_time(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+		ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * Move to a private network namespace, unprivileged users get their own
+ * user namespace as well, and bring up loopback with multicast.  Keeps
+ * the benchmark off the host's routes, firewall and other traffic.
+ */
+static int bench_netns(void)
+{
+	struct ifreq ifr;
+	int flags = CLONE_NEWNET;
+	int sd, rc = -1;
+
+	if (geteuid())
+		flags |= CLONE_NEWUSER;
+	if (unshare(flags)) {
+		DEBUG("Failed creating network namespace: %s", strerror(errno));
+		return 1;
+	}
+
+	sd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sd < 0)
+		goto fail;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, "lo", sizeof(ifr.ifr_name));
+	if (!ioctl(sd, SIOCGIFFLAGS, &ifr)) {
+		ifr.ifr_flags |= IFF_UP | IFF_MULTICAST;
+		rc = ioctl(sd, SIOCSIFFLAGS, &ifr);
+	}
+	close(sd);
+	if (rc)
+		goto fail;
+
+	strlcpy(iface, "lo", IFNAMSIZ);
+	return 0;
+fail:
+	ERROR("Failed setting up loopback in network namespace: %s", strerror(errno));
+	return -1;
+}
+
+/* Receiver process, the regular receiver loop, until SIGTERM */
+static void rx_run(int fd, int busy)
+{
+	struct rx_result rx = { 0 };
+	uint64_t start, wall;
+	size_t i;
+
+	/* Skip the "Joining ..." noise for each group and trial */
+	log_level("warning");
+	busy_poll = busy;
+
+	for (i = 0; i < group_num; i++) {
+		struct gr *g = &groups[i];
+
+		g->count = g->gaps = 0;
+		memset(&g->rxq, 0, sizeof(g->rxq));
+		if (join_group(g))
+			_exit(1);
+	}
+
+	start = cpu_time();
+	wall  = now_ns();
+	if (write(fd, &rx, sizeof(rx)) != sizeof(rx))
+		_exit(1);
+
+	while (running)
+		receiver(0);
+
+	for (i = 0; i < group_num; i++) {
+		rx.count += groups[i].count;
+		rx.drops += groups[i].rxq.drops;
+	}
+	rx.cpu  = cpu_time() - start;
+	rx.wall = now_ns() - wall;
+
+	if (write(fd, &rx, sizeof(rx)) != sizeof(rx))
+		_exit(1);
+	_exit(0);
+}
+
+/* Let the receiver drain its socket buffers */
+static void settle(void)
+{
+	struct timespec ts = { 0, BENCH_SETTLE };
+
+	while (running && nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+static size_t sent(void)
+{
+	size_t i, num = 0;
+
+	for (i = 0; i < group_num; i++)
+		num += groups[i].count;
+
+	return num;
+}
+
+/* One trial: fork receiver, send flat out for --trial SEC, compare */
+static int trial(size_t len, size_t id)
+{
+	struct rx_result rx;
+	uint64_t start, wall, cpu;
+	size_t tx;
+	double tx_pps, rx_pps;
+	int fd[2];
+	pid_t pid;
+
+	if (pipe(fd)) {
+		ERROR("Failed creating pipe: %s", strerror(errno));
+		return -1;
+	}
+
+	fflush(NULL);
+	pid = fork();
+	if (pid < 0) {
+		ERROR("Failed starting receiver: %s", strerror(errno));
+		close(fd[0]);
+		close(fd[1]);
+		return -1;
+	}
+	if (!pid) {
+		close(fd[0]);
+		rx_run(fd[1], io[id].busy_poll);
+	}
+	close(fd[1]);
+
+	/* Wait for receiver to join all groups */
+	if (read(fd[0], &rx, sizeof(rx)) != sizeof(rx))
+		goto fail;
+
+	tx    = sent();
+	cpu   = cpu_time();
+	start = now_ns();
+	sender_trial(len, 0, search_trial);
+	wall  = now_ns() - start;
+	cpu   = cpu_time() - cpu;
+	tx    = sent() - tx;
+
+	settle();
+	kill(pid, SIGTERM);
+	if (read(fd[0], &rx, sizeof(rx)) != sizeof(rx))
+		goto fail;
+	close(fd[0]);
+	waitpid(pid, NULL, 0);
+
+	/* Interrupted, partial trial */
+	if (!running)
+		return 0;
+
+	tx_pps = (double)tx * NSEC_PER_SEC / wall;
+	rx_pps = (double)rx.count * NSEC_PER_SEC / wall;
+	PRINT("%6zu %6zu %-5s %10.0f %10.0f %8.1f %6.1f%% %6.1f%% %6.2f%%",
+	      group_num, len, io[id].name, tx_pps, rx_pps, rx_pps * len * 8 / 1000000,
+	      (double)cpu * 100000 / wall, (double)rx.cpu * 100000 / rx.wall,
+	      tx > rx.count ? (double)(tx - rx.count) * 100 / tx : 0.0);
+	DEBUG("Sent %zu, received %zu, dropped %zu by receiver socket buffers",
+	      tx, rx.count, rx.drops);
+
+	return 0;
+fail:
+	if (running)
+		ERROR("Receiver failed, see above.");
+	kill(pid, SIGTERM);
+	close(fd[0]);
+	waitpid(pid, NULL, 0);
+	return -1;
+}
+
+/*
+ * Sweep group counts, payload sizes, and receiver I/O backends, with
+ * the regular sender and receiver engines in two processes.  Groups
+ * are the first 1, 16, .. of the groups given, by default BENCH_GROUPS,
+ * and sizes are the --sizes given, or 100, 512, and 1472 bytes.
+ */
+int bench_run(void)
+{
+	const size_t nums[] = { 1, 16, 256 };
+	const size_t lens[] = { 100, 512, 1472 };
+	size_t max = group_num, num, len, i, j, k;
+	int ns;
+
+	/* IPv6 multicast is never looped back on lo, use the host's iface */
+	ns = need6 ? 1 : bench_netns();
+	if (ns < 0)
+		return 1;
+
+	/* On the host, looped back to our receiver, never leaves the host */
+	if (ns)
+		ttl = 0;
+
+	PRINT("Benchmark on %s, %s, %.1f sec per trial", iface,
+	      ns ? "host network with TTL 0" : "private network namespace",
+	      (double)search_trial / NSEC_PER_SEC);
+	PRINT("%6s %6s %-5s %10s %10s %8s %7s %7s %7s", "Groups", "Bytes", "I/O",
+	      "TX pps", "RX pps", "Mbps", "TX CPU", "RX CPU", "Loss");
+
+	for (i = 0; running && i < NELEMS(nums); i++) {
+		num = nums[i] < max ? nums[i] : max;
+		group_num = num;
+
+		for (j = 0; running && j < (model.num ? model.num : NELEMS(lens)); j++) {
+			len = model.num ? model.size[j] : lens[j];
+			if (rtp && len < RTP_HDR_LEN)
+				continue;
+
+			for (k = 0; running && k < NELEMS(io); k++) {
+				if (trial(len, k)) {
+					group_num = max;
+					return 1;
+				}
+			}
+		}
+
+		if (num == max)
+			break;
+	}
+	group_num = max;
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
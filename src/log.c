@@ -32,6 +32,8 @@
 
 #include "log.h"
 #include "mcjoin.h"
+#include "profile.h"
+#include "schedule.h"
 #include "screen.h"
 
 char **log_buf;			/* Ring buffer of LOG_MAX entries of width length */
@@ -178,11 +180,14 @@ void log_show(int signo)
 
 int logit(int prio, char *fmt, ...)
 {
+	struct prof_mark m = { 0 };
 	va_list ap;
 	time_t now;
 	char *snow;
 	int rc = 0;
 
+	/* Filtered out messages count too, e.g., DEBUG() in the hot path */
+	PROF_BEGIN(m);
 	va_start(ap, fmt);
 	if (log_syslog)
 		vsyslog(prio, fmt, ap);
@@ -192,6 +197,7 @@ int logit(int prio, char *fmt, ...)
 			char *ptr;
 			int i;
 
+			sched_ui_lock();
 			for (i = 0; i < LOG_POS; i++)
 				strlcpy(log_buf[i], log_buf[i + 1], log_width);
 
@@ -204,6 +210,7 @@ int logit(int prio, char *fmt, ...)
 
 			snprintf(log_buf[LOG_POS], width, "%24.24s  %s", snow, ptr);
 			log_show(0);
+			sched_ui_unlock();
 		} else {
 			FILE *fp = stdout;
 			int sync = 1;
@@ -219,6 +226,7 @@ int logit(int prio, char *fmt, ...)
 		}
 	}
 	va_end(ap);
+	PROF_END(m, PROF_LOG);
 
 	return rc;
 }
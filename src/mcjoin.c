@@ -22,7 +22,9 @@
 #include <errno.h>
 #include <getopt.h>
 #include <libgen.h>
+#include <limits.h>
 #include <poll.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -34,9 +36,15 @@
 #include <sys/resource.h>
 
 #include "addr.h"
+#include "bench.h"
 #include "log.h"
 #include "mcjoin.h"
+#include "netlink.h"
+#include "profile.h"
+#include "schedule.h"
 #include "screen.h"
+#include "search.h"
+#include "txtime.h"
 
 /* Mode flags */
 int old = 0;
@@ -51,35 +59,161 @@ int height = 24;
 size_t bytes = 100;
 size_t count = 0;
 int port = DEFAULT_PORT;
+int port_num = 1;		/* -p PORT-PORT, spread over groups */
 unsigned char ttl = 1;
 char *ident = PACKAGE_NAME;
 
 int need4 = 0;
 int need6 = 0;
 
+/* RTP mode */
+int rtp = 0;
+uint8_t rtp_pt = RTP_DEFAULT_PT;
+uint32_t rtp_ssrc = 0;
+uint32_t rtp_clock = RTP_DEFAULT_CLOCK;
+
+/* MPEG-TS analyzer */
+int mpegts = 0;
+
+/* File-backed stream sender */
+char *stream_file = NULL;
+uint64_t bitrate = 0;
+
+/* Capture replay sender */
+char *pcap_file = NULL;
+double speed = 1.0;
+
+/* Sender traffic shape */
+struct model model;
+
+/* Max lossless rate search */
+char *search_host = NULL;
+uint64_t search_trial = NSEC_PER_SEC;
+int control = 0;
+int bench = 0;
+
+/* Receive buffer size, 0 for auto-sizing */
+int rcvbuf = 0;
+
+/* Coalesced receive, UDP GRO */
+int gro = 0;
+
+/* Count in the kernel, XDP */
+int xdp = 0;
+
+/* Launch time pacing of the model sender, TXTIME_ETF, _FQ, or _USER */
+int txtime = 0;
+
+/* Sender TX timestamps, host transmit latency per group */
+int tx_stamps = 0;
+
+/* Sender socket per group, connected to the group */
+int connect_groups = 0;
+
+/* Sender source port(s), 0 for ephemeral */
+int sport = 0;
+int sport_num = 1;
+
+/* Send and receive frames on an AF_XDP socket */
+int af_xdp = 0;
+int af_xdp_queue = 0;
+
+/* Low-latency receive */
+int busy_poll = 0;
+int rx_latency = 0;
+
+/* Receiver reports CPU and NAPI ID (RX queue) each group arrives on */
+int incoming = 0;
+
+/* Scheduling of I/O and UI */
+char *io_cpu = NULL;
+char *ui_cpu = NULL;
+int sched_policy = SCHED_OTHER;
+int sched_prio = 0;
+int mlock_mem = 0;
+int prefault = 0;
+
+/* Per-stage cycle counters */
+int profile = 0;
+
+/* Round-trip latency */
+int reflect = 0;
+int latency = 0;
+char *return_group = NULL;
+
 size_t group_num = 0;
 struct gr groups[MAX_NUM_GROUPS];
 
 char iface[IFNAMSIZ + 1];
 
+/* Long-only options */
+enum {
+	OPT_RTP = 256,
+	OPT_RTP_PT,
+	OPT_RTP_SSRC,
+	OPT_RTP_CLOCK,
+	OPT_TS,
+	OPT_FROM_FILE,
+	OPT_BITRATE,
+	OPT_PCAP,
+	OPT_SPEED,
+	OPT_JITTER_DIST,
+	OPT_POISSON,
+	OPT_BURST,
+	OPT_SIZES,
+	OPT_SEARCH,
+	OPT_TRIAL,
+	OPT_CONTROL,
+	OPT_REFLECT,
+	OPT_RTT,
+	OPT_RCVBUF,
+	OPT_GRO,
+	OPT_XDP,
+	OPT_AF_XDP,
+	OPT_CONNECT,
+	OPT_SPORT,
+	OPT_TXTIME,
+	OPT_TX_STAMPS,
+	OPT_BUSY_POLL,
+	OPT_REALTIME,
+	OPT_RX_LATENCY,
+	OPT_INCOMING,
+	OPT_CPU,
+	OPT_UI_CPU,
+	OPT_SCHED,
+	OPT_MLOCK,
+	OPT_PREFAULT,
+	OPT_BENCH,
+	OPT_PROFILE,
+};
+
 volatile sig_atomic_t running = 1;
 volatile sig_atomic_t winchg  = 0;
+volatile sig_atomic_t relink  = 0;
 
 
 /* prepare next iteration */
+/* Only STATUS_POS is written by the I/O thread, the rest is ours */
+static char mark(struct gr *g)
+{
+	return __atomic_load_n(&g->status[STATUS_POS], __ATOMIC_RELAXED);
+}
+
 static void update(void)
 {
 	size_t i;
 
 	for (i = 0; i < group_num; i++) {
 		struct gr *g = &groups[i];
+		char c;
 
-		memmove(g->status, &g->status[1], STATUS_HISTORY - 1);
-		g->status[STATUS_POS] = ' ';
+		c = __atomic_exchange_n(&g->status[STATUS_POS], ' ', __ATOMIC_RELAXED);
+		memmove(g->status, &g->status[1], STATUS_POS - 1);
+		g->status[STATUS_POS - 1] = c;
 	}
 }
 
-static char spin(struct gr *g)
+static char spin(struct gr *g, char c)
 {
 	const char *spinner = "|/-\\";
 	size_t num = strlen(spinner);
@@ -87,7 +221,7 @@ static char spin(struct gr *g)
 
 	/* spin on activity only */
 	act = spinner[g->spin % num];
-	if (g->status[STATUS_POS] == '.')
+	if (c == '.')
 		g->spin++;
 
 	return act;
@@ -99,6 +233,9 @@ void plotter_show(int signo)
 	static inet_addr_t addr = { 0 };
 	static char hostname[80];
 	static int once = 1;
+	struct prof_mark m = { 0 };
+	char prof[160];
+	char lat[48];
 	time_t now;
 	char *snow;
 	int swidth;
@@ -112,7 +249,7 @@ void plotter_show(int signo)
 		for (i = 0; i < group_num; i++) {
 			struct gr *g = &groups[i];
 
-			if (g->status[STATUS_POS] == '.')
+			if (mark(g) == '.')
 				act = act == '.' ? '*' : '.';
 		}
 
@@ -123,6 +260,7 @@ void plotter_show(int signo)
 		return;
 	}
 
+	PROF_BEGIN(m);
 	if (once) {
 		once = 0;
 		gethostname(hostname, sizeof(hostname));
@@ -130,6 +268,11 @@ void plotter_show(int signo)
 		inet_address(&addr, buf, sizeof(buf));
 	}
 
+	if (sched_show(lat, sizeof(lat)) > 0) {
+		gotoxy(width - strlen(lat), TITLE_ROW);
+		fprintf(stderr, "\e[2m%s\e[0m", lat);
+	}
+
 	now = time(NULL);
 	snow = ctime(&now);
 	gotoxy(0, HOSTDATE_ROW);
@@ -145,15 +288,79 @@ void plotter_show(int signo)
 	for (i = 0; i < group_num; i++) {
 		struct gr *g = &groups[i];
 		char sgbuf[35];
+		char c = mark(g);
 
 		gotoxy(0, GROUP_ROW + i);
-		act = spin(g);
+		act = spin(g, c);
 
 		snprintf(sgbuf, sizeof(sgbuf), "%s,%s", g->source ? g->source : "*", g->group);
-		fprintf(stderr, "%-31s  %c [%s] %13zu", sgbuf, act, &g->status[spos], g->count);
+		fprintf(stderr, "%-31s  %c [%.*s%c] %13zu", sgbuf, act, STATUS_POS - spos,
+			&g->status[spos], c, g->count);
+	}
+
+	if (prof_show(prof, sizeof(prof)) > 0) {
+		gotoxy(0, PROFILE_ROW);
+		fprintf(stderr, "\e[2m%.*s\e[0m\e[K", width, prof);
 	}
 
 	update();
+	PROF_END(m, PROF_RENDER);
+}
+
+static void show_rxq(struct gr *g, int gwidth)
+{
+	size_t net = g->rxq.lost > g->rxq.drops ? g->rxq.lost - g->rxq.drops : 0;
+
+	/* Packets counted by XDP never reach the socket */
+	if (xdp || (!g->gaps && !g->rxq.drops))
+		return;
+
+	PRINT("      %-*s Lost %zu: local overflow %zu, network %zu; gaps local %zu, "
+	      "network %zu; buffer peak %u of %d bytes", gwidth, "",
+	      g->rxq.lost > g->rxq.drops ? g->rxq.lost : g->rxq.drops, g->rxq.drops,
+	      net, g->rxq.gap_local, g->rxq.gap_net, g->rxq.rmem_peak, g->rxq.rcvbuf);
+}
+
+static void show_rtp(struct gr *g, int gwidth)
+{
+	if (!g->rtp.valid)
+		return;
+
+	PRINT("      %-*s RTP SSRC 0x%08x PT %u, seq %u, lost %zu, late/dup %zu, "
+	      "jitter %.3f ms, SSRC changes %zu", gwidth, "",
+	      g->rtp.ssrc, g->rtp.pt, rtp_extseq(&g->rtp), rtp_lost(&g->rtp),
+	      g->rtp.reordered, rtp_jitter(&g->rtp, rtp_clock),
+	      g->rtp.ssrc_changes);
+}
+
+static void show_ts(struct gr *g, int gwidth)
+{
+	struct ts *ts = g->ts;
+	size_t i;
+
+	if (!ts || !ts->packets)
+		return;
+
+	PRINT("      %-*s MPEG-TS %zu packets, %.3f Mbps, CC errors %zu, sync errors %zu",
+	      gwidth, "", ts->packets, ts_bitrate(ts, ts->packets) / 1000000,
+	      ts->cc_errors, ts->sync_errors);
+	if (ts->untracked)
+		PRINT("      %-*s %zu packets on untracked PIDs, max %d PIDs",
+		      gwidth, "", ts->untracked, TS_MAX_PIDS);
+
+	for (i = 0; i < ts->num; i++) {
+		struct ts_pid *st = &ts->pid[i];
+
+		PRINT("      %-*s   PID %4u %9.3f Mbps, CC errors %zu", gwidth, "",
+		      st->pid, ts_bitrate(ts, st->packets) / 1000000, st->cc_errors);
+		if (st->pcr_jit_num)
+			PRINT("      %-*s            PCR interval max %.1f ms (errors %zu, discont. %zu), "
+			      "jitter max %.3f avg %.3f ms, accuracy %.0f ns", gwidth, "",
+			      st->pcr_int_max / 1000000.0, st->pcr_errors, st->pcr_disc,
+			      st->pcr_jit_max / 1000000.0,
+			      st->pcr_jit_sum / 1000000.0 / st->pcr_jit_num,
+			      (double)st->pcr_ac_max);
+	}
 }
 
 static void show_stats(void)
@@ -168,13 +375,32 @@ static void show_stats(void)
 		}
 
 		for (i = 0; i < group_num; i++) {
+			struct gr *g = &groups[i];
+
 			PRINT("Group %-*s received %zu packets, gaps: %zu", gwidth,
-			      groups[i].group, groups[i].count, groups[i].gaps);
-			total_count += groups[i].count;
+			      g->group, g->count, g->gaps);
+			show_rxq(g, gwidth);
+			if (rtp)
+				show_rtp(g, gwidth);
+			if (mpegts)
+				show_ts(g, gwidth);
+			total_count += g->count;
 		}
 
 		PRINT("\nReceived total: %zu packets", total_count);
+		receiver_stats();
+	} else
+		sender_stats();
+
+	if (io_cpu || sched_policy != SCHED_OTHER || mlock_mem || prefault) {
+		char lat[64];
+
+		if (sched_show(lat, sizeof(lat)) > 0)
+			PRINT("%sScheduling %s", join ? "" : "\n", lat);
 	}
+
+	nl_stats();
+	prof_stats();
 }
 
 void timer_init(void (*cb)(int))
@@ -185,6 +411,12 @@ void timer_init(void (*cb)(int))
 	};
 	struct itimerval times;
 
+	/* Screen updates in their own thread, off the I/O CPU(s) */
+	if (cb == plotter_show && !sched_ui(cb))
+		return;
+	if (ui_cpu && cb != plotter_show)
+		PRINT("Screen is updated by the periodic sender, ignoring --ui-cpu");
+
 	sigaction(SIGALRM, &sa, NULL);
 
 	/* wait a bit (1 sec) for system to "stabilize" */
@@ -218,6 +450,7 @@ static void redraw(int signo)
 		hidecursor();
 	}
 
+	sched_ui_lock();
 	cls();
 	gotoxy((width - strlen(title)) / 2, TITLE_ROW);
 	fprintf(stderr, "\e[1m%s\e[0m", title);
@@ -233,6 +466,7 @@ static void redraw(int signo)
 		plotter_show(signo);
 		log_show(signo);
 	}
+	sched_ui_unlock();
 }
 
 static void sigwinch_cb(int signo)
@@ -254,9 +488,25 @@ static int loop(void)
 		rc = sender_init();
 	else
 		rc = receiver_init();
+	if (!rc)
+		rc = sched_init();
+	if (!rc)
+		prof_init();
 
+	redraw(0);
 	while (!rc && running) {
-		redraw(winchg);
+		if (winchg)
+			redraw(winchg);
+
+		/* Link or address change, redo sockets and joins */
+		if (relink) {
+			if (!join)
+				rc = sender_relink();
+			else
+				rc = receiver_relink();
+			if (rc)
+				break;
+		}
 
 		if (!join)
 			rc = sender();
@@ -264,6 +514,7 @@ static int loop(void)
 			rc = receiver(count);
 	}
 
+	sched_exit();
 	if (!rc) {
 		DEBUG("Leaving main loop");
 		show_stats();
@@ -290,7 +541,7 @@ static int usage(int code)
 		ifdefault(iface, sizeof(iface));
 
 	printf("Usage: %s [-dhjosv] [-c COUNT] [-f MSEC ][-i IFACE] [-l LEVEL] [-p PORT]\n"
-	       "              [-r SEC] [-t TTL] [-w SEC]\n"
+	       "              [-J MSEC] [-r SEC] [-t TTL] [-w SEC] [--rtp ...]\n"
 	       "              [[SOURCE,]GROUP0 .. [SOURCE,]GROUPN | [SOURCE,]GROUP+NUM]\n"
 	       "Options:\n"
 	       "  -b BYTES    Payload in bytes over IP/UDP header (42 bytes), default: 100\n"
@@ -300,16 +551,94 @@ static int usage(int code)
 	       "  -h          This help text\n"
 	       "  -i IFACE    Interface to use for sending/receiving multicast, default: %s\n"
 	       "  -j          Join groups, default unless acting as sender\n"
+	       "  -J MSEC     Add MSEC random jitter to each sent packet, e.g. 0.5\n"
 	       "  -l LEVEL    Set log level; none, notice*, debug\n"
 	       "  -o          Old (plain/ordinary) output, no fancy progress bars\n"
-	       "  -p PORT     UDP port number to send/listen to, default: %d\n"
+	       "  -p PORT[-PORT]\n"
+	       "              UDP port to send/listen to, default: %d.  With a range, the\n"
+	       "              groups are spread over the ports, one port per group in turn\n"
 	       "  -s          Act as sender, sends packets to select groups, default: no\n"
 	       "  -t TTL      TTL to use when sending multicast packets, default: 1\n"
 	       "  -v          Display program version\n"
-	       "  -w SEC      Initial wait before opening sockets\n"
+	       "  -w SEC      Initial wait before opening sockets, on Linux the interface\n"
+	       "              and its address are waited for anyway\n"
+	       "\n"
+	       "  --rtp       Send RTP instead of text payload, or parse RTP when receiving\n"
+	       "  --rtp-pt PT Payload type of sent RTP packets, default: %d\n"
+	       "  --rtp-ssrc SSRC\n"
+	       "              SSRC of sent RTP packets, default: random\n"
+	       "  --rtp-clock HZ\n"
+	       "              RTP timestamp clock rate, for send and jitter, default: %d\n"
+	       "  --ts        Analyze received MPEG-TS, raw or in RTP: CC errors per PID,\n"
+	       "              PCR interval, jitter and accuracy, and PID bitrates\n"
+	       "  --from-file FILE\n"
+	       "              Send contents of FILE, MPEG-TS as 7x188 byte datagrams, other\n"
+	       "              files as BYTES long datagrams.  Loops at end of file\n"
+	       "  --bitrate RATE\n"
+	       "              Constant bitrate for --from-file, e.g. 5M, default: PCR timing\n"
+	       "  --pcap FILE Replay UDP payloads in pcap/pcapng FILE, each flow mapped to a\n"
+	       "              group, with original timing\n"
+	       "  --speed X   Replay speed factor, 0 for top speed, default: 1\n"
+	       "  --jitter-dist DIST\n"
+	       "              Jitter distribution, uniform in +/- MSEC, or normal with\n"
+	       "              MSEC standard deviation, default: uniform\n"
+	       "  --poisson   Poisson arrivals, exponential gaps with mean from -f MSEC\n"
+	       "  --burst N   Send packets in trains of N back-to-back, same average rate\n"
+	       "  --sizes MIX Payload size mix, `imix` or SIZE[:WEIGHT][,SIZE[:WEIGHT]..]\n"
+	       "  --search ADDR\n"
+	       "              Find max lossless rate per group, for each of --sizes, with\n"
+	       "              a receiver at unicast ADDR running with --control\n"
+	       "  --trial SEC Length of each --search or --bench trial, default: 1\n"
+	       "  --control   Receiver answers --search requests on UDP port PORT+1,\n"
+	       "              or the port after the last one in a -p range\n"
+	       "  --bench     Benchmark max pps of sender and receiver on this host, over\n"
+	       "              loopback, for 1, 16, and 256 groups, and each of --sizes\n"
+	       "  --rcvbuf SIZE\n"
+	       "              Receive buffer size, e.g. 4M, default: auto-sized from rate\n"
+	       "  --gro       Receiver reads bursts of each group coalesced by UDP GRO\n"
+	       "  --xdp       Receiver counts packets, and RTP gaps, in the kernel with\n"
+	       "              XDP on IFACE, packets to the groups are dropped there\n"
+	       "  --af-xdp[=QUEUE]\n"
+	       "              Send and receive frames on an AF_XDP socket bound to QUEUE of\n"
+	       "              IFACE, default: 0.  Zero-copy if the driver supports it\n"
+	       "  --connect   Sender uses one socket per group, connected to the group,\n"
+	       "              to skip the route lookup of each sendto()\n"
+	       "  --sport PORT[-PORT]\n"
+	       "              Sender source port, default: ephemeral.  A range spreads the\n"
+	       "              groups over the ports, for ECMP and RSS hashing, and implies\n"
+	       "              --connect\n"
+	       "  --txtime[=QDISC]\n"
+	       "              Sender hands packets to the kernel 2 ms ahead, each with its\n"
+	       "              launch time, for the etf (default) or fq qdisc on IFACE, or\n"
+	       "              `user` to pace in userspace.  Reports launch accuracy\n"
+	       "  --tx-stamps Sender shows time from schedule to send syscall, and on to\n"
+	       "              the wire, per group, from TX timestamps of driver or NIC\n"
+	       "  --busy-poll[=USEC]\n"
+	       "              Receiver spins on non-blocking reads on the CPU it started on,\n"
+	       "              with SO_BUSY_POLL set to USEC, default: 50.  Implies --rx-latency\n"
+	       "  --realtime  Same as --sched fifo:10 --mlock\n"
+	       "  --rx-latency\n"
+	       "              Receiver shows histogram of kernel to application latency\n"
+	       "  --incoming  Receiver shows CPU and NAPI ID, i.e., RX queue, each group\n"
+	       "              arrives on, to verify RSS spreads groups over queues and CPUs\n"
+	       "  --cpu LIST  Pin sending/receiving to CPU(s) in LIST, e.g. 2 or 1-3,6\n"
+	       "  --ui-cpu LIST\n"
+	       "              Update screen from a separate thread, pinned to CPU(s) in LIST\n"
+	       "  --sched POLICY[:PRIO]\n"
+	       "              Scheduling of sending/receiving, fifo, rr, or other (default)\n"
+	       "  --mlock     Lock all memory, current and future, to avoid page faults\n"
+	       "  --prefault  Touch stack and all buffers at startup\n"
+	       "  --profile   Count cycles spent per stage of sending/receiving, and\n"
+	       "              syscalls per second, shown live and in summary at exit\n"
+	       "  --reflect[=GROUP]\n"
+	       "              Receiver echoes header of each packet back to the sender,\n"
+	       "              or to a return GROUP, for --rtt\n"
+	       "  --rtt[=GROUP]\n"
+	       "              Sender measures round-trip time per group from echoes of a\n"
+	       "              --reflect receiver, unicast or on return GROUP\n"
 	       "\n"
 	       "Bug report address : %-40s\n", ident, period / 1000, iface, DEFAULT_PORT,
-	       PACKAGE_BUGREPORT);
+	       RTP_DEFAULT_PT, RTP_DEFAULT_CLOCK, PACKAGE_BUGREPORT);
 #ifdef PACKAGE_URL
 	printf("Project homepage   : %s\n", PACKAGE_URL);
 #endif
@@ -317,6 +646,93 @@ static int usage(int code)
 	return code;
 }
 
+/* Parse rate with optional k/M/G suffix, returns 0 on error */
+static uint64_t rate(const char *arg)
+{
+	char *end;
+	double val;
+
+	val = strtod(arg, &end);
+	switch (*end) {
+	case 'k':
+	case 'K':
+		val *= 1000;
+		break;
+
+	case 'm':
+	case 'M':
+		val *= 1000000;
+		break;
+
+	case 'g':
+	case 'G':
+		val *= 1000000000;
+		break;
+
+	case 0:
+		break;
+
+	default:
+		return 0;
+	}
+
+	if (val < 1)
+		return 0;
+
+	return (uint64_t)val;
+}
+
+/* Parse POLICY[:PRIO], i.e., fifo, rr, or other */
+static int policy(const char *arg)
+{
+	const char *ptr;
+	size_t len;
+
+	ptr = strchr(arg, ':');
+	len = ptr ? (size_t)(ptr - arg) : strlen(arg);
+
+	if (!strncmp(arg, "fifo", len) && len == 4)
+		sched_policy = SCHED_FIFO;
+	else if (!strncmp(arg, "rr", len) && len == 2)
+		sched_policy = SCHED_RR;
+	else if (!strncmp(arg, "other", len) && len == 5)
+		sched_policy = SCHED_OTHER;
+	else
+		return -1;
+
+	sched_prio = sched_policy == SCHED_OTHER ? 0 : REALTIME_PRIO;
+	if (ptr)
+		sched_prio = atoi(ptr + 1);
+
+	if (sched_prio < sched_get_priority_min(sched_policy) ||
+	    sched_prio > sched_get_priority_max(sched_policy))
+		return -1;
+
+	return 0;
+}
+
+/* Parse PORT[-PORT], at most max, returns -1 on error */
+static int port_range(const char *arg, int max, int *lo, int *num)
+{
+	char *end;
+	long first, last;
+
+	first = strtol(arg, &end, 10);
+	last  = first;
+	if (*end == '-')
+		last = strtol(end + 1, &end, 10);
+
+	if (*end || first < 1 || last < first || last > max)
+		return -1;
+	if (first < 1024 && geteuid())
+		ERROR("Must be root to use privileged ports (< 1024)");
+
+	*lo  = (int)first;
+	*num = (int)(last - first + 1);
+
+	return 0;
+}
+
 static char *progname(char *arg0)
 {
        char *nm;
@@ -332,11 +748,53 @@ static char *progname(char *arg0)
 
 int main(int argc, char *argv[])
 {
+	struct option long_options[] = {
+		{ "rtp",       no_argument,       NULL, OPT_RTP       },
+		{ "rtp-pt",    required_argument, NULL, OPT_RTP_PT    },
+		{ "rtp-ssrc",  required_argument, NULL, OPT_RTP_SSRC  },
+		{ "rtp-clock", required_argument, NULL, OPT_RTP_CLOCK },
+		{ "ts",        no_argument,       NULL, OPT_TS        },
+		{ "from-file", required_argument, NULL, OPT_FROM_FILE },
+		{ "bitrate",   required_argument, NULL, OPT_BITRATE   },
+		{ "pcap",      required_argument, NULL, OPT_PCAP      },
+		{ "speed",     required_argument, NULL, OPT_SPEED     },
+		{ "jitter-dist", required_argument, NULL, OPT_JITTER_DIST },
+		{ "poisson",   no_argument,       NULL, OPT_POISSON   },
+		{ "burst",     required_argument, NULL, OPT_BURST     },
+		{ "sizes",     required_argument, NULL, OPT_SIZES     },
+		{ "search",    required_argument, NULL, OPT_SEARCH    },
+		{ "trial",     required_argument, NULL, OPT_TRIAL     },
+		{ "control",   no_argument,       NULL, OPT_CONTROL   },
+		{ "reflect",   optional_argument, NULL, OPT_REFLECT   },
+		{ "rtt",       optional_argument, NULL, OPT_RTT       },
+		{ "rcvbuf",    required_argument, NULL, OPT_RCVBUF    },
+		{ "gro",       no_argument,       NULL, OPT_GRO       },
+		{ "xdp",       no_argument,       NULL, OPT_XDP       },
+		{ "af-xdp",    optional_argument, NULL, OPT_AF_XDP    },
+		{ "connect",   no_argument,       NULL, OPT_CONNECT   },
+		{ "sport",     required_argument, NULL, OPT_SPORT     },
+		{ "txtime",    optional_argument, NULL, OPT_TXTIME    },
+		{ "tx-stamps", no_argument,       NULL, OPT_TX_STAMPS },
+		{ "busy-poll", optional_argument, NULL, OPT_BUSY_POLL },
+		{ "realtime",  no_argument,       NULL, OPT_REALTIME  },
+		{ "rx-latency", no_argument,      NULL, OPT_RX_LATENCY },
+		{ "incoming",  no_argument,       NULL, OPT_INCOMING  },
+		{ "cpu",       required_argument, NULL, OPT_CPU       },
+		{ "ui-cpu",    required_argument, NULL, OPT_UI_CPU    },
+		{ "sched",     required_argument, NULL, OPT_SCHED     },
+		{ "mlock",     no_argument,       NULL, OPT_MLOCK     },
+		{ "prefault",  no_argument,       NULL, OPT_PREFAULT  },
+		{ "bench",     no_argument,       NULL, OPT_BENCH     },
+		{ "profile",   no_argument,       NULL, OPT_PROFILE   },
+		{ NULL, 0, NULL, 0 }
+	};
 	struct sigaction sa = {
 		.sa_flags = SA_RESTART,
 		.sa_handler = exit_loop,
 	};
+	char *bench_groups[] = { BENCH_GROUPS };
 	struct rlimit rlim;
+	uint64_t size;
 	size_t ilen;
 	int wait = 0;
 	int i, c;
@@ -345,7 +803,7 @@ int main(int argc, char *argv[])
 		memset(&groups[i], 0, sizeof(groups[0]));
 
 	ident = progname(argv[0]);
-	while ((c = getopt(argc, argv, "b:c:df:hi:jl:op:st:vw:")) != EOF) {
+	while ((c = getopt_long(argc, argv, "b:c:df:hi:jJ:l:op:st:vw:", long_options, NULL)) != EOF) {
 		switch (c) {
 		case 'b':
 			bytes = (size_t)atoi(optarg);
@@ -385,6 +843,10 @@ int main(int argc, char *argv[])
 			join++;
 			break;
 
+		case 'J':
+			model.jitter = (uint64_t)(atof(optarg) * 1000000);
+			break;
+
 		case 'l':
 			if (log_level(optarg)) {
 				ERROR("Invalid log level: %s", strerror(errno));
@@ -397,9 +859,11 @@ int main(int argc, char *argv[])
 			break;
 
 		case 'p':
-			port = atoi(optarg);
-			if (port < 1024 && geteuid())
-				ERROR("Must be root to use privileged ports (< 1024)");
+			/* Room for the --search control channel after the range */
+			if (port_range(optarg, 65535 - SEARCH_PORT_OFFSET, &port, &port_num)) {
+				ERROR("Invalid port or port range: %s", optarg);
+				return 1;
+			}
 			break;
 
 		case 's':
@@ -418,13 +882,297 @@ int main(int argc, char *argv[])
 			wait = atoi(optarg);
 			break;
 
+		case OPT_RTP:
+			rtp = 1;
+			break;
+
+		case OPT_RTP_PT:
+			rtp = 1;
+			rtp_pt = (uint8_t)atoi(optarg) & 0x7f;
+			break;
+
+		case OPT_RTP_SSRC:
+			rtp = 1;
+			rtp_ssrc = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+
+		case OPT_RTP_CLOCK:
+			rtp = 1;
+			rtp_clock = (uint32_t)strtoul(optarg, NULL, 0);
+			if (!rtp_clock) {
+				ERROR("Invalid RTP clock rate: %s", optarg);
+				return 1;
+			}
+			break;
+
+		case OPT_TS:
+			mpegts = 1;
+			break;
+
+		case OPT_FROM_FILE:
+			stream_file = optarg;
+			join = 0;
+			break;
+
+		case OPT_BITRATE:
+			bitrate = rate(optarg);
+			if (!bitrate) {
+				ERROR("Invalid bitrate: %s", optarg);
+				return 1;
+			}
+			break;
+
+		case OPT_PCAP:
+			pcap_file = optarg;
+			join = 0;
+			break;
+
+		case OPT_SPEED:
+			speed = atof(optarg);
+			if (speed < 0.0) {
+				ERROR("Invalid replay speed: %s", optarg);
+				return 1;
+			}
+			break;
+
+		case OPT_JITTER_DIST:
+			if (!strcmp(optarg, "normal"))
+				model.dist = JITTER_NORMAL;
+			else if (!strcmp(optarg, "uniform"))
+				model.dist = JITTER_UNIFORM;
+			else {
+				ERROR("Invalid jitter distribution: %s", optarg);
+				return 1;
+			}
+			break;
+
+		case OPT_POISSON:
+			model.poisson = 1;
+			break;
+
+		case OPT_BURST:
+			model.burst = (size_t)atoi(optarg);
+			if (model.burst < 1) {
+				ERROR("Invalid burst length: %s", optarg);
+				return 1;
+			}
+			break;
+
+		case OPT_SIZES:
+			if (model_sizes(&model, optarg, BUFSZ)) {
+				ERROR("Invalid size mix: %s", optarg);
+				return 1;
+			}
+			break;
+
+		case OPT_SEARCH:
+			search_host = optarg;
+			join = 0;
+			break;
+
+		case OPT_TRIAL:
+			search_trial = (uint64_t)(atof(optarg) * NSEC_PER_SEC);
+			if (search_trial < NSEC_PER_SEC / 10) {
+				ERROR("Too short trial, min 0.1 sec: %s", optarg);
+				return 1;
+			}
+			break;
+
+		case OPT_CONTROL:
+			control = 1;
+			break;
+
+		case OPT_REFLECT:
+			reflect = 1;
+			return_group = optarg;
+			break;
+
+		case OPT_RTT:
+			latency = 1;
+			return_group = optarg;
+			join = 0;
+			break;
+
+		case OPT_RCVBUF:
+			size = rate(optarg);
+			if (!size || size > INT_MAX / 2) {
+				ERROR("Invalid receive buffer size: %s", optarg);
+				return 1;
+			}
+			rcvbuf = (int)size;
+			break;
+
+		case OPT_GRO:
+			gro = 1;
+			break;
+
+		case OPT_XDP:
+			xdp = 1;
+			break;
+
+		case OPT_AF_XDP:
+			af_xdp = 1;
+			af_xdp_queue = optarg ? atoi(optarg) : 0;
+			if (af_xdp_queue < 0) {
+				ERROR("Invalid AF_XDP queue: %s", optarg);
+				return 1;
+			}
+			break;
+
+		case OPT_CONNECT:
+			connect_groups = 1;
+			break;
+
+		case OPT_SPORT:
+			if (port_range(optarg, 65535, &sport, &sport_num)) {
+				ERROR("Invalid source port or port range: %s", optarg);
+				return 1;
+			}
+			break;
+
+		case OPT_TXTIME:
+			txtime = txtime_parse(optarg);
+			if (txtime < 0) {
+				ERROR("Invalid launch time qdisc: %s", optarg);
+				return 1;
+			}
+			break;
+
+		case OPT_TX_STAMPS:
+			tx_stamps = 1;
+			break;
+
+		case OPT_BUSY_POLL:
+			busy_poll = optarg ? atoi(optarg) : BUSY_POLL_USEC;
+			if (busy_poll <= 0) {
+				ERROR("Invalid busy poll time: %s", optarg);
+				return 1;
+			}
+			rx_latency = 1;
+			break;
+
+		case OPT_REALTIME:
+			sched_policy = SCHED_FIFO;
+			sched_prio = REALTIME_PRIO;
+			mlock_mem = 1;
+			break;
+
+		case OPT_INCOMING:
+			incoming = 1;
+			break;
+
+		case OPT_RX_LATENCY:
+			rx_latency = 1;
+			break;
+
+		case OPT_CPU:
+			io_cpu = optarg;
+			break;
+
+		case OPT_UI_CPU:
+			ui_cpu = optarg;
+			break;
+
+		case OPT_SCHED:
+			if (policy(optarg)) {
+				ERROR("Invalid scheduling policy: %s", optarg);
+				return 1;
+			}
+			break;
+
+		case OPT_MLOCK:
+			mlock_mem = 1;
+			break;
+
+		case OPT_PREFAULT:
+			prefault = 1;
+			break;
+
+		case OPT_BENCH:
+			bench = 1;
+			old = 1;
+			break;
+
+		case OPT_PROFILE:
+			profile = 1;
+			break;
+
 		default:
 			return usage(1);
 		}
 	}
 
-	if (optind == argc)
-		groups[group_num++].group = strdup(DEFAULT_GROUP);
+	if (optind == argc) {
+		if (bench) {
+			argv = bench_groups;
+			argc = NELEMS(bench_groups);
+			optind = 0;
+		} else
+			groups[group_num++].group = strdup(DEFAULT_GROUP);
+	}
+
+	if (rtp && bytes < RTP_HDR_LEN) {
+		ERROR("Too short payload for RTP, min %d bytes", RTP_HDR_LEN);
+		return 1;
+	}
+	for (i = 0; rtp && !bench && i < (int)model.num; i++) {
+		if (model.size[i] < RTP_HDR_LEN) {
+			ERROR("Too short size %zu in --sizes for RTP, min %d bytes",
+			      model.size[i], RTP_HDR_LEN);
+			return 1;
+		}
+	}
+
+	if (gro && reflect) {
+		ERROR("Cannot reflect coalesced packets, --gro and --reflect are exclusive");
+		return 1;
+	}
+
+	if (xdp && (gro || reflect || busy_poll || mpegts)) {
+		ERROR("Packets are counted in the kernel with --xdp, not received");
+		return 1;
+	}
+
+	if (af_xdp && (xdp || gro || reflect || rx_latency)) {
+		ERROR("Frames bypass the socket layer with --af-xdp, cannot be combined "
+		      "with --xdp, --gro, --reflect, --busy-poll, or --rx-latency");
+		return 1;
+	}
+
+	if (txtime && (af_xdp || latency || search_host || pcap_file || stream_file)) {
+		ERROR("Launch time is only supported by the traffic model sender, not with "
+		      "--af-xdp, --rtt, --search, --pcap, or --from-file");
+		return 1;
+	}
+
+	if (tx_stamps && (af_xdp || latency || search_host || bench)) {
+		ERROR("TX timestamps are not supported with --af-xdp, --rtt, --search, or --bench");
+		return 1;
+	}
+
+	if ((port_num > 1 || sport) && (xdp || af_xdp)) {
+		ERROR("Port ranges and --sport are not supported with --xdp or --af-xdp");
+		return 1;
+	}
+
+	if (incoming && (xdp || af_xdp)) {
+		ERROR("Packets bypass the socket with --xdp and --af-xdp, cannot use --incoming");
+		return 1;
+	}
+
+	/* Source port range, a socket per group bound to its own port */
+	if (sport_num > 1)
+		connect_groups = 1;
+
+	if (connect_groups && (af_xdp || latency)) {
+		ERROR("Connected sockets, with --connect or a --sport range, cannot be "
+		      "combined with --af-xdp or --rtt");
+		return 1;
+	}
+
+	srandom(time(NULL) ^ getpid());
+	if (rtp && !rtp_ssrc)
+		rtp_ssrc = (uint32_t)random();
 
 	if (!foreground) {
 		if (daemonize()) {
@@ -439,6 +1187,9 @@ int main(int argc, char *argv[])
 
 	log_init(foreground, ident);
 
+	/* Before ifdefault(), the startup dump resolves the default route */
+	if (!bench)
+		nl_init();
 	if (!iface[0])
 		ifdefault(iface, sizeof(iface));
 
@@ -541,6 +1292,29 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/*
+	 * A receiver reads the sequence number from the text payload, a
+	 * shorter size cuts it off.  Bench and search only count packets.
+	 */
+	if (model.num && !rtp && !bench && !search_host) {
+		size_t min = 0;
+
+		for (i = 0; i < (int)group_num; i++) {
+			size_t len = sender_text_min(groups[i].group);
+
+			if (len > min)
+				min = len;
+		}
+
+		for (i = 0; i < (int)model.num; i++) {
+			if (model.size[i] < min) {
+				ERROR("Too short size %zu in --sizes, min %zu bytes, or use --rtp",
+				      model.size[i], min);
+				return 1;
+			}
+		}
+	}
+
 	for (i = 0; i < (int)group_num; i++) {
 #ifdef AF_INET6
 		if (strchr(groups[i].group, ':')) {
@@ -549,7 +1323,7 @@ int main(int argc, char *argv[])
 
 			inet_pton(AF_INET6, groups[i].group, &grp->sin6_addr);
 			grp->sin6_family = AF_INET6;
-			grp->sin6_port   = htons(port);
+			grp->sin6_port   = htons(port + i % port_num);
 
 			if (groups[i].source) {
 				inet_pton(AF_INET6, groups[i].source, &src->sin6_addr);
@@ -565,7 +1339,7 @@ int main(int argc, char *argv[])
 
 			inet_pton(AF_INET, groups[i].group, &grp->sin_addr);
 			grp->sin_family = AF_INET;
-			grp->sin_port   = htons(port);
+			grp->sin_port   = htons(port + i % port_num);
 
 			if (groups[i].source) {
 				inet_pton(AF_INET, groups[i].source, &src->sin_addr);
@@ -591,6 +1365,9 @@ int main(int argc, char *argv[])
 	sigaction(SIGHUP,  &sa, NULL);
 	sigaction(SIGTERM, &sa, NULL);
 
+	if (bench)
+		return bench_run();
+
 	return loop();
 }
 
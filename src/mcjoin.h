@@ -22,8 +22,15 @@
 
 #include "addr.h"
 #include "log.h"
+#include "model.h"
+#include "rtp.h"
+#include "ts.h"
 
 #define BUFSZ           1606	/* +42 => 1648 */
+#define GRO_BUFSZ       65535	/* Max UDP GRO super-buffer */
+#define RECV_BATCH      32	/* Max packets per recvmmsg() */
+#define SEND_BATCH      64	/* Max packets per sendmmsg() */
+#define TX_BACKOFF      20000	/* ns to wait on ENOBUFS before retry */
 #define MAX_NUM_GROUPS  2048
 #define DEFAULT_GROUP   "225.1.2.3"
 #define DEFAULT_PORT    1234
@@ -31,14 +38,27 @@
 #define SEQ_KEY         "count: "
 #define FREQ_KEY        "freq: "
 
+#define NSEC_PER_SEC    1000000000ULL
+
+#define RCVBUF_WINDOW   200	/* msec of traffic to fit in SO_RCVBUF */
+#define RCVBUF_OVERHEAD 768	/* Approx. kernel overhead per packet */
+#define RCVBUF_MAX      (64 * 1024 * 1024)
+
+#define BUSY_POLL_USEC  50	/* Default SO_BUSY_POLL time */
+#define REALTIME_PRIO   10	/* Default SCHED_FIFO/RR priority */
+
 #define STATUS_HISTORY  1024
 #define STATUS_POS      (STATUS_HISTORY - 2)
 
+/* Activity this period, set by I/O while a --ui-cpu thread may shift history */
+#define STATUS_MARK(g, c) __atomic_store_n(&(g)->status[STATUS_POS], (c), __ATOMIC_RELAXED)
+
 /* Positions on screen for ui */
 #define TITLE_ROW       1
 #define HOSTDATE_ROW    2
 #define HEADING_ROW     3
 #define GROUP_ROW       4
+#define PROFILE_ROW     (group_num + GROUP_ROW)
 #define LOGHEADING_ROW  (group_num + GROUP_ROW + 1)
 #define LOG_ROW         (LOGHEADING_ROW + 1)
 #define EXIT_ROW        (LOG_ROW + LOG_MAX)
@@ -48,6 +68,31 @@
 #define NELEMS(array) (sizeof(array) / sizeof(array[0]))
 #endif
 
+/* Receive queue, local socket buffer overflow vs. network loss */
+struct rxq {
+	uint32_t     ovfl;		/* Last SO_RXQ_OVFL drop counter */
+	size_t       drops;		/* Packets dropped by our socket */
+	size_t       lost;		/* Packets missing in sequence */
+	size_t       gap_local;		/* Gaps with local drops */
+	size_t       gap_net;		/* Gaps without, i.e., network */
+	uint32_t     rmem_peak;		/* Highest SO_MEMINFO rmem_alloc */
+	int          rcvbuf;		/* Current SO_RCVBUF, as reported */
+	uint64_t     bytes;		/* Received, for rate estimate */
+	size_t       mark_count;	/* count, bytes, drops at last sample */
+	uint64_t     mark_bytes;
+	size_t       mark_drops;
+	int          backlog;		/* Last read was a full batch */
+};
+
+/* Where a group arrives, SO_INCOMING_CPU and SO_INCOMING_NAPI_ID */
+struct rxcpu {
+	int          cpu;		/* Last CPU, -1 until known */
+	unsigned int napi;		/* Last NAPI ID, 0 if none */
+	uint64_t     cpus;		/* CPUs seen, one bit each for 0-63 */
+	size_t       moves;		/* Changes of CPU or NAPI ID */
+	int          peer;		/* Socket connected to first sender */
+};
+
 /* Group info */
 struct gr {
 	int          sd;
@@ -61,6 +106,11 @@ struct gr {
 
 	char         status[STATUS_HISTORY];
 	size_t       spin;
+
+	struct rxq   rxq;
+	struct rxcpu rxcpu;
+	struct rtp   rtp;
+	struct ts   *ts;
 };
 
 extern int old;
@@ -74,15 +124,63 @@ extern int need6;
 extern char iface[];
 
 extern int period;
+extern int port;
+extern int port_num;
 extern size_t bytes;
 extern size_t count;
 extern unsigned char ttl;
 
+extern int rtp;
+extern uint8_t rtp_pt;
+extern uint32_t rtp_ssrc;
+extern uint32_t rtp_clock;
+
+extern int mpegts;
+
+extern char *stream_file;
+extern uint64_t bitrate;
+
+extern char *pcap_file;
+extern double speed;
+
+extern struct model model;
+
+extern char *search_host;
+extern uint64_t search_trial;
+extern int control;
+extern int bench;
+
+extern int rcvbuf;
+extern int gro;
+extern int xdp;
+extern int connect_groups;
+extern int sport;
+extern int sport_num;
+extern int txtime;
+extern int tx_stamps;
+extern int af_xdp;
+extern int af_xdp_queue;
+extern int busy_poll;
+extern char *io_cpu;
+extern char *ui_cpu;
+extern int sched_policy;
+extern int sched_prio;
+extern int mlock_mem;
+extern int prefault;
+extern int profile;
+extern int rx_latency;
+extern int incoming;
+
+extern int reflect;
+extern int latency;
+extern char *return_group;
+
 extern size_t group_num;
 extern struct gr groups[];
 
 extern volatile sig_atomic_t running;
 extern volatile sig_atomic_t winchg;
+extern volatile sig_atomic_t relink;
 
 extern void timer_init(void (*cb)(int));
 extern void plotter_show(int signo);
@@ -98,9 +196,17 @@ extern int daemonize     (void);
 /* receiver.c */
 extern int receiver_init (void);
 extern int receiver      (int count);
+extern int join_group    (struct gr *sg);
+extern int receiver_relink(void);
+extern void receiver_stats(void);
 
 /* sender.c */
 extern int sender_init   (void);
+extern int send_socket   (int family);
 extern int sender        (void);
+extern int sender_relink (void);
+extern void sender_stats (void);
+extern size_t sender_trial(size_t len, uint64_t pps, uint64_t duration);
+extern size_t sender_text_min(const char *group);
 
 #endif /* MCJOIN_H_ */
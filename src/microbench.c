@@ -0,0 +1,408 @@
+/* Microbenchmarks of the per-packet hot paths, run with `make bench`
+ *
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The hot paths are static functions, so build them into this file.
+ * Everything else is linked in as usual, see Makefile.am
+ */
+#define main mcjoin_main
+#include "mcjoin.c"
+#undef main
+#include "receiver.c"
+#include "sender.c"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#define BENCH_RUNS  5			/* Best of, to filter out noise */
+#define BENCH_NSEC  (NSEC_PER_SEC / 10)	/* Length of each run */
+#define BENCH_SEQ   1000		/* First sequence number sent */
+#define BENCH_SEGS  32			/* Packets per UDP GRO buffer */
+
+static char           pkt[BUFSZ + 1];
+static size_t         pkt_len;
+static struct msghdr  pkt_msgh;
+static struct iovec   pkt_iov;
+static char           pkt_cmsg[0x100];
+static uint16_t       pkt_seq;
+
+static char           gro_pkt[GRO_BUFSZ + 1];
+static size_t         gro_len;
+static struct msghdr  gro_msgh;
+static struct iovec   gro_iov;
+static char           gro_cmsg[0x100];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static uint64_t cycles(void)
+{
+#ifdef HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/* Groups 225.1.2.0 and up, as set up by main() */
+static void setup_groups(size_t num)
+{
+	char buf[INET_ADDRSTR_LEN];
+	size_t i;
+
+	for (i = 0; i < num; i++) {
+		struct sockaddr_in *sin = (struct sockaddr_in *)&groups[i].grp;
+
+		snprintf(buf, sizeof(buf), "225.1.%zu.%zu", i / 256 + 2, i % 256);
+		if (!groups[i].group)
+			groups[i].group = strdup(buf);
+		sin->sin_family = AF_INET;
+		sin->sin_port   = htons(port);
+		inet_pton(AF_INET, buf, &sin->sin_addr);
+
+		memset(groups[i].status, ' ', STATUS_HISTORY - 1);
+		groups[i].spin = groups[i].group[strlen(groups[i].group) - 1];
+	}
+	group_num = num;
+}
+
+/* The cmsgs the receiver asks for, and the UDP GRO segment size if seg */
+static void setup_cmsg(struct msghdr *msgh, char *buf, int seg)
+{
+	struct in_pktinfo *ipi;
+	struct cmsghdr *cmsg;
+	struct timespec ts;
+
+	msgh->msg_control    = buf;
+	msgh->msg_controllen = CMSG_SPACE(sizeof(*ipi)) + CMSG_SPACE(sizeof(ts));
+	if (seg)
+		msgh->msg_controllen += CMSG_SPACE(sizeof(seg));
+
+	cmsg = CMSG_FIRSTHDR(msgh);
+	cmsg->cmsg_level = SOL_IP;
+	cmsg->cmsg_type  = IP_PKTINFO;
+	cmsg->cmsg_len   = CMSG_LEN(sizeof(*ipi));
+	ipi = (struct in_pktinfo *)CMSG_DATA(cmsg);
+	memset(ipi, 0, sizeof(*ipi));
+	ipi->ipi_addr = ((struct sockaddr_in *)&groups[0].grp)->sin_addr;
+
+	cmsg = CMSG_NXTHDR(msgh, cmsg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type  = SO_TIMESTAMPNS;
+	cmsg->cmsg_len   = CMSG_LEN(sizeof(ts));
+	clock_gettime(CLOCK_REALTIME, &ts);
+	memcpy(CMSG_DATA(cmsg), &ts, sizeof(ts));
+
+#ifdef UDP_GRO
+	if (!seg)
+		return;
+
+	cmsg = CMSG_NXTHDR(msgh, cmsg);
+	cmsg->cmsg_level = SOL_UDP;
+	cmsg->cmsg_type  = UDP_GRO;
+	cmsg->cmsg_len   = CMSG_LEN(sizeof(seg));
+	memcpy(CMSG_DATA(cmsg), &seg, sizeof(seg));
+#endif
+}
+
+/* Received packet to groups[0] */
+static void setup_packet(void)
+{
+	groups[0].seq = BENCH_SEQ;
+	if (rtp)
+		rtp_build((uint8_t *)pkt, bytes, rtp_pt, groups[0].seq, 0, rtp_ssrc);
+	else
+		build_payload(&groups[0], pkt, bytes, 0);
+	pkt_len = bytes;
+	pkt_seq = BENCH_SEQ;
+
+	pkt_iov.iov_base = pkt;
+	pkt_iov.iov_len  = pkt_len;
+
+	memset(&pkt_msgh, 0, sizeof(pkt_msgh));
+	pkt_msgh.msg_iov    = &pkt_iov;
+	pkt_msgh.msg_iovlen = 1;
+	setup_cmsg(&pkt_msgh, pkt_cmsg, 0);
+}
+
+/* BENCH_SEGS packets to groups[0] coalesced by UDP GRO, from BENCH_SEQ */
+static void setup_gro(void)
+{
+	size_t i, seg;
+
+	seg = bytes;
+	if (seg * BENCH_SEGS > GRO_BUFSZ)
+		seg = GRO_BUFSZ / BENCH_SEGS;
+
+	for (i = 0; i < BENCH_SEGS; i++) {
+		char buf[BUFSZ];
+
+		groups[0].seq = BENCH_SEQ + i;
+		if (rtp)
+			rtp_build((uint8_t *)buf, seg, rtp_pt, groups[0].seq, 0, rtp_ssrc);
+		else
+			build_payload(&groups[0], buf, seg, 0);
+		memcpy(&gro_pkt[i * seg], buf, seg);
+	}
+	gro_len = seg * BENCH_SEGS;
+
+	gro_iov.iov_base = gro_pkt;
+	gro_iov.iov_len  = gro_len;
+
+	memset(&gro_msgh, 0, sizeof(gro_msgh));
+	gro_msgh.msg_iov    = &gro_iov;
+	gro_msgh.msg_iovlen = 1;
+	setup_cmsg(&gro_msgh, gro_cmsg, (int)seg);
+}
+
+/* Next RTP sequence number, in place, step 2 to simulate loss */
+static void next_rtp(int step)
+{
+	pkt_seq += step;
+	pkt[2] = pkt_seq >> 8;
+	pkt[3] = pkt_seq & 0xff;
+}
+
+static void b_build(size_t n)
+{
+	static char buf[BUFSZ];
+
+	while (n--)
+		build_payload(&groups[0], buf, bytes, 0);
+}
+
+static void b_validate(size_t n)
+{
+	while (n--) {
+		if (!is_group(&groups[0], &pkt_msgh))
+			abort();
+	}
+}
+
+static void b_parse(size_t n)
+{
+	while (n--) {
+		if (rtp)
+			next_rtp(1);
+		else
+			groups[0].seq = BENCH_SEQ;
+		parse_mcast(&groups[0], &pkt_msgh, pkt, pkt_len, 0);
+	}
+}
+
+/* Sequence tracking with a gap in every packet */
+static void b_loss(size_t n)
+{
+	while (n--) {
+		if (rtp)
+			next_rtp(2);
+		else
+			groups[0].seq = BENCH_SEQ - 1;
+		parse_mcast(&groups[0], &pkt_msgh, pkt, pkt_len, 0);
+	}
+}
+
+/* Everything recv_mcast() does per packet, after recvmmsg() */
+static void b_packet(size_t n)
+{
+	struct gr *g = &groups[0];
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	while (n--) {
+		if (!is_group(g, &pkt_msgh))
+			abort();
+
+		if (rtp)
+			next_rtp(1);
+		else
+			g->seq = BENCH_SEQ;
+		recv_packet(g, &pkt_msgh, pkt, pkt_len, &now);
+	}
+}
+
+/* Same, per packet of BENCH_SEGS in a UDP GRO buffer */
+static void b_gro(size_t n)
+{
+	size_t seg = gro_len / BENCH_SEGS, i;
+	struct gr *g = &groups[0];
+	struct timespec now;
+
+	gro = 1;
+	clock_gettime(CLOCK_REALTIME, &now);
+	for (n = (n + BENCH_SEGS - 1) / BENCH_SEGS; n--; ) {
+		if (!is_group(g, &gro_msgh))
+			abort();
+
+		if (rtp) {
+			for (i = 0; i < BENCH_SEGS; i++) {
+				gro_pkt[i * seg + 2] = ++pkt_seq >> 8;
+				gro_pkt[i * seg + 3] = pkt_seq & 0xff;
+			}
+		} else
+			g->seq = BENCH_SEQ;
+		recv_packet(g, &gro_msgh, gro_pkt, gro_len, &now);
+
+		/* Each segment must be seen, in order */
+		if (!rtp && g->seq != BENCH_SEQ + BENCH_SEGS)
+			abort();
+	}
+	gro = 0;
+}
+
+static void b_update(size_t n)
+{
+	while (n--)
+		update();
+}
+
+static void b_render(size_t n)
+{
+	while (n--)
+		plotter_show(0);
+}
+
+/*
+ * Scale number of operations to BENCH_NSEC per run, then report the
+ * best of BENCH_RUNS runs.  Cycles are TSC ticks, not core clocks.
+ */
+static void run(const char *name, size_t num, void (*fn)(size_t))
+{
+	double ns = 0, cyc = 0;
+	uint64_t t = 0, c;
+	size_t ops, i;
+
+	setup_groups(num);
+	setup_packet();
+	setup_gro();
+
+	for (ops = 16; t < BENCH_NSEC / 10; ops *= 2) {
+		t = now_ns();
+		fn(ops);
+		t = now_ns() - t;
+	}
+	ops = ops * BENCH_NSEC / (t ? t : 1);
+
+	for (i = 0; i < BENCH_RUNS; i++) {
+		double rns, rcyc;
+
+		t = now_ns();
+		c = cycles();
+		fn(ops);
+		c = cycles() - c;
+		t = now_ns() - t;
+
+		rns  = (double)t / ops;
+		rcyc = (double)c / ops;
+		if (!i || rns < ns)
+			ns = rns;
+		if (!i || rcyc < cyc)
+			cyc = rcyc;
+	}
+
+#ifdef HAVE_TSC
+	printf("%-10s %6zu %10.1f %10.0f\n", name, num, ns, cyc);
+#else
+	printf("%-10s %6zu %10.1f %10s\n", name, num, ns, "-");
+#endif
+	fflush(stdout);
+}
+
+static int bench_usage(int code)
+{
+	printf("Usage: microbench [-r] [-b BYTES]\n"
+	       "  -b BYTES  Payload size, default: %zu\n"
+	       "  -r        RTP instead of text payload\n", bytes);
+
+	return code;
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t nums[] = { 1, 16, 256 };
+	size_t i;
+	int c;
+
+	while ((c = getopt(argc, argv, "b:hr")) != EOF) {
+		switch (c) {
+		case 'b':
+			bytes = (size_t)atoi(optarg);
+			if (bytes > BUFSZ) {
+				fprintf(stderr, "Too long payload, max %d bytes\n", BUFSZ);
+				return 1;
+			}
+			break;
+
+		case 'h':
+			return bench_usage(0);
+
+		case 'r':
+			rtp = 1;
+			break;
+
+		default:
+			return bench_usage(1);
+		}
+	}
+
+	if (rtp && bytes < RTP_HDR_LEN) {
+		fprintf(stderr, "Too short payload for RTP, min %d bytes\n", RTP_HDR_LEN);
+		return 1;
+	}
+	rtp_ssrc = 0x4d434a4e;
+
+	/* Screen updates go nowhere, keep stdout for the results */
+	if (!freopen("/dev/null", "w", stderr))
+		return 1;
+	log_init(1, "microbench");
+	strlcpy(iface, "lo", IFNAMSIZ);
+	width  = 80;
+	height = 24;
+
+	printf("%s payload, %zu bytes\n", rtp ? "RTP" : "Text", bytes);
+	printf("%-10s %6s %10s %10s\n", "benchmark", "groups", "ns/op", "cycles/op");
+
+	run("build",    1, b_build);
+	run("validate", 1, b_validate);
+	run("parse",    1, b_parse);
+	run("loss",     1, b_loss);
+	run("packet",   1, b_packet);
+#ifdef UDP_GRO
+	run("gro",      1, b_gro);
+#endif
+	for (i = 0; i < NELEMS(nums); i++)
+		run("update", nums[i], b_update);
+	for (i = 0; i < NELEMS(nums); i++)
+		run("render", nums[i], b_render);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,257 @@
+/* Sender traffic shape models: jitter, Poisson arrivals, bursts, size mix
+ *
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "model.h"
+
+/*
+ * Simple IMIX, 7:4:1 of 64, 594 and 1518 byte Ethernet frames, here as
+ * UDP payload, i.e., minus 42 bytes of headers and 4 bytes of FCS.
+ */
+static const size_t imix_size[]   = { 18, 548, 1472 };
+static const size_t imix_weight[] = {  7,   4,    1 };
+
+/* Per-group schedule */
+struct sched {
+	uint64_t  base;		/* Nominal start of current train */
+	uint64_t  last;		/* Last departure time */
+	size_t    left;		/* Packets left in current train */
+};
+
+static struct sched *sched;
+static uint64_t      gap;	/* Nominal time between trains, ns */
+static size_t        burst;
+static int           poisson;
+
+/* Precomputed tables, randomly indexed at runtime */
+static int64_t      *jitter_tbl;
+static uint64_t     *gap_tbl;
+static size_t       *size_tbl;
+
+static uint64_t      rnd_state;
+
+/* xorshift64*, fast enough to not show up in a profile */
+static uint32_t rnd(void)
+{
+	rnd_state ^= rnd_state >> 12;
+	rnd_state ^= rnd_state << 25;
+	rnd_state ^= rnd_state >> 27;
+
+	return (uint32_t)((rnd_state * 2685821657736338717ULL) >> 32);
+}
+
+/* Uniform in (0,1), never exactly zero */
+static double uniform(void)
+{
+	return ((double)rnd() + 1.0) / 4294967297.0;
+}
+
+/* Box-Muller, one of the pair is enough for table generation */
+static double normal(void)
+{
+	return sqrt(-2.0 * log(uniform())) * cos(2 * M_PI * uniform());
+}
+
+/*
+ * Parse size mix: "imix", or SIZE:WEIGHT[,SIZE:WEIGHT...] where the
+ * weight is optional and defaults to 1.  Sizes are UDP payload bytes.
+ */
+int model_sizes(struct model *m, const char *arg, size_t max)
+{
+	char *buf, *tok, *save = NULL;
+	size_t i;
+
+	if (!strcmp(arg, "imix")) {
+		for (i = 0; i < sizeof(imix_size) / sizeof(imix_size[0]); i++) {
+			m->size[i]   = imix_size[i];
+			m->weight[i] = imix_weight[i];
+		}
+		m->num = i;
+		return 0;
+	}
+
+	buf = strdup(arg);
+	if (!buf)
+		return -1;
+
+	m->num = 0;
+	for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		char *ptr;
+		long size, weight = 1;
+
+		if (m->num >= MODEL_SIZES)
+			goto fail;
+
+		size = strtol(tok, &ptr, 10);
+		if (*ptr == ':')
+			weight = strtol(ptr + 1, &ptr, 10);
+		if (*ptr || size < 1 || (size_t)size > max || weight < 1)
+			goto fail;
+
+		m->size[m->num]     = size;
+		m->weight[m->num++] = weight;
+	}
+
+	free(buf);
+	return m->num ? 0 : -1;
+fail:
+	free(buf);
+	errno = EINVAL;
+	return -1;
+}
+
+int model_active(struct model *m)
+{
+	return m->jitter || m->poisson || m->burst > 1 || m->num;
+}
+
+/*
+ * Set up schedule for all groups and precompute random tables, period
+ * is the nominal time between packets, in ns, the average rate is kept
+ * regardless of model.
+ */
+int model_init(struct model *m, size_t groups, uint64_t period)
+{
+	size_t i, j, k, total = 0;
+
+	rnd_state = ((uint64_t)random() << 32) | (uint64_t)random() | 1;
+
+	sched = calloc(groups, sizeof(*sched));
+	if (!sched)
+		return -1;
+
+	burst   = m->burst > 1 ? m->burst : 1;
+	gap     = period * burst;
+	poisson = m->poisson;
+
+	if (m->jitter) {
+		jitter_tbl = malloc(MODEL_TABLE * sizeof(*jitter_tbl));
+		if (!jitter_tbl)
+			goto fail;
+
+		for (i = 0; i < MODEL_TABLE; i++) {
+			double v;
+
+			if (m->dist == JITTER_NORMAL)
+				v = normal() * m->jitter;
+			else
+				v = (2 * uniform() - 1) * m->jitter;
+			jitter_tbl[i] = (int64_t)v;
+		}
+	}
+
+	if (poisson) {
+		gap_tbl = malloc(MODEL_TABLE * sizeof(*gap_tbl));
+		if (!gap_tbl)
+			goto fail;
+
+		for (i = 0; i < MODEL_TABLE; i++)
+			gap_tbl[i] = (uint64_t)(-log(uniform()) * gap);
+	}
+
+	if (m->num) {
+		size_tbl = malloc(MODEL_TABLE * sizeof(*size_tbl));
+		if (!size_tbl)
+			goto fail;
+
+		for (i = 0; i < m->num; i++)
+			total += m->weight[i];
+
+		/* Fill proportionally to weight, remainder with last size */
+		for (i = 0, k = 0; i < m->num; i++) {
+			size_t n = MODEL_TABLE * m->weight[i] / total;
+
+			for (j = 0; j < n && k < MODEL_TABLE; j++)
+				size_tbl[k++] = m->size[i];
+		}
+		while (k < MODEL_TABLE)
+			size_tbl[k++] = m->size[m->num - 1];
+	}
+
+	return 0;
+fail:
+	model_exit();
+	return -1;
+}
+
+void model_exit(void)
+{
+	free(sched);
+	free(jitter_tbl);
+	free(gap_tbl);
+	free(size_tbl);
+	sched      = NULL;
+	jitter_tbl = NULL;
+	gap_tbl    = NULL;
+	size_tbl   = NULL;
+}
+
+/* Next departure time of group, in ns from start */
+uint64_t model_next(size_t id)
+{
+	struct sched *s = &sched[id];
+	uint64_t due;
+
+	if (s->left) {
+		s->left--;
+		return s->last;
+	}
+
+	if (poisson)
+		s->base += gap_tbl[rnd() & (MODEL_TABLE - 1)];
+	else
+		s->base += gap;
+
+	due = s->base;
+	if (jitter_tbl) {
+		int64_t offset = jitter_tbl[rnd() & (MODEL_TABLE - 1)];
+
+		if (offset < 0 && (uint64_t)-offset > due)
+			due = 0;
+		else
+			due += offset;
+	}
+
+	/* Never reorder packets within a group */
+	if (due < s->last)
+		due = s->last;
+
+	s->left = burst - 1;
+	s->last = due;
+
+	return due;
+}
+
+/* Payload size of next packet, def if no size mix */
+size_t model_size(size_t def)
+{
+	if (!size_tbl)
+		return def;
+
+	return size_tbl[rnd() & (MODEL_TABLE - 1)];
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MCJOIN_MODEL_H_
+#define MCJOIN_MODEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MODEL_TABLE    4096		/* Entries in random tables, power of 2 */
+#define MODEL_SIZES    16		/* Max entries in a size mix */
+
+enum {
+	JITTER_UNIFORM = 0,
+	JITTER_NORMAL,
+};
+
+/* Sender traffic shape, all zero means periodic and fixed size */
+struct model {
+	uint64_t  jitter;	/* ns, max offset or std. deviation */
+	int       dist;		/* JITTER_UNIFORM or JITTER_NORMAL */
+	int       poisson;	/* Exponentially distributed gaps */
+	size_t    burst;	/* Packets per train, back-to-back */
+
+	size_t    num;		/* Size mix, payload bytes and weight */
+	size_t    size[MODEL_SIZES];
+	size_t    weight[MODEL_SIZES];
+};
+
+int      model_sizes  (struct model *m, const char *arg, size_t max);
+int      model_active (struct model *m);
+
+int      model_init   (struct model *m, size_t groups, uint64_t period);
+void     model_exit   (void);
+
+uint64_t model_next   (size_t id);
+size_t   model_size   (size_t def);
+
+#endif /* MCJOIN_MODEL_H_ */
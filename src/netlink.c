@@ -0,0 +1,874 @@
+/* Interface, address, and default route cache, and link monitoring, rtnetlink
+ *
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+#include "mcjoin.h"
+#include "netlink.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <net/if.h>
+#ifdef HAVE_LINUX_RTNETLINK_H
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+
+#ifdef HAVE_LINUX_RTNETLINK_H
+
+/* Link event, wall clock time for the summary */
+struct nlev {
+	struct timespec ts;
+	char            what[80];
+};
+
+/* Cache of all interfaces, their addresses, and the default routes */
+struct nlif {
+	int             ifindex;
+	unsigned int    flags;
+	char            name[IFNAMSIZ];
+};
+
+struct nladdr {
+	int             ifindex;
+	inet_addr_t     addr;
+};
+
+struct nlroute {
+	int             family;
+	int             ifindex;
+	uint32_t        metric;
+};
+
+static struct {
+	int             sd;
+	int             rsd;		/* Route changes, drained by nl_default() */
+	int             loaded;		/* Cache filled by the startup dump */
+	int             loading;	/* Dump in progress, no events */
+
+	struct nlif    *ifs;
+	size_t          nifs, maxifs;
+	struct nladdr  *addrs;
+	size_t          naddrs, maxaddrs;
+	struct nlroute *routes;
+	size_t          nroutes, maxroutes;
+
+	int             pending;	/* Link up, until first packet */
+	struct timespec since;
+	size_t          flaps;
+	size_t          recovered;
+	uint64_t        rec_sum;	/* ns, link up to first packet */
+	uint64_t        rec_max;
+
+	struct nlev     ev[NL_EVENTS];
+	size_t          num;		/* All events, ev[] keeps the last */
+} nl = { .sd = -1, .rsd = -1 };
+
+/* Events interrupt the I/O loops, which return to the main loop */
+static void nl_signal(int signo)
+{
+	(void)signo;
+	relink = 1;
+}
+
+static void event(const char *what)
+{
+	struct nlev *e = &nl.ev[nl.num++ % NL_EVENTS];
+
+	clock_gettime(CLOCK_REALTIME, &e->ts);
+	strlcpy(e->what, what, sizeof(e->what));
+	PRINT("%s %s", iface, what);
+}
+
+/* Grow one of the cache arrays to fit one more, NULL on failure */
+static void *grow(void *arr, size_t *max, size_t num, size_t size)
+{
+	size_t len;
+	void *ptr;
+
+	if (num < *max)
+		return arr;
+
+	len = *max ? *max * 2 : 16;
+	ptr = realloc(arr, len * size);
+	if (!ptr)
+		return NULL;
+	*max = len;
+
+	return ptr;
+}
+
+static struct nlif *if_find(int ifindex)
+{
+	size_t i;
+
+	for (i = 0; i < nl.nifs; i++) {
+		if (nl.ifs[i].ifindex == ifindex)
+			return &nl.ifs[i];
+	}
+
+	return NULL;
+}
+
+static struct nlif *if_byname(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < nl.nifs; i++) {
+		if (!strcmp(nl.ifs[i].name, name))
+			return &nl.ifs[i];
+	}
+
+	return NULL;
+}
+
+static void if_add(int ifindex, unsigned int flags, const char *name)
+{
+	struct nlif *ifp;
+
+	ifp = if_find(ifindex);
+	if (!ifp) {
+		ifp = grow(nl.ifs, &nl.maxifs, nl.nifs, sizeof(*nl.ifs));
+		if (!ifp)
+			return;
+		nl.ifs = ifp;
+		ifp = &nl.ifs[nl.nifs++];
+		ifp->ifindex = ifindex;
+	}
+
+	ifp->flags = flags;
+	if (name != ifp->name)
+		strlcpy(ifp->name, name, sizeof(ifp->name));
+}
+
+/* Drop the interface and everything on it */
+static void if_del(int ifindex)
+{
+	size_t i;
+
+	for (i = 0; i < nl.naddrs; i++) {
+		if (nl.addrs[i].ifindex == ifindex)
+			nl.addrs[i--] = nl.addrs[--nl.naddrs];
+	}
+	for (i = 0; i < nl.nroutes; i++) {
+		if (nl.routes[i].ifindex == ifindex)
+			nl.routes[i--] = nl.routes[--nl.nroutes];
+	}
+	for (i = 0; i < nl.nifs; i++) {
+		if (nl.ifs[i].ifindex == ifindex) {
+			nl.ifs[i] = nl.ifs[--nl.nifs];
+			break;
+		}
+	}
+}
+
+static int if_up(unsigned int flags)
+{
+	return (flags & IFF_UP) && (flags & IFF_RUNNING);
+}
+
+static struct nladdr *addr_find(int ifindex, inet_addr_t *sa)
+{
+	size_t i;
+
+	for (i = 0; i < nl.naddrs; i++) {
+		if (nl.addrs[i].ifindex == ifindex &&
+		    !memcmp(&nl.addrs[i].addr, sa, inet_addrlen(sa)))
+			return &nl.addrs[i];
+	}
+
+	return NULL;
+}
+
+/* Returns 1 if the address was not known before */
+static int addr_add(int ifindex, inet_addr_t *sa)
+{
+	struct nladdr *a;
+
+	if (addr_find(ifindex, sa))
+		return 0;
+
+	a = grow(nl.addrs, &nl.maxaddrs, nl.naddrs, sizeof(*nl.addrs));
+	if (!a)
+		return 0;
+	nl.addrs = a;
+
+	a = &nl.addrs[nl.naddrs++];
+	a->ifindex = ifindex;
+	a->addr    = *sa;
+
+	return 1;
+}
+
+/* Returns 1 if the address was known */
+static int addr_del(int ifindex, inet_addr_t *sa)
+{
+	struct nladdr *a;
+
+	a = addr_find(ifindex, sa);
+	if (!a)
+		return 0;
+
+	*a = nl.addrs[--nl.naddrs];
+	return 1;
+}
+
+static int route_add(int family, int ifindex, uint32_t metric)
+{
+	struct nlroute *r;
+	size_t i;
+
+	for (i = 0; i < nl.nroutes; i++) {
+		r = &nl.routes[i];
+		if (r->family == family && r->ifindex == ifindex && r->metric == metric)
+			return 0;
+	}
+
+	r = grow(nl.routes, &nl.maxroutes, nl.nroutes, sizeof(*nl.routes));
+	if (!r)
+		return 0;
+	nl.routes = r;
+
+	r = &nl.routes[nl.nroutes++];
+	r->family  = family;
+	r->ifindex = ifindex;
+	r->metric  = metric;
+
+	return 1;
+}
+
+static void route_del(int family, int ifindex, uint32_t metric)
+{
+	size_t i;
+
+	for (i = 0; i < nl.nroutes; i++) {
+		struct nlroute *r = &nl.routes[i];
+
+		if (r->family == family && r->ifindex == ifindex && r->metric == metric) {
+			*r = nl.routes[--nl.nroutes];
+			return;
+		}
+	}
+}
+
+static int link_msg(struct nlmsghdr *nh)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nh);
+	int len = IFLA_PAYLOAD(nh);
+	struct rtattr *rta;
+	struct nlif *ifp;
+	const char *name = NULL;
+	int up, was = 0;
+
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFLA_IFNAME)
+			name = RTA_DATA(rta);
+	}
+
+	ifp = if_find(ifi->ifi_index);
+	if (ifp) {
+		was = if_up(ifp->flags);
+		if (!name)
+			name = ifp->name;
+	}
+	if (!name)
+		return NL_NONE;
+
+	if (nh->nlmsg_type == RTM_DELLINK) {
+		int ours = !strcmp(name, iface);
+
+		if_del(ifi->ifi_index);
+		if (!ours)
+			return NL_NONE;
+
+		event("link removed");
+		return was ? NL_DOWN : NL_NONE;
+	}
+
+	if_add(ifi->ifi_index, ifi->ifi_flags, name);
+	if (nl.loading || strcmp(name, iface))
+		return NL_NONE;
+
+	up = if_up(ifi->ifi_flags);
+	if (up == was)
+		return NL_NONE;
+
+	if (!up) {
+		event("link down");
+		return NL_DOWN;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &nl.since);
+	nl.pending = 1;
+	nl.flaps++;
+	event("link up");
+
+	return NL_UP;
+}
+
+static int addr_msg(struct nlmsghdr *nh)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+	int len = IFA_PAYLOAD(nh);
+	struct rtattr *rta;
+	struct nlif *ifp;
+	inet_addr_t sa;
+	char buf[INET_ADDRSTR_LEN];
+	char what[80];
+	void *addr = NULL;
+	int ifindex = ifa->ifa_index;
+
+	if (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)
+		return NL_NONE;
+
+	for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFA_LOCAL)
+			addr = RTA_DATA(rta);
+		else if (rta->rta_type == IFA_ADDRESS && !addr)
+			addr = RTA_DATA(rta);
+	}
+	if (!addr)
+		return NL_NONE;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.ss_family = ifa->ifa_family;
+	if (ifa->ifa_family == AF_INET6) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&sa;
+
+		memcpy(&sin6->sin6_addr, addr, sizeof(sin6->sin6_addr));
+		if (IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr))
+			sin6->sin6_scope_id = ifindex;
+	} else {
+		struct sockaddr_in *sin = (struct sockaddr_in *)&sa;
+
+		memcpy(&sin->sin_addr, addr, sizeof(sin->sin_addr));
+	}
+
+	/* Cannot bind to an address until DAD is done */
+	if (ifa->ifa_flags & IFA_F_TENTATIVE) {
+		addr_del(ifindex, &sa);
+		return NL_NONE;
+	}
+
+	if (nh->nlmsg_type == RTM_DELADDR) {
+		if (!addr_del(ifindex, &sa))
+			return NL_NONE;
+	} else if (!addr_add(ifindex, &sa))
+		return NL_NONE;
+
+	ifp = if_find(ifindex);
+	if (nl.loading || !ifp || strcmp(ifp->name, iface))
+		return NL_NONE;
+
+	inet_ntop(ifa->ifa_family, addr, buf, sizeof(buf));
+	snprintf(what, sizeof(what), "address %s/%d %s", buf, ifa->ifa_prefixlen,
+		 nh->nlmsg_type == RTM_NEWADDR ? "added" : "removed");
+	event(what);
+
+	return nh->nlmsg_type == RTM_NEWADDR ? NL_ADDR : NL_NONE;
+}
+
+/* Only default routes in the main table, for nl_default() */
+static int route_msg(struct nlmsghdr *nh)
+{
+	struct rtmsg *rtm = NLMSG_DATA(nh);
+	int len = RTM_PAYLOAD(nh);
+	struct rtattr *rta;
+	uint32_t table = rtm->rtm_table;
+	uint32_t metric = 0;
+	int ifindex = 0;
+
+	if (rtm->rtm_family != AF_INET && rtm->rtm_family != AF_INET6)
+		return NL_NONE;
+	if (rtm->rtm_dst_len || rtm->rtm_type != RTN_UNICAST)
+		return NL_NONE;
+
+	for (rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case RTA_TABLE:
+			table = *(uint32_t *)RTA_DATA(rta);
+			break;
+
+		case RTA_OIF:
+			ifindex = *(int *)RTA_DATA(rta);
+			break;
+
+		case RTA_PRIORITY:
+			metric = *(uint32_t *)RTA_DATA(rta);
+			break;
+
+		case RTA_MULTIPATH:
+			/* First nexthop is good enough to find the LAN */
+			if (!ifindex && RTA_PAYLOAD(rta) >= sizeof(struct rtnexthop))
+				ifindex = ((struct rtnexthop *)RTA_DATA(rta))->rtnh_ifindex;
+			break;
+		}
+	}
+	if (table != RT_TABLE_MAIN || !ifindex)
+		return NL_NONE;
+
+	if (nh->nlmsg_type == RTM_DELROUTE)
+		route_del(rtm->rtm_family, ifindex, metric);
+	else
+		route_add(rtm->rtm_family, ifindex, metric);
+
+	return NL_NONE;
+}
+
+static int nl_msg(struct nlmsghdr *nh)
+{
+	switch (nh->nlmsg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		return link_msg(nh);
+
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		return addr_msg(nh);
+
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		return route_msg(nh);
+	}
+
+	return NL_NONE;
+}
+
+/* Dump one table on the request socket into the cache */
+static int dump(int sd, int type, uint32_t seq)
+{
+	static uint32_t buf[NL_BUFSZ / sizeof(uint32_t)];
+	struct {
+		struct nlmsghdr nh;
+		union {
+			struct ifinfomsg ifi;
+			struct ifaddrmsg ifa;
+			struct rtmsg     rtm;
+		};
+	} req;
+	size_t hdrlen;
+	int len;
+
+	switch (type) {
+	case RTM_GETLINK:
+		hdrlen = sizeof(req.ifi);
+		break;
+
+	case RTM_GETADDR:
+		hdrlen = sizeof(req.ifa);
+		break;
+
+	default:
+		hdrlen = sizeof(req.rtm);
+		break;
+	}
+
+	/* Family is the first field of all three, AF_UNSPEC for all */
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len   = NLMSG_LENGTH(hdrlen);
+	req.nh.nlmsg_type  = type;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nh.nlmsg_seq   = seq;
+
+	if (send(sd, &req, req.nh.nlmsg_len, 0) < 0)
+		return -1;
+
+	while ((len = (int)recv(sd, buf, sizeof(buf), 0)) > 0) {
+		struct nlmsghdr *nh;
+
+		for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			if (nh->nlmsg_seq != seq)
+				continue;
+			if (nh->nlmsg_type == NLMSG_DONE)
+				return 0;
+			if (nh->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *err = NLMSG_DATA(nh);
+
+				errno = -err->error;
+				return -1;
+			}
+
+			nl_msg(nh);
+		}
+	}
+
+	return -1;
+}
+
+/* Dump links and addresses, if all, and routes into the cache */
+static int reload(int all)
+{
+	static uint32_t seq;
+	int sd, rc = 0;
+
+	sd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (sd < 0) {
+		ERROR("Failed opening netlink socket: %s", strerror(errno));
+		return -1;
+	}
+
+	if (all)
+		nl.nifs = nl.naddrs = 0;
+	nl.nroutes = 0;
+	nl.loading = 1;
+	if ((all && (dump(sd, RTM_GETLINK, ++seq) || dump(sd, RTM_GETADDR, ++seq))) ||
+	    dump(sd, RTM_GETROUTE, ++seq)) {
+		ERROR("Failed reading interfaces and routes: %s", strerror(errno));
+		rc = -1;
+	}
+	nl.loading = 0;
+	close(sd);
+
+	return rc;
+}
+
+/*
+ * One dump of all links, addresses, and routes at startup, or to start
+ * over after lost events.  The listener keeps the cache current after.
+ */
+static int nl_load(void)
+{
+	if (nl.loaded)
+		return 0;
+
+	if (reload(1))
+		return -1;
+
+	nl.loaded = 1;
+	DEBUG("Netlink cache: %zu interfaces, %zu addresses, %zu default routes",
+	      nl.nifs, nl.naddrs, nl.nroutes);
+
+	return 0;
+}
+
+/*
+ * Route changes are only read when the default route is needed, their
+ * socket does not signal, so route churn never interrupts the I/O loops.
+ */
+static void route_recv(void)
+{
+	static uint32_t buf[NL_BUFSZ / sizeof(uint32_t)];
+	int len;
+
+	if (nl.rsd < 0)
+		return;
+
+	while ((len = (int)recv(nl.rsd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		struct nlmsghdr *nh;
+
+		for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len))
+			nl_msg(nh);
+	}
+
+	if (len < 0 && errno == ENOBUFS) {
+		DEBUG("Netlink overrun, reloading routes");
+		reload(0);
+	}
+}
+
+/* Default outbound *LAN* interface, i.e. skipping tunnels, lowest metric */
+char *nl_default(char *ifname, size_t len)
+{
+	struct nlroute *best = NULL;
+	struct nlif *ifp;
+	int tun = 0;
+	size_t i;
+
+	if (nl_load())
+		return NULL;
+	route_recv();
+
+	for (i = 0; i < nl.nroutes; i++) {
+		struct nlroute *r = &nl.routes[i];
+		int is_tun;
+
+		ifp = if_find(r->ifindex);
+		if (!ifp || !(ifp->flags & IFF_UP))
+			continue;
+
+		is_tun = !strncmp(ifp->name, "tun", 3);
+		if (best) {
+			if (is_tun > tun)
+				continue;
+			if (is_tun == tun) {
+				if (r->metric > best->metric)
+					continue;
+				/* Same metric, IPv4 first */
+				if (r->metric == best->metric &&
+				    (r->family != AF_INET || best->family == AF_INET))
+					continue;
+			}
+		}
+
+		best = r;
+		tun  = is_tun;
+	}
+	if (!best)
+		return NULL;
+
+	ifp = if_find(best->ifindex);
+	strlcpy(ifname, ifp->name, len);
+	DEBUG("Found default interface %s", ifname);
+
+	return ifname;
+}
+
+/* First address of family on a multicast capable ifname, IPv4 first for AF_UNSPEC */
+int nl_ifinfo(const char *ifname, inet_addr_t *addr, int family)
+{
+	char buf[INET_ADDRSTR_LEN];
+	struct nlif *ifp;
+	size_t i;
+
+	if (nl_load())
+		return -3;
+
+	ifp = if_byname(ifname);
+	if (!ifp || !(ifp->flags & IFF_MULTICAST))
+		return -1;
+
+	if (family == AF_UNSPEC) {
+		if (nl_ifinfo(ifname, addr, AF_INET) > 0)
+			return ifp->ifindex;
+		return nl_ifinfo(ifname, addr, AF_INET6);
+	}
+
+	for (i = 0; i < nl.naddrs; i++) {
+		struct nladdr *a = &nl.addrs[i];
+
+		if (a->ifindex != ifp->ifindex || a->addr.ss_family != family)
+			continue;
+
+		*addr = a->addr;
+		DEBUG("Valid iface %s, ifindex %d, addr %s", ifname, ifp->ifindex,
+		      inet_address(addr, buf, sizeof(buf)));
+
+		return ifp->ifindex;
+	}
+
+	return -1;
+}
+
+/*
+ * Listen to link and address changes, the socket signals SIGIO so the
+ * I/O loops return to the main loop, which calls nl_recv().
+ */
+int nl_init(void)
+{
+	struct sockaddr_nl sa = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR,
+	};
+	struct sockaddr_nl rsa = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE,
+	};
+	struct sigaction act = {
+		.sa_flags   = SA_RESTART,
+		.sa_handler = nl_signal,
+	};
+
+	nl.sd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (nl.sd < 0) {
+		DEBUG("Failed opening netlink socket: %s", strerror(errno));
+		return -1;
+	}
+
+	if (bind(nl.sd, (struct sockaddr *)&sa, sizeof(sa))) {
+		ERROR("Failed binding netlink socket: %s", strerror(errno));
+		goto error;
+	}
+
+	sigaction(SIGIO, &act, NULL);
+	if (fcntl(nl.sd, F_SETOWN, getpid()) || fcntl(nl.sd, F_SETFL, O_NONBLOCK | O_ASYNC)) {
+		ERROR("Failed enabling netlink events: %s", strerror(errno));
+		goto error;
+	}
+
+	nl.rsd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+	if (nl.rsd >= 0 && bind(nl.rsd, (struct sockaddr *)&rsa, sizeof(rsa))) {
+		ERROR("Failed binding netlink route socket: %s", strerror(errno));
+		close(nl.rsd);
+		nl.rsd = -1;
+	}
+
+	/* Subscribed first, so no change is missed between dump and events */
+	nl.loaded = 0;
+	nl_load();
+
+	return nl.sd;
+error:
+	close(nl.sd);
+	nl.sd = -1;
+	return -1;
+}
+
+/* Read all pending events, returns the last change of IFACE */
+int nl_recv(void)
+{
+	static uint32_t buf[NL_BUFSZ / sizeof(uint32_t)];
+	int rc = NL_NONE;
+	int len;
+
+	relink = 0;
+	if (nl.sd < 0)
+		return NL_NONE;
+
+	while ((len = (int)recv(nl.sd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		struct nlmsghdr *nh;
+		int ev = NL_NONE;
+
+		for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			ev = nl_msg(nh);
+			if (ev == NL_UP || ev == NL_DOWN)
+				rc = ev;
+			else if (ev == NL_ADDR && rc == NL_NONE)
+				rc = ev;
+		}
+	}
+
+	/* Lost events, start over from the current state */
+	if (len < 0 && errno == ENOBUFS) {
+		struct nlif *ifp;
+
+		DEBUG("Netlink overrun, reloading interfaces and routes");
+		nl.loaded = 0;
+		nl_load();
+
+		ifp = if_byname(iface);
+		if (ifp && if_up(ifp->flags))
+			rc = NL_UP;
+	}
+
+	return rc;
+}
+
+/* Wait at most msec for events, returns -1 without netlink */
+int nl_wait(int msec)
+{
+	struct pollfd pfd[2] = {
+		{ .fd = nl.sd,  .events = POLLIN },
+		{ .fd = nl.rsd, .events = POLLIN },
+	};
+
+	if (nl.sd < 0)
+		return -1;
+
+	/* A new default route also ends the wait, e.g., without -i */
+	if (poll(pfd, nl.rsd < 0 ? 1 : 2, msec) < 0 && errno != EINTR)
+		return -1;
+	route_recv();
+
+	return nl_recv();
+}
+
+/* First packet sent or received after link up */
+void nl_data(void)
+{
+	struct timespec now;
+	uint64_t ns;
+
+	if (!nl.pending)
+		return;
+	nl.pending = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = (uint64_t)(now.tv_sec - nl.since.tv_sec) * NSEC_PER_SEC +
+		now.tv_nsec - nl.since.tv_nsec;
+
+	nl.recovered++;
+	nl.rec_sum += ns;
+	if (ns > nl.rec_max)
+		nl.rec_max = ns;
+	DEBUG("Recovered %.1f ms after link up", ns / 1000000.0);
+}
+
+void nl_stats(void)
+{
+	size_t i, first;
+
+	if (!nl.num)
+		return;
+
+	PRINT("\nLink events on %s:", iface);
+	first = nl.num > NL_EVENTS ? nl.num - NL_EVENTS : 0;
+	if (first)
+		PRINT("  ... %zu earlier events", first);
+
+	for (i = first; i < nl.num; i++) {
+		struct nlev *e = &nl.ev[i % NL_EVENTS];
+		char ts[16];
+		struct tm tm;
+
+		localtime_r(&e->ts.tv_sec, &tm);
+		strftime(ts, sizeof(ts), "%H:%M:%S", &tm);
+		PRINT("  %s.%03ld  %s", ts, e->ts.tv_nsec / 1000000, e->what);
+	}
+
+	if (!nl.flaps)
+		return;
+
+	if (nl.recovered)
+		PRINT("Recovered %zu of %zu times, link up to first packet avg %.1f ms, max %.1f ms",
+		      nl.recovered, nl.flaps, nl.rec_sum / 1000000.0 / nl.recovered,
+		      nl.rec_max / 1000000.0);
+	else
+		PRINT("No packets after link up");
+}
+
+#else /* !HAVE_LINUX_RTNETLINK_H */
+
+int nl_init(void)
+{
+	DEBUG("No netlink on this system, link changes are not tracked.");
+	return -1;
+}
+
+int nl_recv(void)
+{
+	relink = 0;
+	return NL_NONE;
+}
+
+int nl_wait(int msec)
+{
+	(void)msec;
+	return -1;
+}
+
+void nl_data(void)
+{
+}
+
+void nl_stats(void)
+{
+}
+
+#endif /* HAVE_LINUX_RTNETLINK_H */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MCJOIN_NETLINK_H_
+#define MCJOIN_NETLINK_H_
+
+#include <stddef.h>
+#include "addr.h"
+
+#define NL_EVENTS     16	/* Link and address events kept for the summary */
+#define NL_BUFSZ      32768	/* Dumps fill the buffer, fewer recv() */
+#define NL_WAIT_MSEC  1000	/* Recheck while waiting, in case of lost events */
+
+/* Change of IFACE, from nl_recv() */
+enum {
+	NL_NONE = 0,
+	NL_DOWN,		/* Link down, no carrier, or removed */
+	NL_UP,			/* Link up again, redo sockets and joins */
+	NL_ADDR,		/* Address added, usable as source */
+};
+
+int  nl_init  (void);
+int  nl_recv  (void);
+int  nl_wait  (int msec);
+void nl_data  (void);
+void nl_stats (void);
+
+char *nl_default (char *ifname, size_t len);
+int   nl_ifinfo  (const char *ifname, inet_addr_t *addr, int family);
+
+#endif /* MCJOIN_NETLINK_H_ */
@@ -0,0 +1,502 @@
+/* Index UDP payloads of a pcap or pcapng capture, for replay by the sender
+ *
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mcjoin.h"
+#include "pcap.h"
+
+#define PCAP_MAGIC_US   0xa1b2c3d4
+#define PCAP_MAGIC_NS   0xa1b23c4d
+#define PCAPNG_SHB      0x0a0d0d0a
+#define PCAPNG_IDB      0x00000001
+#define PCAPNG_EPB      0x00000006
+#define PCAPNG_BOM      0x1a2b3c4d
+#define PCAPNG_MAX_IF   32
+
+/* Link types, from tcpdump.org/linktypes.html */
+#define LINK_NULL       0
+#define LINK_EN10MB     1
+#define LINK_RAW_OLD1   12
+#define LINK_RAW_OLD2   14
+#define LINK_RAW        101
+#define LINK_LOOP       108
+#define LINK_SLL        113
+#define LINK_IPV4       228
+#define LINK_IPV6       229
+#define LINK_SLL2       276
+
+#define FLOW_BUCKETS    4096
+
+/* Destination of UDP flow in capture */
+struct flow {
+	uint8_t   family;
+	uint8_t   addr[16];
+	uint16_t  port;
+	int       next;		/* Next in hash bucket, or -1 */
+};
+
+/* Capture interface, only one for pcap, several for pcapng */
+struct iface {
+	int       linktype;
+	uint64_t  tsres;	/* Units per second */
+};
+
+static void            *map;
+static size_t           map_len;
+static int              swap;
+
+static struct pcap_pkt *pkts;
+static size_t           pkt_num;
+static size_t           pkt_max;
+static size_t           skipped;
+
+static struct flow     *flows;
+static size_t           flow_num;
+static size_t           flow_max;
+static int              bucket[FLOW_BUCKETS];
+
+static uint16_t rd16(const uint8_t *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return swap ? (uint16_t)((v >> 8) | (v << 8)) : v;
+}
+
+static uint32_t rd32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return swap ? __builtin_bswap32(v) : v;
+}
+
+static int flow_find(int family, const uint8_t *addr, uint16_t port)
+{
+	size_t alen = family == AF_INET ? 4 : 16;
+	uint32_t hash = 2166136261u;
+	size_t i;
+	int idx;
+
+	for (i = 0; i < alen; i++)
+		hash = (hash ^ addr[i]) * 16777619u;
+	hash = ((hash ^ port) * 16777619u) % FLOW_BUCKETS;
+
+	for (idx = bucket[hash]; idx >= 0; idx = flows[idx].next) {
+		struct flow *f = &flows[idx];
+
+		if (f->family == family && f->port == port && !memcmp(f->addr, addr, alen))
+			return idx;
+	}
+
+	if (flow_num == flow_max) {
+		struct flow *tmp;
+
+		flow_max = flow_max ? flow_max * 2 : 64;
+		tmp = realloc(flows, flow_max * sizeof(*flows));
+		if (!tmp)
+			return -1;
+		flows = tmp;
+	}
+
+	idx = (int)flow_num++;
+	flows[idx].family = family;
+	flows[idx].port   = port;
+	flows[idx].next   = bucket[hash];
+	memcpy(flows[idx].addr, addr, alen);
+	bucket[hash] = idx;
+
+	return idx;
+}
+
+/* Find UDP payload in IPv4 or IPv6 packet, skips fragments */
+static int ip_udp(const uint8_t *p, size_t len, uint64_t ts)
+{
+	const uint8_t *dst;
+	size_t hlen, ulen;
+	int family, flow;
+	uint8_t next;
+
+	if (len < 1)
+		return -1;
+
+	switch (p[0] >> 4) {
+	case 4:
+		if (len < 20)
+			return -1;
+		hlen = (p[0] & 0x0f) * 4;
+		if (p[9] != IPPROTO_UDP || ((p[6] << 8 | p[7]) & 0x3fff))
+			return -1;
+		family = AF_INET;
+		dst = &p[16];
+		break;
+
+	case 6:
+		if (len < 40)
+			return -1;
+		family = AF_INET6;
+		dst = &p[24];
+		next = p[6];
+		hlen = 40;
+		/* Hop-by-hop, routing, and destination options */
+		while (next == 0 || next == 43 || next == 60) {
+			if (len < hlen + 8)
+				return -1;
+			next  = p[hlen];
+			hlen += (p[hlen + 1] + 1) * 8;
+		}
+		if (next != IPPROTO_UDP)
+			return -1;
+		break;
+
+	default:
+		return -1;
+	}
+
+	if (len < hlen + 8)
+		return -1;
+	p   += hlen;
+	len -= hlen + 8;
+
+	ulen = (p[4] << 8 | p[5]);
+	if (ulen < 8)
+		return -1;
+	ulen -= 8;
+	if (ulen > len)
+		ulen = len;	/* Truncated by snaplen */
+
+	flow = flow_find(family, dst, (uint16_t)(p[2] << 8 | p[3]));
+	if (flow < 0)
+		return -1;
+
+	if (pkt_num == pkt_max) {
+		struct pcap_pkt *tmp;
+
+		pkt_max = pkt_max ? pkt_max * 2 : 4096;
+		tmp = realloc(pkts, pkt_max * sizeof(*pkts));
+		if (!tmp)
+			return -1;
+		pkts = tmp;
+	}
+
+	pkts[pkt_num].data = p + 8;
+	pkts[pkt_num].len  = (uint32_t)ulen;
+	pkts[pkt_num].flow = (uint32_t)flow;
+	pkts[pkt_num].ts   = ts;
+	pkt_num++;
+
+	return 0;
+}
+
+/* Strip link layer header */
+static void add_frame(int linktype, const uint8_t *p, size_t len, uint64_t ts)
+{
+	uint16_t type;
+	size_t off;
+
+	switch (linktype) {
+	case LINK_EN10MB:
+		if (len < 14)
+			goto skip;
+		off  = 12;
+		type = p[off] << 8 | p[off + 1];
+		while (type == 0x8100 || type == 0x88a8 || type == 0x9100) {
+			off += 4;
+			if (len < off + 2)
+				goto skip;
+			type = p[off] << 8 | p[off + 1];
+		}
+		off += 2;
+		if (type != 0x0800 && type != 0x86dd)
+			goto skip;
+		break;
+
+	case LINK_SLL:
+		off = 16;
+		break;
+
+	case LINK_SLL2:
+		off = 20;
+		break;
+
+	case LINK_NULL:
+	case LINK_LOOP:
+		off = 4;
+		break;
+
+	case LINK_RAW:
+	case LINK_RAW_OLD1:
+	case LINK_RAW_OLD2:
+	case LINK_IPV4:
+	case LINK_IPV6:
+		off = 0;
+		break;
+
+	default:
+		goto skip;
+	}
+
+	if (len > off && !ip_udp(p + off, len - off, ts))
+		return;
+skip:
+	skipped++;
+}
+
+static uint64_t to_ns(uint64_t ts, uint64_t tsres)
+{
+	if (tsres == NSEC_PER_SEC)
+		return ts;
+
+	return ts / tsres * NSEC_PER_SEC + ts % tsres * NSEC_PER_SEC / tsres;
+}
+
+static int pcap_parse(const uint8_t *p, size_t len, int nsec)
+{
+	uint64_t tsres = nsec ? NSEC_PER_SEC : 1000000;
+	int linktype;
+	size_t off;
+
+	if (len < 24)
+		return -1;
+	linktype = (int)(rd32(&p[20]) & 0xffff);
+
+	for (off = 24; off + 16 <= len; ) {
+		uint64_t ts;
+		uint32_t caplen;
+
+		ts     = (uint64_t)rd32(&p[off]) * tsres + rd32(&p[off + 4]);
+		caplen = rd32(&p[off + 8]);
+		off   += 16;
+		if (caplen > len - off)
+			break;	/* Truncated capture */
+
+		add_frame(linktype, &p[off], caplen, to_ns(ts, tsres));
+		off += caplen;
+	}
+
+	return 0;
+}
+
+/* Interface timestamp resolution, from if_tsresol option */
+static uint64_t idb_tsres(const uint8_t *opt, size_t len)
+{
+	uint64_t res = 1000000;
+	size_t off = 0;
+
+	while (off + 4 <= len) {
+		uint16_t code = rd16(&opt[off]);
+		uint16_t olen = rd16(&opt[off + 2]);
+
+		if (code == 0)
+			break;
+		if (code == 9 && olen >= 1 && off + 4 < len) {
+			uint8_t v = opt[off + 4];
+			int i;
+
+			res = 1;
+			for (i = 0; i < (v & 0x7f) && res < (1ULL << 62) / 10; i++)
+				res *= (v & 0x80) ? 2 : 10;
+			break;
+		}
+		off += 4 + ((olen + 3) & ~3);
+	}
+
+	return res;
+}
+
+static int pcapng_parse(const uint8_t *p, size_t len)
+{
+	struct iface ifs[PCAPNG_MAX_IF];
+	size_t num = 0, off = 0;
+
+	while (off + 12 <= len) {
+		const uint8_t *blk = &p[off];
+		uint32_t type, blen;
+
+		/* New section, may change byte order, magic is symmetric */
+		if (rd32(blk) == PCAPNG_SHB) {
+			swap = 0;
+			if (rd32(&blk[8]) != PCAPNG_BOM)
+				swap = 1;
+			if (rd32(&blk[8]) != PCAPNG_BOM)
+				return -1;
+			num = 0;
+		}
+
+		type = rd32(blk);
+		blen = rd32(&blk[4]);
+		if (blen < 12 || blen > len - off)
+			break;
+
+		switch (type) {
+		case PCAPNG_IDB:
+			if (num < PCAPNG_MAX_IF && blen >= 20) {
+				ifs[num].linktype = rd16(&blk[8]);
+				ifs[num].tsres    = idb_tsres(&blk[16], blen - 20);
+				num++;
+			}
+			break;
+
+		case PCAPNG_EPB:
+			if (blen >= 32) {
+				uint32_t id = rd32(&blk[8]);
+				uint32_t caplen = rd32(&blk[20]);
+				uint64_t ts;
+
+				if (id >= num || caplen > blen - 32) {
+					skipped++;
+					break;
+				}
+
+				ts = (uint64_t)rd32(&blk[12]) << 32 | rd32(&blk[16]);
+				add_frame(ifs[id].linktype, &blk[28], caplen, to_ns(ts, ifs[id].tsres));
+			}
+			break;
+
+		default:
+			break;
+		}
+
+		off += blen;
+	}
+
+	return 0;
+}
+
+/*
+ * Map capture file and index all UDP payloads, with their destination
+ * flow and capture time relative to the first packet.
+ */
+int pcap_open(const char *file)
+{
+	struct stat st;
+	uint64_t ts0, prev;
+	uint32_t magic;
+	size_t i;
+	int fd, rc;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		ERROR("Failed opening %s: %s", file, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) || st.st_size < 24) {
+		ERROR("Cannot use %s, too short or not a regular file", file);
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		map = NULL;
+		ERROR("Failed mapping %s: %s", file, strerror(errno));
+		return -1;
+	}
+	map_len = st.st_size;
+
+	for (i = 0; i < FLOW_BUCKETS; i++)
+		bucket[i] = -1;
+
+	memcpy(&magic, map, sizeof(magic));
+	if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS) {
+		swap = 0;
+		rc = pcap_parse(map, map_len, magic == PCAP_MAGIC_NS);
+	} else if (__builtin_bswap32(magic) == PCAP_MAGIC_US ||
+		   __builtin_bswap32(magic) == PCAP_MAGIC_NS) {
+		swap = 1;
+		rc = pcap_parse(map, map_len, __builtin_bswap32(magic) == PCAP_MAGIC_NS);
+	} else if (magic == PCAPNG_SHB) {
+		rc = pcapng_parse(map, map_len);
+	} else {
+		ERROR("%s is not a pcap or pcapng file", file);
+		goto fail;
+	}
+
+	if (rc || !pkt_num) {
+		ERROR("No UDP packets found in %s", file);
+		goto fail;
+	}
+
+	/* Relative to first packet, captures may not be strictly ordered */
+	ts0 = pkts[0].ts;
+	for (i = 0, prev = 0; i < pkt_num; i++) {
+		uint64_t ts = pkts[i].ts > ts0 ? pkts[i].ts - ts0 : 0;
+
+		if (ts < prev)
+			ts = prev;
+		pkts[i].ts = prev = ts;
+	}
+
+	PRINT("Replaying %s, %zu UDP packets in %zu flows over %.3f sec, skipped %zu",
+	      file, pkt_num, flow_num, (double)pkts[pkt_num - 1].ts / NSEC_PER_SEC, skipped);
+
+	return 0;
+fail:
+	pcap_close();
+	return -1;
+}
+
+void pcap_close(void)
+{
+	if (map)
+		munmap(map, map_len);
+	map = NULL;
+
+	free(pkts);
+	pkts = NULL;
+	pkt_num = pkt_max = 0;
+
+	free(flows);
+	flows = NULL;
+	flow_num = flow_max = 0;
+}
+
+size_t pcap_num(void)
+{
+	return pkt_num;
+}
+
+size_t pcap_flows(void)
+{
+	return flow_num;
+}
+
+struct pcap_pkt *pcap_pkt(size_t idx)
+{
+	if (idx >= pkt_num)
+		return NULL;
+
+	return &pkts[idx];
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
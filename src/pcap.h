@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MCJOIN_PCAP_H_
+#define MCJOIN_PCAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* UDP payload of one captured packet, points into the file mapping */
+struct pcap_pkt {
+	const uint8_t *data;
+	uint32_t       len;
+	uint32_t       flow;	/* Index of (dst addr, dst port) in capture */
+	uint64_t       ts;	/* Capture time, ns since first packet */
+};
+
+int              pcap_open  (const char *file);
+void             pcap_close (void);
+
+size_t           pcap_num   (void);
+size_t           pcap_flows (void);
+struct pcap_pkt *pcap_pkt   (size_t idx);
+
+#endif /* MCJOIN_PCAP_H_ */
@@ -0,0 +1,227 @@
+/* Per-stage cycle counters and syscall accounting, --profile
+ *
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+#include "mcjoin.h"
+#include "profile.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+/*
+ * Counters of one thread, only written by that thread, so no locks.
+ * Readers may see a slightly stale view, which is fine for reporting.
+ */
+struct prof_stat {
+	uint64_t  cycles[PROF_STAGES];
+	uint64_t  calls[PROF_STAGES];
+	uint64_t  inner;	/* All cycles counted, for nesting */
+};
+
+static const struct {
+	const char *name;
+	const char *syscall;
+} stage[PROF_STAGES] = {
+	{ "wait",     "poll/sleep" },
+	{ "recv",     "recvmmsg"   },
+	{ "send",     "sendmmsg/sendto" },
+	{ "build",    NULL         },
+	{ "validate", NULL         },
+	{ "parse",    NULL         },
+	{ "account",  NULL         },
+	{ "render",   NULL         },
+	{ "log",      NULL         },
+};
+
+static struct prof_stat  prof[PROF_THREADS];
+static int               stat_num;
+static __thread struct prof_stat *self;
+
+/* Start of profiling, and last live row, in cycles and ns */
+static uint64_t start_clk, start_ns;
+static uint64_t last_clk, last_ns;
+static uint64_t last_cycles[PROF_STAGES];
+static uint64_t last_calls;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* TSC cycles where available, otherwise ns */
+static uint64_t prof_clock(void)
+{
+#ifdef HAVE_TSC
+	return __rdtsc();
+#else
+	return now_ns();
+#endif
+}
+
+/* First use in each thread claims a slot, the last one is shared */
+static struct prof_stat *prof_self(void)
+{
+	if (!self) {
+		int id = __sync_fetch_and_add(&stat_num, 1);
+
+		self = &prof[id < PROF_THREADS ? id : PROF_THREADS - 1];
+	}
+
+	return self;
+}
+
+void prof_init(void)
+{
+	start_clk = last_clk = prof_clock();
+	start_ns  = last_ns  = now_ns();
+}
+
+void prof_begin(struct prof_mark *m)
+{
+	m->inner = prof_self()->inner;
+	m->start = prof_clock();
+}
+
+void prof_end(struct prof_mark *m, int id)
+{
+	struct prof_stat *s = prof_self();
+	uint64_t cycles;
+
+	cycles = prof_clock() - m->start - (s->inner - m->inner);
+	s->cycles[id] += cycles;
+	s->calls[id]++;
+	s->inner += cycles;
+}
+
+static void sum(uint64_t *cycles, uint64_t *calls)
+{
+	int i, j;
+
+	memset(cycles, 0, PROF_STAGES * sizeof(*cycles));
+	memset(calls, 0, PROF_STAGES * sizeof(*calls));
+	for (i = 0; i < PROF_THREADS; i++) {
+		for (j = 0; j < PROF_STAGES; j++) {
+			cycles[j] += prof[i].cycles[j];
+			calls[j]  += prof[i].calls[j];
+		}
+	}
+}
+
+static uint64_t syscalls(uint64_t *calls)
+{
+	uint64_t num = 0;
+	int i;
+
+	for (i = 0; i < PROF_STAGES; i++) {
+		if (stage[i].syscall)
+			num += calls[i];
+	}
+
+	return num;
+}
+
+/* Live row, share of time per stage and syscalls/s since last call */
+int prof_show(char *buf, size_t len)
+{
+	uint64_t cycles[PROF_STAGES], calls[PROF_STAGES];
+	uint64_t clk, ns, num;
+	size_t pos = 0;
+	int i;
+
+	if (!profile)
+		return 0;
+
+	clk = prof_clock();
+	ns  = now_ns();
+	if (clk == last_clk || ns == last_ns)
+		return 0;
+
+	sum(cycles, calls);
+	for (i = 0; i < PROF_STAGES && pos < len; i++) {
+		double share = (double)(cycles[i] - last_cycles[i]) * 100 / (clk - last_clk);
+
+		if (share < 0.5)
+			continue;
+		pos += snprintf(&buf[pos], len - pos, "%s %.0f%%  ", stage[i].name, share);
+	}
+
+	num = syscalls(calls);
+	if (pos < len)
+		pos += snprintf(&buf[pos], len - pos, "syscalls %.0f/s",
+				(double)(num - last_calls) * NSEC_PER_SEC / (ns - last_ns));
+
+	memcpy(last_cycles, cycles, sizeof(cycles));
+	last_calls = num;
+	last_clk   = clk;
+	last_ns    = ns;
+
+	return (int)pos;
+}
+
+void prof_stats(void)
+{
+	uint64_t cycles[PROF_STAGES], calls[PROF_STAGES];
+	uint64_t clk, ns;
+	double sec;
+	int i;
+
+	if (!profile)
+		return;
+
+	clk = prof_clock() - start_clk;
+	ns  = now_ns() - start_ns;
+	sec = (double)ns / NSEC_PER_SEC;
+	if (!clk || !ns)
+		return;
+
+	sum(cycles, calls);
+#ifdef HAVE_TSC
+	PRINT("\nProfile, %.1f sec, TSC at %.2f GHz:", sec, (double)clk / ns);
+#else
+	PRINT("\nProfile, %.1f sec, cycles are ns:", sec);
+#endif
+	PRINT("%-10s %-15s %12s %10s %12s %7s", "Stage", "Syscall", "Calls", "Calls/s",
+	      "Cycles/call", "Share");
+	for (i = 0; i < PROF_STAGES; i++) {
+		if (!calls[i])
+			continue;
+
+		PRINT("%-10s %-15s %12" PRIu64 " %10.0f %12.0f %6.1f%%", stage[i].name,
+		      stage[i].syscall ? stage[i].syscall : "-", calls[i], calls[i] / sec,
+		      (double)cycles[i] / calls[i], (double)cycles[i] * 100 / clk);
+	}
+	PRINT("Syscalls %.0f/s, %d thread(s)", syscalls(calls) / sec,
+	      stat_num < PROF_THREADS ? stat_num : PROF_THREADS);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
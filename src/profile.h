@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MCJOIN_PROFILE_H_
+#define MCJOIN_PROFILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROF_THREADS  4		/* I/O thread, UI thread, and spare */
+
+/* Stages of the send and receive paths, wait, recv, and send are syscalls */
+enum {
+	PROF_WAIT = 0,
+	PROF_RECV,
+	PROF_SEND,
+	PROF_BUILD,
+	PROF_VALIDATE,
+	PROF_PARSE,
+	PROF_ACCOUNT,
+	PROF_RENDER,
+	PROF_LOG,
+	PROF_STAGES
+};
+
+/* Start of a stage, and cycles spent in stages nested in it */
+struct prof_mark {
+	uint64_t  start;
+	uint64_t  inner;
+};
+
+/*
+ * Cheap enough to leave in the hot path, a branch on a global when
+ * --profile is not given.  Nested stages, e.g., render in a signal
+ * handler interrupting wait, are only counted once, by the inner one.
+ */
+#define PROF_BEGIN(m)      do { if (profile) prof_begin(&(m)); } while (0)
+#define PROF_END(m, stage) do { if (profile) prof_end(&(m), stage); } while (0)
+
+void prof_init  (void);
+void prof_begin (struct prof_mark *m);
+void prof_end   (struct prof_mark *m, int stage);
+
+int  prof_show  (char *buf, size_t len);
+void prof_stats (void);
+
+#endif /* MCJOIN_PROFILE_H_ */
@@ -20,14 +20,33 @@
 
 #include <errno.h>
 #include <poll.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
+#include <netinet/udp.h>		/* UDP_GRO */
+#ifdef HAVE_LINUX_FILTER_H
+#include <linux/filter.h>		/* SO_ATTACH_FILTER */
+#endif
+#ifdef HAVE_LINUX_SOCK_DIAG_H
+#include <linux/sock_diag.h>
+#endif
 
 #include "mcjoin.h"
+#include "netlink.h"
+#include "profile.h"
+#include "rtt.h"
+#include "schedule.h"
+#include "search.h"
+#include "xdp.h"
+#include "xsk.h"
 
 int num_joins = 0;
 
+/* Kernel receive timestamps are only needed by these */
+#define RX_STAMPS (rtp || mpegts || rx_latency)
+
 static int alloc_socket(inet_addr_t group)
 {
 	inet_addr_t ina = { 0 };
@@ -35,6 +54,9 @@ static int alloc_socket(inet_addr_t group)
 
 	ina.ss_family = group.ss_family;
 	inet_addr_set_port(&ina, inet_addr_get_port(&group));
+	/* Bound to the group, the socket stays on it when connected */
+	if (incoming)
+		ina = group;
 
 #ifdef AF_INET6
 	if (group.ss_family == AF_INET6)
@@ -50,7 +72,12 @@ static int alloc_socket(inet_addr_t group)
 	}
 
 	val = 1;
-#ifdef SO_REUSEPORT
+	/*
+	 * On Linux, SO_REUSEADDR is enough for UDP, and with SO_REUSEPORT
+	 * newer kernels pick one socket of the reuseport group by hash,
+	 * even for multicast, so groups land on each other's sockets.
+	 */
+#if defined(SO_REUSEPORT) && !defined(__linux__)
 	if (setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val)))
 		ERROR("Failed enabling SO_REUSEPORT: %s", strerror(errno));
 #endif
@@ -84,6 +111,50 @@ static int alloc_socket(inet_addr_t group)
 #endif
 	}
 
+#ifdef SO_RXQ_OVFL
+	/* Socket drop counter in each packet, to tell local from network loss */
+	val = 1;
+	if (setsockopt(sd, SOL_SOCKET, SO_RXQ_OVFL, &val, sizeof(val)))
+		ERROR("Failed enabling SO_RXQ_OVFL: %s", strerror(errno));
+#endif
+
+	if (rcvbuf > 0) {
+#ifdef SO_RCVBUFFORCE
+		if (setsockopt(sd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)))
+#endif
+		if (setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)))
+			ERROR("Failed setting SO_RCVBUF: %s", strerror(errno));
+	}
+
+#ifdef UDP_GRO
+	/* Bursts of the group in one buffer, split again in recv_mcast() */
+	if (gro) {
+		val = 1;
+		if (setsockopt(sd, SOL_UDP, UDP_GRO, &val, sizeof(val)))
+			ERROR("Failed enabling UDP_GRO: %s", strerror(errno));
+	}
+#endif
+
+#ifdef SO_TIMESTAMPNS
+	/* Kernel receive timestamp, for RTP jitter, PCR, and wakeup latency */
+	val = 1;
+	if (RX_STAMPS && setsockopt(sd, SOL_SOCKET, SO_TIMESTAMPNS, &val, sizeof(val)))
+		ERROR("Failed enabling SO_TIMESTAMPNS: %s", strerror(errno));
+#endif
+
+	if (busy_poll) {
+#ifdef SO_BUSY_POLL
+		/* Above net.core.busy_read requires CAP_NET_ADMIN */
+		if (setsockopt(sd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)))
+			ERROR("Failed enabling SO_BUSY_POLL: %s", strerror(errno));
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+		val = 1;
+		if (setsockopt(sd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &val, sizeof(val)))
+			DEBUG("Failed enabling SO_PREFER_BUSY_POLL: %s", strerror(errno));
+#endif
+	}
+
 	if (bind(sd, (struct sockaddr *)&ina, inet_addrlen(&ina))) {
 		ERROR("Failed binding to socket: %s", strerror(errno));
 		close(sd);
@@ -93,7 +164,75 @@ static int alloc_socket(inet_addr_t group)
 	return sd;
 }
 
-static int join_group(struct gr *sg)
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_FILTER)
+/* Compare each 32-bit word of addr at offset from IP header, else drop */
+static size_t filter_addr(struct sock_filter *insn, size_t num, int off, inet_addr_t *addr,
+			  size_t drop)
+{
+	const uint32_t *word;
+	size_t i, words;
+
+	if (addr->ss_family == AF_INET6) {
+		word  = (uint32_t *)&((struct sockaddr_in6 *)addr)->sin6_addr;
+		words = 4;
+	} else {
+		word  = (uint32_t *)&((struct sockaddr_in *)addr)->sin_addr;
+		words = 1;
+	}
+
+	for (i = 0; i < words; i++) {
+		insn[num] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+							 SKF_NET_OFF + off + 4 * i);
+		num++;
+		insn[num] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+							 ntohl(word[i]), 0, drop - num - 1);
+		num++;
+	}
+
+	return num;
+}
+#endif
+
+/*
+ * Classic BPF on the group socket, matching the group, and the source
+ * for SSM, so packets to other groups on our port are dropped by the
+ * kernel instead of read and rejected by is_group().  Older kernels
+ * deliver them despite IP_MULTICAST_ALL off, IPv6 before 4.20 has no
+ * IPV6_MULTICAST_ALL, and unicast to the port lands on any socket.
+ */
+static void attach_filter(int sd, struct gr *g)
+{
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_FILTER)
+	struct sock_filter insn[2 * 4 * 2 + 2];
+	struct sock_fprog prog;
+	int dst = 16, src = 12;	/* Offset of addresses in IPv4 header */
+	size_t num = 0, words, drop;
+
+	if (g->grp.ss_family == AF_INET6) {
+		dst   = 24;
+		src   = 8;
+		words = 4;
+	} else
+		words = 1;
+
+	drop = 2 * words * (g->source ? 2 : 1) + 1;
+	num  = filter_addr(insn, num, dst, &g->grp, drop);
+	if (g->source)
+		num = filter_addr(insn, num, src, &g->src, drop);
+	insn[num++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+	insn[num++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+
+	prog.len    = num;
+	prog.filter = insn;
+	if (setsockopt(sd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)))
+		ERROR("Failed attaching socket filter: %s", strerror(errno));
+#else
+	(void)sd;
+	(void)g;
+#endif
+}
+
+int join_group(struct gr *sg)
 {
 	struct group_source_req gsr;
 	struct group_req gr;
@@ -108,6 +247,7 @@ static int join_group(struct gr *sg)
 	sd = alloc_socket(sg->grp);
 	if (sd < 0)
 		return 1;
+	attach_filter(sd, sg);
 
 	ifindex = if_nametoindex(iface);
 	if (!ifindex) {
@@ -191,55 +331,312 @@ struct in6_addr *find_dstaddr6(struct msghdr *msgh)
 	return NULL;
 }
 
-/*
- * rcvmsg() wrapper which uses out-of-band info to verify expected
- * destination address (multicast group)
- */
-static ssize_t recv_mcast(int id)
+/* Kernel receive timestamp, or current time if not available */
+static void find_rxtime(struct msghdr *msgh, struct timespec *ts)
+{
+#ifdef SO_TIMESTAMPNS
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msgh); cmsg; cmsg = CMSG_NXTHDR(msgh, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SO_TIMESTAMPNS) {
+			memcpy(ts, CMSG_DATA(cmsg), sizeof(*ts));
+			return;
+		}
+	}
+#else
+	(void)msgh;
+#endif
+	clock_gettime(CLOCK_REALTIME, ts);
+}
+
+/* Check destination address of packet, cheaper than string compare */
+static int is_group(struct gr *g, struct msghdr *msgh)
 {
-	struct sockaddr_storage src;
 	struct in_addr *dstaddr;
-	struct in6_addr *dstaddr6;
-	struct msghdr msgh;
-	struct iovec iov[1];
-	char addr[INET6_ADDRSTRLEN];
-	char cmbuf[0x100];
-	char buf[BUFSZ];
-	const char *dst;
-	size_t seq = 0;
-	ssize_t bytes;
-	int pid = 0;
-	char *ptr;
 
-	iov[0].iov_base = buf;
-	iov[0].iov_len  = sizeof(buf);
+	dstaddr = find_dstaddr(msgh);
+	if (dstaddr) {
+		struct sockaddr_in *sin = (struct sockaddr_in *)&g->grp;
 
-	memset(&msgh, 0, sizeof(msgh));
-	msgh.msg_name       = &src;
-	msgh.msg_namelen    = sizeof(src);
-	msgh.msg_iov        = iov;
-	msgh.msg_iovlen     = NELEMS(iov);
-	msgh.msg_control    = cmbuf;
-	msgh.msg_controllen = sizeof(cmbuf);
+		return g->grp.ss_family == AF_INET &&
+			sin->sin_addr.s_addr == dstaddr->s_addr;
+	}
+#ifdef AF_INET6
+	else {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&g->grp;
+		struct in6_addr *dstaddr6;
 
-	bytes = recvmsg(groups[id].sd, &msgh, MSG_DONTWAIT);
-	if (bytes < 0)
-		return -1;
+		dstaddr6 = find_dstaddr6(msgh);
+		if (!dstaddr6)
+			return 0;
 
-	dstaddr = find_dstaddr(&msgh);
+		return g->grp.ss_family == AF_INET6 &&
+			!memcmp(&sin6->sin6_addr, dstaddr6, sizeof(*dstaddr6));
+	}
+#endif
+
+	return 0;
+}
+
+static void wrong_socket(struct gr *g, struct msghdr *msgh)
+{
+	char addr[INET_ADDRSTR_LEN] = "unknown";
+	struct in_addr *dstaddr;
+
+	dstaddr = find_dstaddr(msgh);
 	if (dstaddr)
-		dst = inet_ntop(AF_INET, dstaddr, addr, sizeof(addr));
+		inet_ntop(AF_INET, dstaddr, addr, sizeof(addr));
 #ifdef AF_INET6
 	else {
-		dstaddr6 = find_dstaddr6(&msgh);
-		if (!dstaddr6)
-			return -1;
+		struct in6_addr *dstaddr6;
 
-		dst = inet_ntop(AF_INET6, dstaddr6, addr, sizeof(addr));
+		dstaddr6 = find_dstaddr6(msgh);
+		if (dstaddr6)
+			inet_ntop(AF_INET6, dstaddr6, addr, sizeof(addr));
 	}
 #endif
 
-	buf[bytes] = 0;
+	ERROR("Packet for group %s received on wrong socket, expected group %s.",
+	      addr, g->group);
+}
+
+/*
+ * CPU and NAPI ID, i.e., RX queue, of the last packet to the socket.
+ * The kernel only tracks these per packet on connected UDP sockets, so
+ * with --incoming the socket is connected to the first sender seen.
+ */
+static void rx_incoming(struct gr *g, struct msghdr *msgh)
+{
+	struct rxcpu *rc = &g->rxcpu;
+	unsigned int napi = 0;
+	socklen_t len;
+	int cpu = -1;
+
+	if (!rc->peer) {
+		char addr[INET_ADDRSTR_LEN];
+
+		rc->peer = 1;
+		if (connect(g->sd, msgh->msg_name, msgh->msg_namelen))
+			ERROR("Failed connecting %s socket to sender %s: %s", g->group,
+			      inet_address(msgh->msg_name, addr, sizeof(addr)), strerror(errno));
+		return;
+	}
+
+#ifdef SO_INCOMING_CPU
+	len = sizeof(cpu);
+	if (getsockopt(g->sd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len))
+		cpu = -1;
+#endif
+#ifdef SO_INCOMING_NAPI_ID
+	len = sizeof(napi);
+	if (getsockopt(g->sd, SOL_SOCKET, SO_INCOMING_NAPI_ID, &napi, &len))
+		napi = 0;
+#endif
+	(void)len;
+	if (cpu < 0)
+		return;
+
+	if (rc->cpu >= 0 && (cpu != rc->cpu || napi != rc->napi))
+		rc->moves++;
+	rc->cpu  = cpu;
+	rc->napi = napi;
+	if (cpu < 64)
+		rc->cpus |= 1ULL << cpu;
+}
+
+/* Segment size of a UDP GRO buffer, 0 for a single datagram */
+static size_t gro_size(struct msghdr *msgh)
+{
+#ifdef UDP_GRO
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msgh); cmsg; cmsg = CMSG_NXTHDR(msgh, cmsg)) {
+		if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+			int val;
+
+			memcpy(&val, CMSG_DATA(cmsg), sizeof(val));
+			return val > 0 ? (size_t)val : 0;
+		}
+	}
+#else
+	(void)msgh;
+#endif
+
+	return 0;
+}
+
+/* Packets dropped by our socket since the previous packet, SO_RXQ_OVFL */
+static uint32_t rxq_drops(struct gr *g, struct msghdr *msgh)
+{
+#ifdef SO_RXQ_OVFL
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msgh); cmsg; cmsg = CMSG_NXTHDR(msgh, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SO_RXQ_OVFL) {
+			uint32_t ovfl, drops;
+
+			memcpy(&ovfl, CMSG_DATA(cmsg), sizeof(ovfl));
+			drops = ovfl - g->rxq.ovfl;
+			g->rxq.ovfl   = ovfl;
+			g->rxq.drops += drops;
+
+			return drops;
+		}
+	}
+#else
+	(void)g;
+	(void)msgh;
+#endif
+	/* No cmsg means no drops since the counter was zero */
+	return 0;
+}
+
+/* Attribute a gap to our socket buffer overflowing, or the network */
+static void rxq_gap(struct gr *g, size_t lost, uint32_t drops)
+{
+	g->gaps++;
+	g->rxq.lost += lost;
+	if (drops)
+		g->rxq.gap_local++;
+	else
+		g->rxq.gap_net++;
+}
+
+/* Sample socket buffer use, for peak fill level and current size */
+static void rxq_meminfo(struct gr *g)
+{
+#if defined(SO_MEMINFO) && defined(HAVE_LINUX_SOCK_DIAG_H)
+	uint32_t mem[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(mem);
+
+	if (getsockopt(g->sd, SOL_SOCKET, SO_MEMINFO, mem, &len))
+		return;
+
+	if (mem[SK_MEMINFO_RMEM_ALLOC] > g->rxq.rmem_peak)
+		g->rxq.rmem_peak = mem[SK_MEMINFO_RMEM_ALLOC];
+	g->rxq.rcvbuf = (int)mem[SK_MEMINFO_RCVBUF];
+#else
+	socklen_t len = sizeof(g->rxq.rcvbuf);
+
+	getsockopt(g->sd, SOL_SOCKET, SO_RCVBUF, &g->rxq.rcvbuf, &len);
+#endif
+}
+
+/*
+ * Grow SO_RCVBUF to fit RCVBUF_WINDOW msec of the rate observed since
+ * the last call, msec ago, including what we dropped.  Local drops in
+ * spite of that, e.g. from bursts, double the buffer.  Never shrinks,
+ * and not with --rcvbuf SIZE.
+ */
+static void rxq_autosize(struct gr *g, uint64_t msec)
+{
+	size_t drops = g->rxq.drops - g->rxq.mark_drops;
+	size_t pkts = g->count - g->rxq.mark_count;
+	uint64_t bytes = g->rxq.bytes - g->rxq.mark_bytes;
+	uint64_t want;
+	int val;
+
+	g->rxq.mark_count = g->count;
+	g->rxq.mark_bytes = g->rxq.bytes;
+	g->rxq.mark_drops = g->rxq.drops;
+	rxq_meminfo(g);
+
+	if (rcvbuf > 0 || !pkts || !msec)
+		return;
+
+	bytes += drops * (bytes / pkts);
+	pkts  += drops;
+	want   = (bytes + pkts * RCVBUF_OVERHEAD) * RCVBUF_WINDOW / msec;
+	if (drops && want < (uint64_t)g->rxq.rcvbuf * 2)
+		want = (uint64_t)g->rxq.rcvbuf * 2;
+	if (want > RCVBUF_MAX)
+		want = RCVBUF_MAX;
+	if (want <= (uint64_t)g->rxq.rcvbuf)
+		return;
+
+	/* Kernel doubles the value for bookkeeping overhead */
+	val = (int)(want / 2);
+#ifdef SO_RCVBUFFORCE
+	if (setsockopt(g->sd, SOL_SOCKET, SO_RCVBUFFORCE, &val, sizeof(val)))
+#endif
+	if (setsockopt(g->sd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val)))
+		return;
+
+	val = g->rxq.rcvbuf;
+	rxq_meminfo(g);
+	if (g->rxq.rcvbuf != val)
+		PRINT("Group %s receive buffer %d -> %d bytes", g->group, val, g->rxq.rcvbuf);
+}
+
+/* RTP header from any sender, returns offset to RTP payload */
+static size_t parse_rtp(struct gr *g, uint8_t *buf, size_t len, struct timespec *ts, uint32_t drops)
+{
+	uint32_t arrival, prev = rtp_extseq(&g->rtp);
+
+	arrival = (uint32_t)((uint64_t)ts->tv_sec * rtp_clock +
+			     (uint64_t)ts->tv_nsec * rtp_clock / NSEC_PER_SEC);
+
+	switch (rtp_parse(&g->rtp, buf, len, arrival)) {
+	case -1:
+		DEBUG("Group %s, not an RTP packet, len %zu", g->group, len);
+		return 0;
+
+	case 1:
+		/* Only a step forward is loss, not a re-sync or a jump back */
+		DEBUG("Group %s, RTP seq gap, now at %u", g->group, rtp_extseq(&g->rtp));
+		rxq_gap(g, rtp_extseq(&g->rtp) > prev ? rtp_extseq(&g->rtp) - prev - 1 : 0, drops);
+		break;
+
+	default:
+		break;
+	}
+	g->seq = rtp_extseq(&g->rtp) + 1;
+
+	return rtp_hdrlen(buf, len);
+}
+
+/* MPEG-TS packets, raw over UDP or in RTP */
+static void parse_ts(struct gr *g, uint8_t *buf, size_t len, struct timespec *ts)
+{
+	int rc;
+
+	/* Skip RTP header even if not in RTP mode */
+	if (len % TS_PACKET_LEN && buf[0] != TS_SYNC_BYTE) {
+		size_t hlen = rtp_hdrlen(buf, len);
+
+		buf += hlen;
+		len -= hlen;
+	}
+
+	rc = ts_parse(g->ts, buf, len, (uint64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec);
+	if (rc < 0)
+		DEBUG("Group %s, invalid MPEG-TS datagram, len %zu", g->group, len);
+	else if (rc > 0)
+		DEBUG("Group %s, %d continuity counter errors", g->group, rc);
+}
+
+/* Payload from another mcjoin, or any sender when using RTP/MPEG-TS */
+static void parse_mcast(struct gr *g, struct msghdr *msgh, char *buf, size_t len, uint32_t drops)
+{
+	size_t seq = 0;
+	int pid = 0;
+	char *ptr;
+
+	if (rtp || mpegts) {
+		struct timespec ts;
+		size_t hlen = 0;
+
+		find_rxtime(msgh, &ts);
+		if (rtp)
+			hlen = parse_rtp(g, (uint8_t *)buf, len, &ts, drops);
+		if (mpegts)
+			parse_ts(g, (uint8_t *)buf + hlen, len - hlen, &ts);
+		return;
+	}
+
+	buf[len] = 0;
 	ptr = strstr(buf, MAGIC_KEY);
 	if (ptr)
 		pid = atoi(ptr + strlen(MAGIC_KEY));
@@ -247,24 +644,199 @@ static ssize_t recv_mcast(int id)
 	if (ptr)
 		seq = atoi(ptr + strlen(SEQ_KEY));
 
-	DEBUG("Count %5zu, our PID %d, sender PID %d, group %s, seq: %zu, msg: %s",
-	      groups[id].count, getpid(), pid, groups[id].group, seq, buf);
+	if (log_level(NULL) == LOG_DEBUG)
+		DEBUG("Count %5zu, our PID %d, sender PID %d, group %s, seq: %zu, msg: %s",
+		      g->count, getpid(), pid, g->group, seq, buf);
+
+	if (g->seq != seq) {
+		DEBUG("group seq %zu vs seq %zu", g->seq, seq);
+		rxq_gap(g, seq > g->seq && g->count ? seq - g->seq : 0, drops);
+	}
+	g->seq = seq + 1; /* Next expected sequence number */
+}
+
+/* Rate search control channel, see search.c */
+static int ctl_sd = -1;
+
+/* With --af-xdp, all groups are received on this socket */
+static int xsk_sd = -1;
 
-	if (strcmp(dst, groups[id].group)) {
-		ERROR("Packet for group %s received on wrong socket, expected group %s.",
-		      dst, groups[id].group);
+/* Kernel to application latency, --rx-latency */
+static struct hist rx_hist;
+
+/* Time from kernel receive timestamp until we read the packet */
+static int64_t rx_delay(struct msghdr *msgh, struct timespec *now)
+{
+	struct timespec ts;
+
+	find_rxtime(msgh, &ts);
+	return (int64_t)(now->tv_sec - ts.tv_sec) * NSEC_PER_SEC + (now->tv_nsec - ts.tv_nsec);
+}
+
+static void rx_stamp(struct msghdr *msgh, struct timespec *now)
+{
+	int64_t ns;
+
+	ns = rx_delay(msgh, now);
+	if (ns >= 0)
+		hist_add(&rx_hist, ns);
+}
+
+/* Receive buffers for one batch, shared by all groups */
+static struct mmsghdr msgv[RECV_BATCH];
+static struct iovec   iov[RECV_BATCH];
+static inet_addr_t    srcv[RECV_BATCH];
+static char           cmbuf[RECV_BATCH][0x100];
+static char           bufv[RECV_BATCH][BUFSZ + 1];
+
+/* With --gro, each buffer holds up to GRO_BUFSZ of segments */
+static char          *grov;
+static size_t         gro_reads;
+static size_t         gro_segs;
+
+/*
+ * One datagram, or with --gro a buffer of same size segments, each one
+ * counted and sequence checked as a packet of its own.  Returns drops
+ * reported by the socket since the previous read.
+ */
+static uint32_t recv_packet(struct gr *g, struct msghdr *msgh, char *buf, size_t len,
+			    struct timespec *now)
+{
+	struct prof_mark m = { 0 }, pm = { 0 };
+	size_t off = 0, seg;
+	uint32_t drops;
+
+	/* Parsing is nested, accounting is the rest */
+	PROF_BEGIN(m);
+	if (rx_latency)
+		rx_stamp(msgh, now);
+	drops = rxq_drops(g, msgh);
+
+	seg = gro ? gro_size(msgh) : 0;
+	if (!seg || seg >= len)
+		seg = len;
+	else
+		gro_reads++;
+
+	do {
+		size_t slen = len - off < seg ? len - off : seg;
+		char next = buf[off + slen];
+
+		PROF_BEGIN(pm);
+		parse_mcast(g, msgh, &buf[off], slen, off ? 0 : drops);
+		PROF_END(pm, PROF_PARSE);
+
+		/* Text is NUL terminated in place, restore next segment */
+		buf[off + slen] = next;
+		g->rxq.bytes += slen;
+		g->count++;
+		off += slen;
+		if (seg < len)
+			gro_segs++;
+	} while (off < len);
+
+	STATUS_MARK(g, '.'); /* XXX: Use increasing dot size for more hits? */
+	PROF_END(m, PROF_ACCOUNT);
+
+	return drops;
+}
+
+/*
+ * recvmmsg() wrapper which uses out-of-band info to verify expected
+ * destination address (multicast group).  Reads at most one batch of
+ * packets from the socket, to be fair to all other groups.
+ */
+static ssize_t recv_mcast(int id)
+{
+	struct gr *g = &groups[id];
+	struct msghdr *last = NULL;
+	struct prof_mark m = { 0 };
+	struct timespec now;
+	uint32_t drops = 0;
+	int i, num;
+
+	for (i = 0; i < RECV_BATCH; i++) {
+		struct msghdr *msgh = &msgv[i].msg_hdr;
+
+		if (grov) {
+			iov[i].iov_base = &grov[i * (GRO_BUFSZ + 1)];
+			iov[i].iov_len  = GRO_BUFSZ;
+		} else {
+			iov[i].iov_base = bufv[i];
+			iov[i].iov_len  = BUFSZ;
+		}
+
+		msgh->msg_name       = &srcv[i];
+		msgh->msg_namelen    = sizeof(srcv[i]);
+		msgh->msg_iov        = &iov[i];
+		msgh->msg_iovlen     = 1;
+		msgh->msg_control    = cmbuf[i];
+		msgh->msg_controllen = sizeof(cmbuf[i]);
+		msgh->msg_flags      = 0;
+	}
+
+	/* Sample buffer fill level before draining it, when backlogged */
+	if (g->rxq.backlog)
+		rxq_meminfo(g);
+
+	PROF_BEGIN(m);
+#ifdef HAVE_RECVMMSG
+	num = recvmmsg(g->sd, msgv, RECV_BATCH, MSG_DONTWAIT, NULL);
+	PROF_END(m, PROF_RECV);
+	if (num < 0)
 		return -1;
+#else
+	for (num = 0; num < RECV_BATCH; num++) {
+		ssize_t len;
+
+		len = recvmsg(g->sd, &msgv[num].msg_hdr, MSG_DONTWAIT);
+		if (len < 0)
+			break;
+		msgv[num].msg_len = len;
 	}
+	PROF_END(m, PROF_RECV);
+	if (!num)
+		return -1;
+#endif
+
+	if (RX_STAMPS)
+		clock_gettime(CLOCK_REALTIME, &now);
+
+	for (i = 0; i < num; i++) {
+		struct msghdr *msgh = &msgv[i].msg_hdr;
+		int valid;
 
-	if (groups[id].seq != seq) {
-		DEBUG("group seq %zu vs seq %zu", groups[id].seq, seq);
-		groups[id].gaps++;
+		PROF_BEGIN(m);
+		valid = is_group(g, msgh);
+		PROF_END(m, PROF_VALIDATE);
+		if (!valid) {
+			wrong_socket(g, msgh);
+			msgv[i].msg_len = 0; /* Not reflected */
+			continue;
+		}
+
+		drops += recv_packet(g, msgh, iov[i].iov_base, msgv[i].msg_len, &now);
+		last = msgh;
 	}
-	groups[id].seq = seq + 1; /* Next expected sequence number */
-	groups[id].count++;
-	groups[id].status[STATUS_POS] = '.'; /* XXX: Use increasing dot size for more hits? */
 
-	return 0;
+	/* Once per read, where the group arrived */
+	if (incoming && last)
+		rx_incoming(g, last);
+	/* Once per read, latency for the screen */
+	if (RX_STAMPS && last) {
+		int64_t ns = rx_delay(last, &now);
+
+		if (ns >= 0)
+			sched_lat(ns);
+	}
+	nl_data();
+
+	if (reflect)
+		reflect_batch(id, msgv, num);
+
+	g->rxq.backlog = num == RECV_BATCH || drops;
+
+	return num;
 }
 
 int receiver_init(void)
@@ -273,19 +845,215 @@ int receiver_init(void)
 
 	timer_init(plotter_show);
 
+	/* Joins need the interface to exist, not an address */
+	if (iface[0] && !if_nametoindex(iface)) {
+		PRINT("Waiting for interface %s ...", iface);
+		while (running && !if_nametoindex(iface)) {
+			if (nl_wait(NL_WAIT_MSEC) < 0)
+				break;
+		}
+	}
+
+	if (gro) {
+#ifdef UDP_GRO
+		grov = malloc(RECV_BATCH * (GRO_BUFSZ + 1));
+		if (!grov) {
+			ERROR("Failed allocating UDP GRO buffers: %s", strerror(errno));
+			return 1;
+		}
+#else
+		PRINT("UDP GRO not supported on this system, ignoring --gro");
+		gro = 0;
+#endif
+	}
+
 	for (i = 0; i < group_num; i++) {
+		groups[i].rxcpu.cpu = -1;
+		if (mpegts) {
+			groups[i].ts = ts_alloc();
+			if (!groups[i].ts) {
+				ERROR("Failed allocating MPEG-TS state: %s", strerror(errno));
+				return 1;
+			}
+		}
+
 		if (join_group(&groups[i]))
 			return 1;
 	}
 
+	if (xdp && xdp_init(-1))
+		return 1;
+
+	if (af_xdp) {
+		xsk_sd = xsk_init(1);
+		if (xsk_sd < 0 || xdp_init(xsk_sd))
+			return 1;
+	}
+
+	if (reflect && reflect_init())
+		return 1;
+
+	if (control) {
+		ctl_sd = control_init();
+		if (ctl_sd < 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Link up after down, or a new interface with the same name: open the
+ * sockets and join the groups again, the kernel may have lost them.
+ */
+int receiver_relink(void)
+{
+	size_t i;
+
+	if (nl_recv() != NL_UP)
+		return 0;
+
+	for (i = 0; i < group_num; i++) {
+		struct gr *g = &groups[i];
+
+		close(g->sd);
+		g->sd = -1;
+		g->rxcpu.peer = 0;
+		if (join_group(g))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Once a second, sample socket buffers and auto-size them */
+static void rxq_tick(void)
+{
+	static struct timespec last = { 0, 0 };
+	struct timespec now;
+	uint64_t msec;
+	size_t i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	msec = (now.tv_sec - last.tv_sec) * 1000 + (now.tv_nsec - last.tv_nsec) / 1000000;
+	if (msec < 1000)
+		return;
+
+	for (i = 0; i < group_num; i++)
+		rxq_autosize(&groups[i], last.tv_sec ? msec : 0);
+	last = now;
+}
+
+static int received(int count)
+{
+	size_t i, total = 0;
+
+	if (count <= 0)
+		return 0;
+
+	for (i = 0; i < group_num; i++)
+		total += groups[i].count;
+
+	return total >= count * group_num;
+}
+
+/* Spin on non-blocking reads of all sockets, never sleep in poll() */
+static int receiver_busy(int count)
+{
+	size_t i;
+
+	while (running && !winchg && !relink) {
+		for (i = 0; i < group_num; i++)
+			recv_mcast(i);
+		if (ctl_sd >= 0)
+			control_recv(ctl_sd);
+		rxq_tick();
+
+		if (received(count)) {
+			running = 0;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/* Packets are counted by XDP, only read counters and control channel */
+static int receiver_xdp(int count)
+{
+	struct pollfd pfd = { .fd = ctl_sd, .events = POLLIN };
+
+	while (running && !winchg && !relink) {
+		if (poll(&pfd, ctl_sd >= 0 ? 1 : 0, XDP_POLL_MSEC) > 0)
+			control_recv(ctl_sd);
+		xdp_read();
+
+		if (received(count)) {
+			running = 0;
+			break;
+		}
+	}
+	xdp_read();
+
+	return 0;
+}
+
+/* Frames redirected by XDP, no socket, so no cmsg and no kernel time */
+static struct timespec xsk_now;
+
+static void recv_frame(struct gr *g, char *buf, size_t len)
+{
+	struct msghdr msgh = { 0 };
+
+	recv_packet(g, &msgh, buf, len, &xsk_now);
+}
+
+/* Read the AF_XDP RX ring, the joined sockets only keep the groups */
+static int receiver_xsk(int count)
+{
+	struct pollfd pfd[2] = {
+		{ .fd = xsk_sd, .events = POLLIN },
+		{ .fd = ctl_sd, .events = POLLIN },
+	};
+	struct prof_mark m = { 0 };
+	int rc;
+
+	while (running && !winchg && !relink) {
+		PROF_BEGIN(m);
+		rc = poll(pfd, ctl_sd >= 0 ? 2 : 1, -1);
+		PROF_END(m, PROF_WAIT);
+		if (rc <= 0)
+			continue;
+
+		if (pfd[0].revents) {
+			clock_gettime(CLOCK_REALTIME, &xsk_now);
+			xsk_recv(recv_frame);
+		}
+		if (pfd[1].revents)
+			control_recv(ctl_sd);
+
+		if (received(count)) {
+			running = 0;
+			break;
+		}
+	}
+
 	return 0;
 }
 
 int receiver(int count)
 {
-	struct pollfd pfd[MAX_NUM_GROUPS];
+	struct pollfd pfd[MAX_NUM_GROUPS + 1];
+	struct prof_mark m = { 0 };
+	size_t i, num = group_num;
 	int rc = 0;
-	size_t i;
+
+	if (busy_poll)
+		return receiver_busy(count);
+	if (xdp)
+		return receiver_xdp(count);
+	if (af_xdp)
+		return receiver_xsk(count);
 
 	for (i = 0; i < group_num; i++) {
 		pfd[i].fd = groups[i].sd;
@@ -293,8 +1061,17 @@ int receiver(int count)
 		pfd[i].revents = 0;
 	}
 
-	while (running && !winchg) {
-		rc = poll(pfd, group_num, -1);
+	/* Control channel last, so counters are up to date when answering */
+	if (ctl_sd >= 0) {
+		pfd[num].fd = ctl_sd;
+		pfd[num].events = POLLIN;
+		pfd[num++].revents = 0;
+	}
+
+	while (running && !winchg && !relink) {
+		PROF_BEGIN(m);
+		rc = poll(pfd, num, -1);
+		PROF_END(m, PROF_WAIT);
 		if (rc <= 0) {
 			rc = 0;
 			continue;
@@ -304,21 +1081,82 @@ int receiver(int count)
 			if (pfd[i].revents)
 				recv_mcast(i);
 		}
+		if (num > group_num && pfd[group_num].revents)
+			control_recv(ctl_sd);
+		rxq_tick();
 
-		if (count > 0) {
-			size_t total = count * group_num;
+		rc = 0;
+		if (received(count)) {
+			running = 0;
+			break;
+		}
+	}
 
-			for (i = 0; i < group_num; i++)
-				total -= groups[i].count;
+	return rc;
+}
 
-			if (total <= 0) {
-				running = 0;
-				break;
+/* Receive CPU and NAPI ID per group, and how many of each in total */
+static void incoming_stats(void)
+{
+	uint64_t cpus = 0;
+	size_t i, j, napis = 0;
+	inet_addr_t peer;
+	int num = 0;
+
+	PRINT("\nReceive CPU and NAPI ID per group:");
+	for (i = 0; i < group_num; i++) {
+		struct rxcpu *rc = &groups[i].rxcpu;
+		char addr[INET_ADDRSTR_LEN];
+		char from[INET_ADDRSTR_LEN + 8] = "-";
+		char napi[16] = "-";
+		socklen_t len = sizeof(peer);
+
+		if (rc->cpu < 0) {
+			PRINT("  %-20s  unknown, no packets or not supported", groups[i].group);
+			continue;
+		}
+
+		if (rc->napi) {
+			snprintf(napi, sizeof(napi), "%u", rc->napi);
+			for (j = 0; j < i; j++) {
+				if (groups[j].rxcpu.cpu >= 0 && groups[j].rxcpu.napi == rc->napi)
+					break;
 			}
+			if (j == i)
+				napis++;
 		}
+
+		/* Sender address and port, the flow that RSS and ECMP hash on */
+		if (!getpeername(groups[i].sd, (struct sockaddr *)&peer, &len))
+			snprintf(from, sizeof(from), peer.ss_family == AF_INET ? "%s:%u" : "[%s]:%u",
+				 inet_address(&peer, addr, sizeof(addr)), ntohs(inet_addr_get_port(&peer)));
+
+		cpus |= rc->cpus;
+		PRINT("  %-20s  from %-24s  CPU %3d  NAPI ID %-8s  %zu moves", groups[i].group,
+		      from, rc->cpu, napi, rc->moves);
 	}
 
-	return rc;
+	for (i = 0; i < 64; i++) {
+		if (cpus & (1ULL << i))
+			num++;
+	}
+	PRINT("Groups arrived on %d CPUs and %zu NAPI IDs", num, napis);
+}
+
+void receiver_stats(void)
+{
+	xsk_stats();
+	if (incoming)
+		incoming_stats();
+	if (gro)
+		PRINT("UDP GRO: %zu coalesced reads, %.1f packets per read", gro_reads,
+		      gro_reads ? (double)gro_segs / gro_reads : 0.0);
+
+	if (!rx_latency || !rx_hist.num)
+		return;
+
+	PRINT("\nKernel to application latency:");
+	hist_show(&rx_hist, busy_poll ? "busy-poll" : "blocking", "Receiver");
 }
 
 /**
@@ -0,0 +1,213 @@
+/* RTP header generation and RFC3550 receiver statistics
+ *
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <arpa/inet.h>
+#include <string.h>
+
+#include "rtp.h"
+
+/*
+ * Fixed 12 byte header, no CSRC list or extensions.  The remainder of
+ * the payload, up to len, is left as-is by the caller.
+ */
+size_t rtp_build(uint8_t *buf, size_t len, uint8_t pt, uint16_t seq, uint32_t ts, uint32_t ssrc)
+{
+	uint16_t nseq = htons(seq);
+	uint32_t nts  = htonl(ts);
+	uint32_t nsrc = htonl(ssrc);
+
+	if (len < RTP_HDR_LEN)
+		return 0;
+
+	buf[0] = RTP_VERSION << 6;
+	buf[1] = pt & 0x7f;
+	memcpy(&buf[2], &nseq, sizeof(nseq));
+	memcpy(&buf[4], &nts,  sizeof(nts));
+	memcpy(&buf[8], &nsrc, sizeof(nsrc));
+
+	return len;
+}
+
+/*
+ * Length of RTP header, including CSRC list and any header extension,
+ * i.e., offset to the payload.  Returns 0 if not a valid RTP header.
+ */
+size_t rtp_hdrlen(const uint8_t *buf, size_t len)
+{
+	size_t hlen;
+
+	if (len < RTP_HDR_LEN || (buf[0] >> 6) != RTP_VERSION)
+		return 0;
+
+	hlen = RTP_HDR_LEN + (buf[0] & 0x0f) * 4;
+	if (buf[0] & 0x10) {
+		if (len < hlen + 4)
+			return 0;
+		hlen += 4 + ((buf[hlen + 2] << 8) | buf[hlen + 3]) * 4;
+	}
+
+	if (len < hlen)
+		return 0;
+
+	return hlen;
+}
+
+/* Start over, new SSRC or a restarted sender, jitter included */
+static void init_seq(struct rtp *r, uint16_t seq, uint32_t transit)
+{
+	r->transit   = transit;
+	r->jitter    = 0;
+	r->base_seq  = seq;
+	r->max_seq   = seq;
+	r->bad_seq   = RTP_SEQ_MOD + 1;
+	r->cycles    = 0;
+	r->received  = 0;
+	r->reordered = 0;
+}
+
+/*
+ * Update sequence number state, from RFC3550 appendix A.1, but without
+ * the probation period -- we want to start counting right away.
+ *
+ * Returns 0 if in sequence, 1 on a gap, 2 if late or duplicate, and 3
+ * on a very large jump, or the re-sync after it.
+ */
+static int update_seq(struct rtp *r, uint16_t seq, uint32_t transit)
+{
+	uint16_t udelta = seq - r->max_seq;
+	int rc = 0;
+
+	if (udelta == 0) {
+		r->reordered++;
+		rc = 2;
+	} else if (udelta < RTP_MAX_DROPOUT) {
+		/* In order, with permissible gap */
+		if (seq < r->max_seq)
+			r->cycles += RTP_SEQ_MOD;
+		r->max_seq = seq;
+		if (udelta > 1)
+			rc = 1;
+	} else if (udelta <= RTP_SEQ_MOD - RTP_MAX_MISORDER) {
+		/*
+		 * The sequence number made a very large jump.  If two
+		 * sequential packets arrive, assume the other side
+		 * restarted without telling us, so just re-sync.
+		 */
+		if (seq == r->bad_seq)
+			init_seq(r, seq, transit);
+		else
+			r->bad_seq = (seq + 1) & (RTP_SEQ_MOD - 1);
+		rc = 3;
+	} else {
+		/* Duplicate or reordered packet */
+		r->reordered++;
+		rc = 2;
+	}
+	r->received++;
+
+	return rc;
+}
+
+/*
+ * Parse RTP header and update receiver statistics.  The arrival time
+ * must be in the same units as the RTP timestamp, i.e., the sampling
+ * clock of the sender, any offset cancels out in the jitter calc.
+ *
+ * Returns -1 if not an RTP packet, otherwise see update_seq().
+ */
+int rtp_parse(struct rtp *r, const uint8_t *buf, size_t len, uint32_t arrival)
+{
+	uint32_t ssrc, ts, transit;
+	uint16_t seq;
+	int32_t d;
+	int rc;
+
+	if (!rtp_hdrlen(buf, len))
+		return -1;
+
+	memcpy(&seq,  &buf[2], sizeof(seq));
+	memcpy(&ts,   &buf[4], sizeof(ts));
+	memcpy(&ssrc, &buf[8], sizeof(ssrc));
+	seq  = ntohs(seq);
+	ts   = ntohl(ts);
+	ssrc = ntohl(ssrc);
+	transit = arrival - ts;
+
+	if (!r->valid || r->ssrc != ssrc) {
+		if (r->valid)
+			r->ssrc_changes++;
+
+		r->valid   = 1;
+		r->ssrc    = ssrc;
+		r->pt      = buf[1] & 0x7f;
+		init_seq(r, seq, transit);
+		r->received = 1;
+
+		return 0;
+	}
+
+	/* Timestamps across a jump are from another run of the sender */
+	rc = update_seq(r, seq, transit);
+	if (rc == 3)
+		return 1;
+
+	/* RFC3550, appendix A.8 */
+	d          = (int32_t)(transit - r->transit);
+	r->transit = transit;
+	if (d < 0)
+		d = -d;
+	r->jitter += d - ((r->jitter + 8) >> 4);
+
+	return rc;
+}
+
+/* Extended highest sequence number received */
+uint32_t rtp_extseq(struct rtp *r)
+{
+	return r->cycles + r->max_seq;
+}
+
+/* Cumulative number of packets lost, RFC3550 appendix A.3 */
+size_t rtp_lost(struct rtp *r)
+{
+	uint32_t expected;
+
+	if (!r->valid)
+		return 0;
+
+	expected = rtp_extseq(r) - r->base_seq + 1;
+	if (expected <= r->received)
+		return 0;
+
+	return expected - r->received;
+}
+
+/* Interarrival jitter in milliseconds */
+double rtp_jitter(struct rtp *r, uint32_t clock)
+{
+	if (!clock)
+		return 0.0;
+
+	return (double)r->jitter / 16.0 * 1000.0 / clock;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
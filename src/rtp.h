@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MCJOIN_RTP_H_
+#define MCJOIN_RTP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RTP_VERSION       2
+#define RTP_HDR_LEN       12
+#define RTP_DEFAULT_PT    33		/* MP2T, RFC3551 */
+#define RTP_DEFAULT_CLOCK 90000
+
+/* RFC3550, appendix A.1 */
+#define RTP_MAX_DROPOUT   3000
+#define RTP_MAX_MISORDER  100
+#define RTP_SEQ_MOD       (1 << 16)
+
+/* Per-group receiver state, one per SSRC at a time */
+struct rtp {
+	int       valid;	/* Seen at least one packet */
+	uint32_t  ssrc;
+	uint8_t   pt;
+
+	uint16_t  max_seq;	/* Highest seq. number seen */
+	uint32_t  cycles;	/* Shifted count of seq. number cycles */
+	uint32_t  base_seq;	/* Extended seq. number of first packet */
+	uint32_t  bad_seq;	/* Last 'bad' seq number + 1 */
+	size_t    received;	/* Packets received from this SSRC */
+	size_t    reordered;	/* Late, or duplicate, packets */
+
+	uint32_t  transit;	/* Relative transit time for prev pkt */
+	uint32_t  jitter;	/* Estimated jitter, scaled by 16 */
+
+	size_t    ssrc_changes;
+};
+
+size_t   rtp_build  (uint8_t *buf, size_t len, uint8_t pt, uint16_t seq, uint32_t ts, uint32_t ssrc);
+size_t   rtp_hdrlen (const uint8_t *buf, size_t len);
+int      rtp_parse  (struct rtp *r, const uint8_t *buf, size_t len, uint32_t arrival);
+
+uint32_t rtp_extseq (struct rtp *r);
+size_t   rtp_lost   (struct rtp *r);
+double   rtp_jitter (struct rtp *r, uint32_t clock);
+
+#endif /* MCJOIN_RTP_H_ */
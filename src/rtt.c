@@ -0,0 +1,413 @@
+/* Round-trip latency, reflector and sender side RTT histograms
+ *
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+#include "mcjoin.h"
+#include "rtt.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Reflector side */
+static int          refl4 = -1;
+static int          refl6 = -1;
+static struct echo *echo;	/* Precomputed per group */
+static inet_addr_t  ret;	/* Return group, if any */
+
+/* Sender side */
+struct rtt {
+	uint64_t     tx[RTT_RING];	/* Send time, by sequence number */
+	struct hist  hist;
+};
+
+static struct rtt *rtt;
+static struct gr   ret_gr;	/* Return group, joined by sender */
+
+/* Upper limit of each bucket, in us, last bucket is everything above */
+static const uint32_t bucket[HIST_BUCKETS - 1] = {
+	10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000
+};
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void echo_hdr(struct echo *e, inet_addr_t *addr)
+{
+	memcpy(e->magic, ECHO_MAGIC, sizeof(e->magic));
+	e->family = htons(addr->ss_family);
+#ifdef AF_INET6
+	if (addr->ss_family == AF_INET6) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)addr;
+
+		e->port = sin6->sin6_port;
+		memcpy(e->addr, &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+	} else
+#endif
+	{
+		struct sockaddr_in *sin = (struct sockaddr_in *)addr;
+
+		e->port = sin->sin_port;
+		memcpy(e->addr, &sin->sin_addr, sizeof(sin->sin_addr));
+	}
+}
+
+static int addr_group(const char *group, inet_addr_t *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+#ifdef AF_INET6
+	if (strchr(group, ':')) {
+		if (inet_pton(AF_INET6, group, &((struct sockaddr_in6 *)addr)->sin6_addr) != 1)
+			return -1;
+		addr->ss_family = AF_INET6;
+	} else
+#endif
+	{
+		if (inet_pton(AF_INET, group, &((struct sockaddr_in *)addr)->sin_addr) != 1)
+			return -1;
+		addr->ss_family = AF_INET;
+	}
+	inet_addr_set_port(addr, htons(port));
+
+	return 0;
+}
+
+int reflect_init(void)
+{
+	size_t i;
+
+	echo = calloc(group_num, sizeof(*echo));
+	if (!echo) {
+		ERROR("Failed allocating reflector state: %s", strerror(errno));
+		return 1;
+	}
+
+	for (i = 0; i < group_num; i++)
+		echo_hdr(&echo[i], &groups[i].grp);
+
+	if (return_group) {
+		if (addr_group(return_group, &ret)) {
+			ERROR("Invalid return group: %s", return_group);
+			return 1;
+		}
+		PRINT("Reflecting packets to group %s", return_group);
+	} else
+		PRINT("Reflecting packets to sender");
+
+	return 0;
+}
+
+static int reflect_socket(int family)
+{
+	int *sd = family == AF_INET ? &refl4 : &refl6;
+
+	if (*sd < 0)
+		*sd = send_socket(family);
+
+	return *sd;
+}
+
+/*
+ * Echo header of each packet in a receive batch, zero-copy from the
+ * receive buffers, in one batch.  Packets with msg_len zero, i.e.,
+ * received on the wrong socket, are skipped.
+ */
+void reflect_batch(size_t id, struct mmsghdr *msgv, int num)
+{
+	struct mmsghdr out[RECV_BATCH];
+	struct iovec iov[RECV_BATCH][2];
+	int i, n = 0, sd;
+
+	for (i = 0; i < num && n < RECV_BATCH; i++) {
+		struct msghdr *msgh = &msgv[i].msg_hdr;
+		inet_addr_t *dst;
+		size_t len;
+
+		len = msgv[i].msg_len;
+		if (!len)
+			continue;
+		if (len > ECHO_LEN)
+			len = ECHO_LEN;
+
+		dst = ret.ss_family ? &ret : (inet_addr_t *)msgh->msg_name;
+
+		iov[n][0].iov_base = &echo[id];
+		iov[n][0].iov_len  = sizeof(echo[id]);
+		iov[n][1].iov_base = msgh->msg_iov[0].iov_base;
+		iov[n][1].iov_len  = len;
+
+		memset(&out[n], 0, sizeof(out[n]));
+		out[n].msg_hdr.msg_name    = dst;
+		out[n].msg_hdr.msg_namelen = inet_addrlen(dst);
+		out[n].msg_hdr.msg_iov     = iov[n];
+		out[n].msg_hdr.msg_iovlen  = 2;
+		n++;
+	}
+
+	if (!n)
+		return;
+
+	/* All echoes in a batch go to the same address family */
+	sd = reflect_socket(((inet_addr_t *)out[0].msg_hdr.msg_name)->ss_family);
+	if (sd < 0)
+		return;
+
+#ifdef HAVE_SENDMMSG
+	if (sendmmsg(sd, out, n, 0) < 0)
+		DEBUG("Failed reflecting packets: %s", strerror(errno));
+#else
+	for (i = 0; i < n; i++) {
+		if (sendmsg(sd, &out[i].msg_hdr, 0) < 0)
+			DEBUG("Failed reflecting packet: %s", strerror(errno));
+	}
+#endif
+}
+
+int rtt_init(void)
+{
+	rtt = calloc(group_num, sizeof(*rtt));
+	if (!rtt) {
+		ERROR("Failed allocating RTT state: %s", strerror(errno));
+		return 1;
+	}
+
+	ret_gr.sd = -1;
+	if (!return_group)
+		return 0;
+
+	ret_gr.group = return_group;
+	if (addr_group(return_group, &ret_gr.grp)) {
+		ERROR("Invalid return group: %s", return_group);
+		return 1;
+	}
+
+	return join_group(&ret_gr);
+}
+
+/* Return group socket, unicast echoes arrive on the send sockets */
+int rtt_sd(void)
+{
+	return ret_gr.sd;
+}
+
+void rtt_sent(size_t id, size_t seq)
+{
+	rtt[id].tx[seq & (RTT_RING - 1)] = now();
+}
+
+static struct gr *find_group(struct echo *e, size_t *id)
+{
+	static size_t hint = 0;
+	inet_addr_t addr = { 0 };
+	struct echo key;
+	size_t i;
+
+	addr.ss_family = ntohs(e->family);
+	if (addr.ss_family != AF_INET && addr.ss_family != AF_INET6)
+		return NULL;
+
+	for (i = 0; i < group_num; i++) {
+		size_t j = (hint + i) % group_num;
+
+		if (groups[j].grp.ss_family != addr.ss_family)
+			continue;
+
+		echo_hdr(&key, &groups[j].grp);
+		if (memcmp(&key, e, sizeof(key)))
+			continue;
+
+		hint = j;
+		*id  = j;
+		return &groups[j];
+	}
+
+	return NULL;
+}
+
+/* Sequence number of echoed packet, extended from our own */
+static int echo_seq(struct gr *g, uint8_t *buf, size_t len, size_t *seq)
+{
+	if (rtp) {
+		uint16_t diff, seq16;
+
+		if (len < RTP_HDR_LEN)
+			return -1;
+
+		seq16 = (buf[2] << 8) | buf[3];
+		diff  = (uint16_t)(g->seq - 1 - seq16);
+		*seq  = g->seq - 1 - diff;
+	} else {
+		char *ptr;
+
+		buf[len] = 0;
+		ptr = strstr((char *)buf, SEQ_KEY);
+		if (!ptr)
+			return -1;
+		*seq = strtoul(ptr + strlen(SEQ_KEY), NULL, 10);
+	}
+
+	return 0;
+}
+
+void hist_add(struct hist *h, uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	size_t i;
+
+	if (!h->num || ns < h->min)
+		h->min = ns;
+	if (ns > h->max)
+		h->max = ns;
+	h->sum += ns;
+	h->num++;
+
+	for (i = 0; i < NELEMS(bucket); i++) {
+		if (us < bucket[i])
+			break;
+	}
+	h->bucket[i]++;
+}
+
+/* Show min/avg/max and non-empty buckets, what is e.g. "RTT" */
+void hist_show(struct hist *h, const char *what, const char *name)
+{
+	char buf[256] = "";
+	size_t i, len = 0;
+
+	PRINT("%s: %s min/avg/max %.3f/%.3f/%.3f ms, %zu samples", name, what,
+	      h->min / 1000000.0, (double)h->sum / h->num / 1000000.0,
+	      h->max / 1000000.0, h->num);
+
+	for (i = 0; i < HIST_BUCKETS && len < sizeof(buf); i++) {
+		char lim[16];
+
+		if (!h->bucket[i])
+			continue;
+
+		if (i == NELEMS(bucket))
+			snprintf(lim, sizeof(lim), ">=%ums", bucket[i - 1] / 1000);
+		else if (bucket[i] < 1000)
+			snprintf(lim, sizeof(lim), "<%uus", bucket[i]);
+		else
+			snprintf(lim, sizeof(lim), "<%ums", bucket[i] / 1000);
+
+		len += snprintf(&buf[len], sizeof(buf) - len, "%s%s %zu",
+				len ? ", " : "", lim, h->bucket[i]);
+	}
+	PRINT("  %s", buf);
+}
+
+/* Read one batch of echoes, match each to the send time of its packet */
+void rtt_recv(int sd)
+{
+	static uint8_t bufv[RECV_BATCH][sizeof(struct echo) + ECHO_LEN + 1];
+	struct mmsghdr msgv[RECV_BATCH];
+	struct iovec iov[RECV_BATCH];
+	uint64_t rx;
+	int i, num;
+
+	for (i = 0; i < RECV_BATCH; i++) {
+		iov[i].iov_base = bufv[i];
+		iov[i].iov_len  = sizeof(bufv[i]) - 1;
+		memset(&msgv[i], 0, sizeof(msgv[i]));
+		msgv[i].msg_hdr.msg_iov    = &iov[i];
+		msgv[i].msg_hdr.msg_iovlen = 1;
+	}
+
+#ifdef HAVE_RECVMMSG
+	num = recvmmsg(sd, msgv, RECV_BATCH, MSG_DONTWAIT, NULL);
+#else
+	for (num = 0; num < RECV_BATCH; num++) {
+		ssize_t len;
+
+		len = recvmsg(sd, &msgv[num].msg_hdr, MSG_DONTWAIT);
+		if (len < 0)
+			break;
+		msgv[num].msg_len = len;
+	}
+#endif
+	if (num <= 0)
+		return;
+
+	rx = now();
+	for (i = 0; i < num; i++) {
+		struct echo *e = (struct echo *)bufv[i];
+		size_t len = msgv[i].msg_len;
+		size_t id, seq, slot;
+		struct gr *g;
+		uint64_t tx;
+
+		if (len < sizeof(*e) || memcmp(e->magic, ECHO_MAGIC, sizeof(e->magic)))
+			continue;
+
+		g = find_group(e, &id);
+		if (!g)
+			continue;
+
+		if (echo_seq(g, bufv[i] + sizeof(*e), len - sizeof(*e), &seq))
+			continue;
+		if (g->seq - seq > RTT_RING)
+			continue;	/* Too old, slot reused */
+
+		/* Only first echo counts, e.g., with more than one reflector */
+		slot = seq & (RTT_RING - 1);
+		tx   = rtt[id].tx[slot];
+		if (!tx || rx < tx)
+			continue;
+		rtt[id].tx[slot] = 0;
+
+		hist_add(&rtt[id].hist, rx - tx);
+	}
+}
+
+void rtt_stats(void)
+{
+	size_t i;
+
+	if (!rtt)
+		return;
+
+	PRINT("\nRound-trip time per group:");
+	for (i = 0; i < group_num; i++) {
+		char name[80];
+
+		snprintf(name, sizeof(name), "Group %s", groups[i].group);
+		if (!rtt[i].hist.num) {
+			PRINT("%s: no echoes of %zu sent", name, groups[i].count);
+			continue;
+		}
+
+		hist_show(&rtt[i].hist, "RTT", name);
+		PRINT("  %zu echoes of %zu sent", rtt[i].hist.num, groups[i].count);
+	}
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
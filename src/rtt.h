@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef MCJOIN_RTT_H_
+#define MCJOIN_RTT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define ECHO_MAGIC   "MCJE"
+#define ECHO_LEN     128	/* Max bytes of original packet echoed */
+#define RTT_RING     1024	/* Send times kept per group, power of 2 */
+#define HIST_BUCKETS 14
+#define RTT_GRACE    1000	/* msec, wait for last echoes after -c COUNT */
+
+/*
+ * Echo datagram from reflector: this header, identifying the group the
+ * packet was received on, followed by the first ECHO_LEN bytes of the
+ * packet, i.e., the text or RTP header with the sequence number.
+ */
+struct echo {
+	char     magic[4];
+	uint16_t family;
+	uint16_t port;
+	uint8_t  addr[16];
+};
+
+/* Latency histogram, log scale from 10 us to 100 ms */
+struct hist {
+	size_t    num;
+	uint64_t  min;
+	uint64_t  max;
+	uint64_t  sum;
+	size_t    bucket[HIST_BUCKETS];
+};
+
+void hist_add      (struct hist *h, uint64_t ns);
+void hist_show     (struct hist *h, const char *what, const char *name);
+
+int  reflect_init  (void);
+void reflect_batch (size_t id, struct mmsghdr *msgv, int num);
+
+int  rtt_init      (void);
+int  rtt_sd        (void);
+void rtt_sent      (size_t id, size_t seq);
+void rtt_recv      (int sd);
+void rtt_stats     (void);
+
+#endif /* MCJOIN_RTT_H_ */
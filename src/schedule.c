@@ -0,0 +1,280 @@
+/* CPU affinity, real-time priority, memory locking, and UI thread
+ *
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+#include "mcjoin.h"
+#include "schedule.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+static pthread_t ui_tid;
+static int       ui_running;
+static void    (*ui_cb)(int);
+
+/* Screen drawing, the UI thread vs. log messages from the I/O thread */
+static pthread_mutex_t ui_mutex;
+
+/* Wakeup latency of the I/O thread, last and max, in ns */
+static volatile uint64_t lat_last;
+static volatile uint64_t lat_max;
+
+/* Parse CPU list, e.g., 2 or 1-3,6 */
+static int cpu_list(const char *arg, cpu_set_t *set)
+{
+	const char *ptr = arg;
+
+	CPU_ZERO(set);
+	while (*ptr) {
+		char *end;
+		long lo, hi;
+
+		lo = hi = strtol(ptr, &end, 10);
+		if (end == ptr)
+			goto fail;
+		if (*end == '-') {
+			ptr = end + 1;
+			hi = strtol(ptr, &end, 10);
+			if (end == ptr)
+				goto fail;
+		}
+		if (lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+			goto fail;
+
+		while (lo <= hi)
+			CPU_SET(lo++, set);
+
+		if (*end == ',')
+			end++;
+		else if (*end)
+			goto fail;
+		ptr = end;
+	}
+
+	if (CPU_COUNT(set))
+		return 0;
+fail:
+	ERROR("Invalid CPU list: %s", arg);
+	return -1;
+}
+
+/* First CPU in set */
+static int cpu_first(cpu_set_t *set)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, set))
+			return cpu;
+	}
+
+	return -1;
+}
+
+/* Touch stack pages now, so deep call chains don't page fault later */
+static void prefault_stack(void)
+{
+	volatile char stack[PREFAULT_STACK];
+	size_t i;
+
+	for (i = 0; i < sizeof(stack); i += 4096)
+		stack[i] = 0;
+}
+
+/*
+ * Apply --cpu, --sched, --mlock, and --prefault to the calling, I/O,
+ * thread.  Busy-poll mode is pinned to a single CPU, the first in the
+ * --cpu list, or the one we are running on.
+ */
+int sched_init(void)
+{
+	cpu_set_t set;
+	int cpu;
+
+	if (io_cpu && cpu_list(io_cpu, &set))
+		return 1;
+
+	if (busy_poll) {
+		cpu = io_cpu ? cpu_first(&set) : sched_getcpu();
+		if (cpu >= 0) {
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			PRINT("Busy polling on CPU %d", cpu);
+		}
+	}
+
+	if ((io_cpu || busy_poll) && sched_setaffinity(0, sizeof(set), &set)) {
+		ERROR("Failed setting CPU affinity: %s", strerror(errno));
+		return 1;
+	}
+
+	if (sched_policy != SCHED_OTHER) {
+		struct sched_param sp = { .sched_priority = sched_prio };
+
+		if (sched_setscheduler(0, sched_policy, &sp)) {
+			ERROR("Failed setting %s priority %d: %s",
+			      sched_policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR",
+			      sched_prio, strerror(errno));
+			return 1;
+		}
+	}
+
+	if (prefault)
+		prefault_stack();
+
+	if (mlock_mem) {
+		if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+			ERROR("Failed locking memory: %s", strerror(errno));
+			return 1;
+		}
+	} else if (prefault) {
+		/* Fault in everything mapped, buffers included, then let go */
+		if (!mlockall(MCL_CURRENT))
+			munlockall();
+	}
+
+	return 0;
+}
+
+/* Screen updates at -f MSEC on their own CPU, at normal priority */
+static void *ui_thread(void *arg)
+{
+	struct sched_param sp = { .sched_priority = 0 };
+	struct timespec next;
+	cpu_set_t set;
+	sigset_t mask;
+
+	(void)arg;
+
+	/* Signals are for the I/O thread, we only draw */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &sp);
+	if (!cpu_list(ui_cpu, &set) && pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+		ERROR("Failed setting UI CPU affinity: %s", strerror(errno));
+
+	/* Same initial delay as timer_init() */
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	next.tv_sec++;
+
+	while (ui_running) {
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+			;
+
+		/* Not cancelled while holding the lock, or mid escape sequence */
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		pthread_mutex_lock(&ui_mutex);
+		ui_cb(0);
+		pthread_mutex_unlock(&ui_mutex);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+		next.tv_sec  += period / 1000000;
+		next.tv_nsec += (long)(period % 1000000) * 1000;
+		if (next.tv_nsec >= (long)NSEC_PER_SEC) {
+			next.tv_sec++;
+			next.tv_nsec -= NSEC_PER_SEC;
+		}
+	}
+
+	return NULL;
+}
+
+/* Start UI thread, if --ui-cpu is set, returns 0 when started */
+int sched_ui(void (*cb)(int))
+{
+	pthread_mutexattr_t attr;
+	int rc;
+
+	if (!ui_cpu)
+		return -1;
+
+	/* Recursive, the plotter may log while drawing */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&ui_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	ui_cb = cb;
+	ui_running = 1;
+	rc = pthread_create(&ui_tid, NULL, ui_thread, NULL);
+	if (rc) {
+		ERROR("Failed starting UI thread: %s", strerror(rc));
+		ui_running = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Draw on screen from the I/O thread.  Only with the UI thread, without
+ * it drawing is from SIGALRM, which must never wait for a lock held by
+ * the code it interrupted.
+ */
+void sched_ui_lock(void)
+{
+	if (ui_running)
+		pthread_mutex_lock(&ui_mutex);
+}
+
+void sched_ui_unlock(void)
+{
+	if (ui_running)
+		pthread_mutex_unlock(&ui_mutex);
+}
+
+void sched_exit(void)
+{
+	if (!ui_running)
+		return;
+
+	ui_running = 0;
+	pthread_cancel(ui_tid);
+	pthread_join(ui_tid, NULL);
+}
+
+/* Record wakeup latency of I/O thread, from sender deadlines or receiver */
+void sched_lat(uint64_t ns)
+{
+	lat_last = ns;
+	if (ns > lat_max)
+		lat_max = ns;
+}
+
+int sched_show(char *buf, size_t len)
+{
+	if (!lat_max)
+		return 0;
+
+	return snprintf(buf, len, "latency %.0f us, max %.0f us",
+			lat_last / 1000.0, lat_max / 1000.0);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
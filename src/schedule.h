@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef MCJOIN_SCHEDULE_H_
+#define MCJOIN_SCHEDULE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PREFAULT_STACK  (256 * 1024)	/* Bytes of stack to touch */
+
+int  sched_init (void);
+int  sched_ui   (void (*cb)(int));
+void sched_exit (void);
+
+void sched_ui_lock   (void);
+void sched_ui_unlock (void);
+
+void sched_lat  (uint64_t ns);
+int  sched_show (char *buf, size_t len);
+
+#endif /* MCJOIN_SCHEDULE_H_ */
@@ -0,0 +1,392 @@
+/* Maximum lossless rate search, RFC2544 style, with cooperating receiver
+ *
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+#include "mcjoin.h"
+#include "search.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Sender side */
+static int          ctl_sd = -1;
+static unsigned int trial_id;
+
+static struct {
+	size_t    size;		/* Payload bytes */
+	uint64_t  pps;		/* Max lossless rate per group, 0 if none */
+	size_t    trials;
+} result[MODEL_SIZES];
+static size_t result_num;
+
+/* Receiver side, counters per group at BEGIN */
+static size_t *base;
+
+static int addr_parse(const char *host, inet_addr_t *ss, short port)
+{
+	memset(ss, 0, sizeof(*ss));
+#ifdef AF_INET6
+	if (inet_pton(AF_INET6, host, &((struct sockaddr_in6 *)ss)->sin6_addr) == 1)
+		ss->ss_family = AF_INET6;
+	else
+#endif
+	if (inet_pton(AF_INET, host, &((struct sockaddr_in *)ss)->sin_addr) == 1)
+		ss->ss_family = AF_INET;
+	else
+		return -1;
+
+	inet_addr_set_port(ss, port);
+
+	return 0;
+}
+
+int search_init(void)
+{
+	inet_addr_t peer;
+
+	if (addr_parse(search_host, &peer, htons(SEARCH_PORT))) {
+		ERROR("Invalid receiver address: %s", search_host);
+		return 1;
+	}
+
+	ctl_sd = socket(peer.ss_family, SOCK_DGRAM, 0);
+	if (ctl_sd < 0) {
+		ERROR("Failed opening control socket: %s", strerror(errno));
+		return 1;
+	}
+
+	/* Only accept replies from our receiver */
+	if (connect(ctl_sd, (struct sockaddr *)&peer, inet_addrlen(&peer))) {
+		ERROR("Failed connecting control socket to %s: %s", search_host, strerror(errno));
+		close(ctl_sd);
+		ctl_sd = -1;
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Send command and wait for reply with the same trial id, retry a few
+ * times since both command and reply may be lost in a congested network.
+ */
+static int request(const char *cmd, unsigned int id, size_t *min, size_t *total)
+{
+	char buf[128];
+	int retry;
+
+	for (retry = 0; running && retry < SEARCH_RETRIES; retry++) {
+		struct pollfd pfd = { .fd = ctl_sd, .events = POLLIN };
+		struct timespec deadline;
+
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += SEARCH_TIMEOUT / 1000;
+		deadline.tv_nsec += (SEARCH_TIMEOUT % 1000) * 1000000;
+
+		snprintf(buf, sizeof(buf), "%s %u", cmd, id);
+		if (send(ctl_sd, buf, strlen(buf), 0) < 0)
+			goto fail;
+
+		while (running) {
+			size_t rmin = 0, rtotal = 0;
+			unsigned int rid;
+			char reply[16];
+			struct timespec now;
+			ssize_t len;
+			long msec;
+			int rc;
+
+			/* Our UI timer interrupts poll(), so track time left */
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			msec = (deadline.tv_sec - now.tv_sec) * 1000 +
+				(deadline.tv_nsec - now.tv_nsec) / 1000000;
+			if (msec <= 0)
+				break;
+
+			rc = poll(&pfd, 1, (int)msec);
+			if (rc < 0 && errno == EINTR)
+				continue;
+			if (rc <= 0)
+				break;
+
+			len = recv(ctl_sd, buf, sizeof(buf) - 1, 0);
+			if (len < 0)
+				goto fail;
+			buf[len] = 0;
+
+			if (sscanf(buf, "%15s %u %zu %zu", reply, &rid, &rmin, &rtotal) < 2)
+				continue;
+			if (rid != id)
+				continue; /* Stale reply to a retry */
+
+			if (min)
+				*min = rmin;
+			if (total)
+				*total = rtotal;
+
+			return 0;
+		}
+	}
+
+	if (running)
+		ERROR("No reply from %s, is it running with --control?", search_host);
+	return -1;
+fail:
+	ERROR("Failed control request to %s: %s", search_host, strerror(errno));
+	return -1;
+}
+
+/* Wait for packets still in flight, before asking for the result */
+static void settle(void)
+{
+	struct timespec ts = { 0, SEARCH_SETTLE };
+
+	while (running && nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * Run one trial, returns 1 if the worst group lost packets, or if the
+ * sender could not keep up with the rate, 0 if lossless, -1 on error.
+ */
+static int trial(size_t len, uint64_t pps)
+{
+	unsigned int id = ++trial_id;
+	size_t sent, min = 0, lost;
+	uint64_t start, wall;
+	int limited;
+
+	if (request(CTRL_BEGIN, id, NULL, NULL))
+		return -1;
+
+	start = now_ns();
+	sent = sender_trial(len, pps, search_trial);
+	wall = now_ns() - start;
+	settle();
+
+	if (request(CTRL_END, id, &min, NULL))
+		return -1;
+
+	lost = sent > min ? sent - min : 0;
+	limited = wall > search_trial + search_trial / SEARCH_RESOLUTION;
+	if (limited)
+		PRINT("Trial %u: %zu bytes at %" PRIu64 " pps/group, sent %zu, lost %zu, "
+		      "sender limited to %.0f pps/group", id, len, pps, sent, lost,
+		      (double)sent * NSEC_PER_SEC / wall);
+	else
+		PRINT("Trial %u: %zu bytes at %" PRIu64 " pps/group, sent %zu, lost %zu",
+		      id, len, pps, sent, lost);
+
+	return lost || limited;
+}
+
+/*
+ * For each payload size, ramp up the per-group rate by doubling it until
+ * loss, then binary search between the last lossless and the first lossy
+ * rate until within SEARCH_RESOLUTION.  A rate the sender cannot keep up
+ * with counts as lossy.
+ */
+static int search(size_t len, uint64_t start, uint64_t *max, size_t *trials)
+{
+	uint64_t lo = 0, hi = 0, pps = start;
+	int rc;
+
+	while (running) {
+		rc = trial(len, pps);
+		if (rc < 0)
+			return -1;
+		(*trials)++;
+
+		if (rc)
+			hi = pps;
+		else
+			lo = pps;
+
+		if (!hi) {
+			if (pps >= SEARCH_MAX_PPS)
+				break;
+			pps *= 2;
+			if (pps > SEARCH_MAX_PPS)
+				pps = SEARCH_MAX_PPS;
+			continue;
+		}
+
+		if (hi - lo <= hi / SEARCH_RESOLUTION || hi - lo <= 1)
+			break;
+		pps = lo + (hi - lo) / 2;
+	}
+
+	*max = lo;
+
+	return 0;
+}
+
+int search_run(void)
+{
+	uint64_t start;
+	size_t i, num;
+
+	start = 1000000 / (period > 0 ? period : 1);
+	if (!start)
+		start = 1;
+
+	num = model.num ? model.num : 1;
+	for (i = 0; running && i < num; i++) {
+		size_t len = model.num ? model.size[i] : bytes;
+
+		if (rtp && len < RTP_HDR_LEN)
+			len = RTP_HDR_LEN;
+
+		result[i].size = len;
+		if (search(len, start, &result[i].pps, &result[i].trials))
+			break;
+		result_num = i + 1;
+
+		PRINT("Max lossless rate for %zu bytes: %" PRIu64 " pps/group", len, result[i].pps);
+	}
+
+	running = 0;
+
+	return result_num == num ? 0 : 1;
+}
+
+void search_stats(void)
+{
+	size_t i;
+
+	if (!result_num)
+		return;
+
+	PRINT("\nMax lossless rate, %zu group(s), %.1f sec trials:", group_num,
+	      (double)search_trial / NSEC_PER_SEC);
+	PRINT("%8s %12s %12s %12s %8s", "Bytes", "pps/group", "Mbps/group", "Mbps total", "Trials");
+	for (i = 0; i < result_num; i++) {
+		/* On-wire size incl. the 42 bytes of Ethernet/IP/UDP headers */
+		double mbps = (double)result[i].pps * (result[i].size + 42) * 8 / 1000000;
+
+		PRINT("%8zu %12" PRIu64 " %12.2f %12.2f %8zu", result[i].size, result[i].pps,
+		      mbps, mbps * group_num, result[i].trials);
+	}
+}
+
+/* Receiver side, answer BEGIN/END on PORT + 1, from any address family */
+int control_init(void)
+{
+	inet_addr_t addr;
+	int sd = -1;
+
+	base = calloc(group_num, sizeof(*base));
+	if (!base) {
+		ERROR("Failed allocating control state: %s", strerror(errno));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+#ifdef AF_INET6
+	sd = socket(AF_INET6, SOCK_DGRAM, 0);
+	if (sd >= 0) {
+		int off = 0;
+
+		if (setsockopt(sd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)))
+			DEBUG("Failed enabling dual-stack control socket: %s", strerror(errno));
+		((struct sockaddr_in6 *)&addr)->sin6_addr = in6addr_any;
+		addr.ss_family = AF_INET6;
+	}
+#endif
+	if (sd < 0) {
+		sd = socket(AF_INET, SOCK_DGRAM, 0);
+		if (sd < 0) {
+			ERROR("Failed opening control socket: %s", strerror(errno));
+			return -1;
+		}
+		((struct sockaddr_in *)&addr)->sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.ss_family = AF_INET;
+	}
+
+	inet_addr_set_port(&addr, htons(SEARCH_PORT));
+	if (bind(sd, (struct sockaddr *)&addr, inet_addrlen(&addr))) {
+		ERROR("Failed binding control socket to port %d: %s",
+		      SEARCH_PORT, strerror(errno));
+		close(sd);
+		return -1;
+	}
+
+	PRINT("Answering rate search requests on port %d", SEARCH_PORT);
+
+	return sd;
+}
+
+void control_recv(int sd)
+{
+	char buf[128], cmd[16];
+	inet_addr_t from;
+	socklen_t flen = sizeof(from);
+	unsigned int id;
+	ssize_t len;
+	size_t i;
+
+	len = recvfrom(sd, buf, sizeof(buf) - 1, MSG_DONTWAIT, (struct sockaddr *)&from, &flen);
+	if (len <= 0)
+		return;
+	buf[len] = 0;
+
+	if (sscanf(buf, "%15s %u", cmd, &id) != 2)
+		return;
+
+	if (!strcmp(cmd, CTRL_BEGIN)) {
+		for (i = 0; i < group_num; i++)
+			base[i] = groups[i].count;
+		snprintf(buf, sizeof(buf), "%s %u", CTRL_OK, id);
+	} else if (!strcmp(cmd, CTRL_END)) {
+		size_t min = (size_t)-1, total = 0;
+
+		for (i = 0; i < group_num; i++) {
+			size_t num = groups[i].count - base[i];
+
+			if (num < min)
+				min = num;
+			total += num;
+		}
+		snprintf(buf, sizeof(buf), "%s %u %zu %zu", CTRL_RESULT, id, min, total);
+	} else
+		return;
+
+	if (sendto(sd, buf, strlen(buf), 0, (struct sockaddr *)&from, flen) < 0)
+		DEBUG("Failed sending control reply: %s", strerror(errno));
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
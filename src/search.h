@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef MCJOIN_SEARCH_H_
+#define MCJOIN_SEARCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SEARCH_PORT_OFFSET  1		/* Control channel on PORT + 1 */
+#define SEARCH_PORT         (port + port_num - 1 + SEARCH_PORT_OFFSET)	/* After -p range */
+#define SEARCH_MAX_PPS      10000000	/* Per group, upper bound of ramp */
+#define SEARCH_RESOLUTION   100		/* Stop at 1% between lossless and lossy */
+#define SEARCH_SETTLE       200000000	/* ns, wait for stragglers before END */
+#define SEARCH_TIMEOUT      500		/* msec, wait for control reply */
+#define SEARCH_RETRIES      4
+
+/*
+ * Control protocol, text over UDP, sender to receiver:
+ *
+ *   BEGIN <trial>  -->  OK <trial>                    snapshot counters
+ *   END <trial>    -->  RESULT <trial> <min> <total>  packets since BEGIN
+ *
+ * where min is the lowest number of packets received by any group.
+ */
+#define CTRL_BEGIN  "BEGIN"
+#define CTRL_END    "END"
+#define CTRL_OK     "OK"
+#define CTRL_RESULT "RESULT"
+
+int  search_init  (void);
+int  search_run   (void);
+void search_stats (void);
+
+int  control_init (void);
+void control_recv (int sd);
+
+#endif /* MCJOIN_SEARCH_H_ */
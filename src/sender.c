@@ -18,15 +18,33 @@
 
 #include "config.h"
 #include "mcjoin.h"
+#include "model.h"
+#include "netlink.h"
+#include "pcap.h"
+#include "profile.h"
+#include "rtt.h"
+#include "schedule.h"
+#include "search.h"
+#include "stream.h"
+#include "txtime.h"
+#include "xsk.h"
 
 #include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef HAVE_SYS_PRCTL_H
+#include <sys/prctl.h>
+#endif
 
 
-static int send_socket(int family)
+/* Multicast send socket on IFACE, bound to source port sp, 0 for ephemeral */
+static int new_socket(int family, int sp, int verbose)
 {
 	inet_addr_t addr;
 	char buf[INET_ADDRSTR_LEN];
@@ -56,9 +74,19 @@ static int send_socket(int family)
 		return -1;
 	}
 
-	PRINT("Sending IPv%s multicast on %s addr, %s ifindex: %d, sd: %d",
-	      family == AF_INET ? "4" : "6", iface,
-	      inet_address(&addr, buf, sizeof(buf)), ifindex, sd);
+	inet_address(&addr, buf, sizeof(buf));
+	if (verbose)
+		PRINT("Sending IPv%s multicast on %s addr, %s ifindex: %d, sd: %d",
+		      family == AF_INET ? "4" : "6", iface, buf, ifindex, sd);
+
+	/* Same source port on the sockets of all groups that share it */
+	if (sp) {
+		int val = 1;
+
+		if (setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val)))
+			ERROR("Failed enabling SO_REUSEADDR: %s", strerror(errno));
+		inet_addr_set_port(&addr, htons(sp));
+	}
 
 	if (family == AF_INET) {
 #ifdef HAVE_STRUCT_IP_MREQN_IMR_IFINDEX
@@ -91,7 +119,7 @@ static int send_socket(int family)
 	}
 #endif
 	if (bind(sd, (struct sockaddr *)&addr, inet_addrlen(&addr)) == -1) {
-		ERROR("Failed binding socket to %s", buf);
+		ERROR("Failed binding socket to %s: %s", buf, strerror(errno));
 		close(sd);
 		return -1;
 	}
@@ -99,74 +127,1355 @@ static int send_socket(int family)
 	return sd;
 }
 
-static void send_mcast(int signo)
+int send_socket(int family)
+{
+	return new_socket(family, 0, 1);
+}
+
+static int sd4 = -1;
+static int sd6 = -1;
+static int connected = 0;	/* Socket per group, with --connect */
+
+/* Timer ticks sent by the periodic sender, first one second after start */
+static volatile sig_atomic_t ticks;
+static struct timespec tick_start;
+
+/* Send backpressure, full socket buffer or interface queue */
+static struct {
+	size_t    deferred;	/* Packets that got EAGAIN or ENOBUFS */
+	size_t    retried;	/* ... and were sent on a retry */
+	size_t    dropped;	/* ... and were given up at end of budget */
+	size_t    errors;	/* Other send errors */
+	struct timespec start;	/* Start of current budget */
+	uint64_t  budget;	/* ns to retry within, from start */
+} txq;
+
+/* Replay timing fidelity, lateness of each packet vs. its deadline */
+static struct {
+	size_t    packets;
+	uint64_t  late_sum;
+	uint64_t  late_max;
+	size_t    hist[5];	/* < 10us, 100us, 1ms, 10ms, and above */
+	uint64_t  duration;
+} replay;
+
+/* Report interface queue drops as ENOBUFS, instead of silently losing them */
+static void tx_recverr(int sd)
+{
+	int val = 1;
+
+	if (sd < 0)
+		return;
+#ifdef AF_INET6
+	if (setsockopt(sd, IPPROTO_IPV6, IPV6_RECVERR, &val, sizeof(val)) &&
+	    setsockopt(sd, IPPROTO_IP, IP_RECVERR, &val, sizeof(val)))
+#else
+	if (setsockopt(sd, IPPROTO_IP, IP_RECVERR, &val, sizeof(val)))
+#endif
+		DEBUG("Failed enabling IP_RECVERR: %s", strerror(errno));
+}
+
+static void close_fd(int *sd)
+{
+	if (*sd < 0)
+		return;
+
+	txtime_close(*sd);
+	close(*sd);
+	*sd = -1;
+}
+
+/* Close all send sockets, to open them again on link up */
+static void close_sockets(void)
 {
-	static int sd4 = -1;
-	static int sd6 = -1;
-	char buf[BUFSZ] = { 0 };
 	size_t i;
 
-	if (sd4 == -1 && need4)
-		sd4 = send_socket(AF_INET);
+	close_fd(&sd4);
+	close_fd(&sd6);
+	if (!connect_groups)
+		return;
+
+	for (i = 0; i < group_num; i++)
+		close_fd(&groups[i].sd);
+	connected = 0;
+}
+
+/*
+ * One socket per group, connected to the group, so the kernel can use
+ * the cached route and neighbour of the socket instead of looking them
+ * up for each sendto().  Like the receiver, a socket per group is
+ * within the RLIMIT_NOFILE set up at start.  With a --sport range each
+ * group is sent from its own source port, in turn, for flow entropy.
+ */
+static int connect_sockets(void)
+{
+	char buf[INET_ADDRSTR_LEN];
+	size_t i, num = 0;
+
+	if (connected)
+		return 0;
+
+	for (i = 0; i < group_num; i++) {
+		struct gr *g = &groups[i];
+		int family = g->grp.ss_family;
+
+		if ((family == AF_INET && !need4) || (family != AF_INET && !need6))
+			continue;
+
+		g->sd = new_socket(family, sport ? sport + (int)(i % sport_num) : 0, 0);
+		if (g->sd < 0)
+			goto fail;
+
+		if (connect(g->sd, (struct sockaddr *)&g->grp, inet_addrlen(&g->grp))) {
+			ERROR("Failed connecting socket to %s: %s",
+			      inet_address(&g->grp, buf, sizeof(buf)), strerror(errno));
+			goto fail;
+		}
+		tx_recverr(g->sd);
+		if (txtime_active() && txtime_socket(g->sd))
+			goto fail;
+		num++;
+	}
+
+	if (!num)
+		return -1;
+	connected = 1;
+
+	if (sport_num > 1)
+		PRINT("Sending multicast on %s, %zu connected sockets, one per group, "
+		      "from source ports %d-%d", iface, num, sport, sport + sport_num - 1);
+	else
+		PRINT("Sending multicast on %s, %zu connected sockets, one per group", iface, num);
+
+	return 0;
+fail:
+	close_sockets();
+	return -1;
+}
+
+/* Open sockets for the address families we need, if not already open */
+static int open_sockets(void)
+{
+	if (connect_groups)
+		return connect_sockets();
+
+	if (sd4 == -1 && need4) {
+		sd4 = new_socket(AF_INET, sport, 1);
+		tx_recverr(sd4);
+	}
 #ifdef AF_INET6
-	if (sd6 == -1 && need6)
-		sd6 = send_socket(AF_INET6);
+	if (sd6 == -1 && need6) {
+		sd6 = new_socket(AF_INET6, sport, 1);
+		tx_recverr(sd6);
+	}
 #endif
 
 	/* Need at least one socket to send any packet */
 	if (sd4 < 0 && sd6 < 0)
-		exit(1);
+		return -1;
+
+	if (txtime_active() && (txtime_socket(sd4) || txtime_socket(sd6)))
+		return -1;
+
+	return 0;
+}
+
+static int group_socket(struct gr *g)
+{
+	int sd;
+
+	if (connect_groups)
+		return g->sd;
+
+	sd = g->grp.ss_family == AF_INET ? sd4 : sd6;
+
+	if (sd < 0)
+		DEBUG("Skipping group %s, no available %s socket.  No address on interface?",
+		      g->group, g->grp.ss_family == AF_INET ? "IPv4" : "IPv6");
+
+	return sd;
+}
+
+/* Model sender, on its own schedule per group */
+static int paced(void)
+{
+	return model_active(&model) || txtime;
+}
+
+/* RTP timestamp offset, random as recommended by RFC3550 */
+static uint32_t rtp_offset(void)
+{
+	static uint32_t offset = 0;
+
+	if (!offset)
+		offset = (uint32_t)random();
+
+	return offset;
+}
+
+/* RTP timestamp from monotonic time, in units of the RTP clock */
+static uint32_t rtp_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return rtp_offset() + (uint32_t)((uint64_t)ts.tv_sec * rtp_clock +
+					 (uint64_t)ts.tv_nsec * rtp_clock / NSEC_PER_SEC);
+}
+
+/* Synthetic payload, text with sequence number or RTP header */
+static void build_payload(struct gr *g, char *buf, size_t len, uint32_t ts)
+{
+	struct prof_mark m = { 0 };
+
+	PROF_BEGIN(m);
+	if (rtp) {
+		rtp_build((uint8_t *)buf, len, rtp_pt, g->seq++, ts, rtp_ssrc);
+		DEBUG("Sending RTP packet, seq: %zu", g->seq - 1);
+	} else {
+		snprintf(buf, BUFSZ, "%s%u, MC group %s ... %s%zu, %s%d",
+			 MAGIC_KEY, getpid(), g->group,
+			 SEQ_KEY, g->seq++,
+			 FREQ_KEY, period / 1000);
+		DEBUG("Sending packet, msg: %s", buf);
+	}
+	PROF_END(m, PROF_BUILD);
+}
+
+/* Shortest text payload that still carries the whole sequence number */
+size_t sender_text_min(const char *group)
+{
+	return snprintf(NULL, 0, "%s%u, MC group %s ... %s%zu", MAGIC_KEY, UINT_MAX,
+			group, SEQ_KEY, (size_t)SIZE_MAX);
+}
+
+/* Time since start, on the monotonic clock */
+static uint64_t elapsed(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)(now.tv_sec - start->tv_sec) * NSEC_PER_SEC +
+		now.tv_nsec - start->tv_nsec;
+}
+
+/* Retries of a send, from now on, may take at most budget ns */
+static void tx_begin(uint64_t budget)
+{
+	clock_gettime(CLOCK_MONOTONIC, &txq.start);
+	txq.budget = budget;
+}
+
+/* Retries must not delay the next packet, the time until it is due */
+static uint64_t tx_budget(struct timespec *start, uint64_t next)
+{
+	uint64_t now = elapsed(start);
+
+	return next > now ? next - now : 0;
+}
+
+static int tx_busy(int err)
+{
+	return err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS;
+}
+
+/*
+ * Called when a send fails.  Socket buffer full, EAGAIN, or interface
+ * queue full, ENOBUFS: wait for room, or a short while, and return 1 to
+ * retry, unless the budget is spent.  Other errors are not retried.
+ */
+static int tx_retry(int sd, int *deferred)
+{
+	struct pollfd pfd = { .fd = sd, .events = POLLOUT };
+	struct timespec ts = { 0, TX_BACKOFF };
+	uint64_t spent;
+	int err = errno;
+
+	if (!tx_busy(err))
+		return 0;
+
+	if (!*deferred) {
+		*deferred = 1;
+		txq.deferred++;
+	}
+
+	spent = elapsed(&txq.start);
+	if (spent >= txq.budget) {
+		txq.dropped++;
+		return 0;
+	}
 
+	/* Socket is writable while the interface queue is full */
+	if (err == ENOBUFS) {
+		if (txq.budget - spent < TX_BACKOFF)
+			ts.tv_nsec = txq.budget - spent;
+		nanosleep(&ts, NULL);
+	} else {
+		ts.tv_sec  = (txq.budget - spent) / NSEC_PER_SEC;
+		ts.tv_nsec = (txq.budget - spent) % NSEC_PER_SEC;
+#ifdef HAVE_PPOLL
+		ppoll(&pfd, 1, &ts, NULL);
+#else
+		poll(&pfd, 1, (int)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000 + 1));
+#endif
+	}
+	errno = err;
+
+	return 1;
+}
+
+static void tx_sent(int deferred)
+{
+	if (deferred)
+		txq.retried++;
+	nl_data();
+}
+
+/* Failed send, group marked and error logged at most once per second */
+static void tx_error(struct gr *g)
+{
+	static time_t last = -1;
+	static size_t quiet = 0;
+	struct timespec now;
+	int err = errno;
+
+	STATUS_MARK(g, 'E');
+	if (!tx_busy(err))
+		txq.errors++;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec == last) {
+		quiet++;
+		return;
+	}
+
+	if (quiet)
+		ERROR("Failed sending mcast packet: %s, %zu more failed sends not logged",
+		      strerror(err), quiet);
+	else
+		ERROR("Failed sending mcast packet: %s", strerror(err));
+	last  = now.tv_sec;
+	quiet = 0;
+}
+
+/* Destination of message, none on connected sockets */
+static void group_dest(struct msghdr *msg, struct gr *g)
+{
+	if (connect_groups) {
+		msg->msg_name    = NULL;
+		msg->msg_namelen = 0;
+	} else {
+		msg->msg_name    = &g->grp;
+		msg->msg_namelen = inet_addrlen(&g->grp);
+	}
+}
+
+static int send_batch(int sd, struct mmsghdr *msgv, size_t num)
+{
+	struct prof_mark m = { 0 };
+	int deferred = 0;
+	int rc;
+
+	PROF_BEGIN(m);
+	if (af_xdp) {
+		rc = xsk_send(sd, msgv, num);
+	} else {
+		do {
+#ifdef HAVE_SENDMMSG
+			rc = sendmmsg(sd, msgv, num, MSG_DONTWAIT);
+#else
+			for (rc = 0; rc < (int)num; rc++) {
+				if (sendmsg(sd, &msgv[rc].msg_hdr, MSG_DONTWAIT) < 0) {
+					if (!rc)
+						rc = -1;
+					break;
+				}
+			}
+#endif
+		} while (rc < 0 && tx_retry(sd, &deferred));
+		if (rc > 0)
+			tx_sent(deferred);
+	}
+	PROF_END(m, PROF_SEND);
+
+	return rc;
+}
+
+/* Single packet to group, the paced modes */
+static ssize_t send_one(int sd, struct gr *g, char *buf, size_t len)
+{
+	struct prof_mark m = { 0 };
+	int deferred = 0;
+	ssize_t rc;
+
+	if (af_xdp) {
+		struct iovec iov = { .iov_base = buf, .iov_len = len };
+		struct mmsghdr msg = { 0 };
+
+		group_dest(&msg.msg_hdr, g);
+		msg.msg_hdr.msg_iov     = &iov;
+		msg.msg_hdr.msg_iovlen  = 1;
+
+		return send_batch(sd, &msg, 1) == 1 ? (ssize_t)len : -1;
+	}
+
+	PROF_BEGIN(m);
+	do {
+		if (connect_groups)
+			rc = send(sd, buf, len, MSG_DONTWAIT);
+		else
+			rc = sendto(sd, buf, len, MSG_DONTWAIT, (struct sockaddr *)&g->grp,
+				    inet_addrlen(&g->grp));
+	} while (rc < 0 && tx_retry(sd, &deferred));
+	if (rc >= 0)
+		tx_sent(deferred);
+	PROF_END(m, PROF_SEND);
+
+	return rc;
+}
+
+/* Single packet with RTP header in front, the stream sender */
+static ssize_t send_msg(int sd, struct msghdr *msg)
+{
+	struct mmsghdr mm = { .msg_hdr = *msg };
+	int deferred = 0;
+	ssize_t rc;
+
+	if (af_xdp)
+		return send_batch(sd, &mm, 1) == 1 ? (ssize_t)mm.msg_len : -1;
+
+	do
+		rc = sendmsg(sd, msg, MSG_DONTWAIT);
+	while (rc < 0 && tx_retry(sd, &deferred));
+	if (rc >= 0)
+		tx_sent(deferred);
+
+	return rc;
+}
+
+/* Wakeup latency of timer tick, vs. the expected -f MSEC period */
+static void tick_lat(void)
+{
+	static struct timespec last = { 0, 0 };
+	struct timespec now;
+	int64_t ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = (int64_t)(now.tv_sec - last.tv_sec) * NSEC_PER_SEC + (now.tv_nsec - last.tv_nsec);
+	ns -= (int64_t)period * 1000;
+	if (last.tv_sec && ns > 0)
+		sched_lat(ns);
+	last = now;
+}
+
+static void send_mcast(int signo)
+{
+	uint64_t due = NSEC_PER_SEC + (uint64_t)ticks * period * 1000;
+	char buf[BUFSZ] = { 0 };
+	uint32_t ts = 0;
+	size_t i;
+
+	(void)signo;
+	if (count > 0 && (size_t)ticks >= count)
+		return;
+
+	tick_lat();
+
+	/* Main loop waits for the interface, see sender_relink() */
+	if (open_sockets()) {
+		relink = 1;
+		return;
+	}
+
+	if (rtp)
+		ts = rtp_now();
+
+	tx_begin((uint64_t)period * 1000);
 	for (i = 0; i < group_num; i++) {
-		struct sockaddr *dest = (struct sockaddr *)&groups[i].grp;
-		socklen_t len = inet_addrlen(&groups[i].grp);
-		int sd = groups[i].grp.ss_family == AF_INET ? sd4 : sd6;
+		struct gr *g = &groups[i];
+		int sd = group_socket(g);
+		uint64_t sys = 0;
+
+		if (sd < 0)
+			continue;
+
+		build_payload(g, buf, bytes, ts);
+		if (latency)
+			rtt_sent(i, g->seq - 1);
+		if (txtime_active())
+			sys = txtime_now();
+		if (send_one(sd, g, buf, bytes) < 0) {
+			tx_error(g);
+		} else {
+			g->count++;
+			STATUS_MARK(g, '.');
+			txtime_sent(sd, &g, &due, sys, 1);
+		}
+	}
+	ticks++;
+	if (txtime_active())
+		txtime_drain();
+
+	plotter_show(0);
+}
+
+/* Sleep until due ns after start, on the monotonic clock */
+static void sleep_until(struct timespec *start, uint64_t due)
+{
+	struct prof_mark m = { 0 };
+	struct timespec ts;
+	uint64_t late;
+
+	ts.tv_sec  = start->tv_sec + due / NSEC_PER_SEC;
+	ts.tv_nsec = start->tv_nsec + due % NSEC_PER_SEC;
+	if (ts.tv_nsec >= (long)NSEC_PER_SEC) {
+		ts.tv_sec++;
+		ts.tv_nsec -= NSEC_PER_SEC;
+	}
+
+	PROF_BEGIN(m);
+#ifdef HAVE_CLOCK_NANOSLEEP
+	while (running && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+#else
+	while (running) {
+		struct timespec now, rel;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		rel.tv_sec  = ts.tv_sec - now.tv_sec;
+		rel.tv_nsec = ts.tv_nsec - now.tv_nsec;
+		if (rel.tv_nsec < 0) {
+			rel.tv_sec--;
+			rel.tv_nsec += NSEC_PER_SEC;
+		}
+		if (rel.tv_sec < 0 || !nanosleep(&rel, NULL))
+			break;
+	}
+#endif
+	PROF_END(m, PROF_WAIT);
+
+	late = elapsed(start);
+	if (late > due)
+		sched_lat(late - due);
+}
+
+static void replay_late(uint64_t late)
+{
+	uint64_t limit = 10000;
+	size_t i;
+
+	replay.packets++;
+	replay.late_sum += late;
+	if (late > replay.late_max)
+		replay.late_max = late;
+
+	for (i = 0; i < NELEMS(replay.hist) - 1; i++, limit *= 10) {
+		if (late < limit)
+			break;
+	}
+	replay.hist[i]++;
+}
+
+static uint64_t replay_due(struct pcap_pkt *pkt)
+{
+	if (speed <= 0.0)
+		return 0;
+
+	return (uint64_t)(pkt->ts / speed);
+}
+
+/*
+ * Replay UDP payloads of a capture, each flow (destination address and
+ * port) mapped to a group, with the original timing scaled by speed.
+ * All packets due, for the same socket, are sent in one batch.
+ */
+static int send_pcap(void)
+{
+	static struct timespec start = { 0, 0 };
+	static size_t idx = 0;
+
+	if (open_sockets())
+		return 1;
+
+	if (!start.tv_sec) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (txtime_active())
+			txtime_start(&start);
+	}
+
+	while (running && !winchg && !relink) {
+		struct mmsghdr msgv[SEND_BATCH];
+		struct iovec iov[SEND_BATCH];
+		struct gr *gv[SEND_BATCH];
+		uint64_t dv[SEND_BATCH];
+		struct pcap_pkt *pkt;
+		uint64_t now, tx, sys = 0;
+		size_t i, num;
+		int sd = -1;
+		int rc;
+
+		pkt = pcap_pkt(idx);
+		if (!pkt || (count > 0 && idx >= count)) {
+			replay.duration = elapsed(&start);
+			running = 0;
+			break;
+		}
+
+		now = elapsed(&start);
+		if (replay_due(pkt) > now) {
+			sleep_until(&start, replay_due(pkt));
+			if (!running)
+				break;
+			now = elapsed(&start);
+		}
+
+		for (num = 0; num < SEND_BATCH; num++) {
+			struct gr *g;
+			int gsd;
+
+			pkt = pcap_pkt(idx + num);
+			if (!pkt || replay_due(pkt) > now)
+				break;
+			if (count > 0 && idx + num >= count)
+				break;
+
+			g = &groups[pkt->flow % group_num];
+			gsd = group_socket(g);
+			if (num && gsd != sd)
+				break;
+			sd = gsd;
+
+			iov[num].iov_base = (void *)pkt->data;
+			iov[num].iov_len  = pkt->len;
+			memset(&msgv[num], 0, sizeof(msgv[num]));
+			group_dest(&msgv[num].msg_hdr, g);
+			msgv[num].msg_hdr.msg_iov     = &iov[num];
+			msgv[num].msg_hdr.msg_iovlen  = 1;
+			gv[num] = g;
+			dv[num] = replay_due(pkt);
+		}
 
 		if (sd < 0) {
-			DEBUG("Skipping group %s, no available %s socket.  No address on interface?",
-			      groups[i].group, groups[i].grp.ss_family == AF_INET ? "IPv4" : "IPv6");
+			idx += num;
 			continue;
 		}
 
-		snprintf(buf, sizeof(buf), "%s%u, MC group %s ... %s%zu, %s%d",
-			 MAGIC_KEY, getpid(), groups[i].group,
-			 SEQ_KEY, groups[i].seq++,
-			 FREQ_KEY, period / 1000);
-		DEBUG("Sending packet on signal %d, msg: %s", signo, buf);
-		if (sendto(sd, buf, bytes, 0, dest, len) < 0) {
-			ERROR("Failed sending mcast packet: %s", strerror(errno));
-			groups[i].status[STATUS_POS] = 'E';
+		/* Flat out, or the last packet, has no schedule to keep */
+		pkt = pcap_pkt(idx + num);
+		if (pkt && speed > 0.0)
+			tx_begin(tx_budget(&start, replay_due(pkt)));
+		else
+			tx_begin((uint64_t)period * 1000);
+		if (txtime_active())
+			sys = txtime_now();
+		rc = send_batch(sd, msgv, num);
+		tx = elapsed(&start);
+		if (rc <= 0) {
+			pkt = pcap_pkt(idx);
+			tx_error(&groups[pkt->flow % group_num]);
+			idx++;
+			continue;
+		}
+
+		for (i = 0; i < (size_t)rc; i++) {
+			struct gr *g;
+
+			pkt = pcap_pkt(idx + i);
+			g = &groups[pkt->flow % group_num];
+			g->seq++;
+			g->count++;
+			STATUS_MARK(g, '.');
+			replay_late(tx - replay_due(pkt));
+		}
+		txtime_sent(sd, gv, dv, sys, rc);
+		txtime_poll(sd);
+		idx += rc;
+	}
+
+	return 0;
+}
+
+/*
+ * Send the same datagram, straight from the file mapping, to all groups
+ * at the stream's own pace.  Optionally with an RTP header in front.
+ */
+static int send_stream(void)
+{
+	static struct timespec start = { 0, 0 };
+	static size_t sent = 0;
+
+	if (open_sockets())
+		return 1;
+
+	if (!start.tv_sec) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (txtime_active())
+			txtime_start(&start);
+	}
+
+	while (running && !winchg && !relink) {
+		uint8_t hdr[RTP_HDR_LEN];
+		struct iovec iov[2];
+		struct msghdr msg;
+		const uint8_t *buf;
+		uint64_t due;
+		size_t i, len;
+
+		len = stream_next(&buf, &due);
+		sleep_until(&start, due);
+		if (!running)
+			break;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov    = iov;
+		msg.msg_iovlen = 0;
+		if (rtp) {
+			iov[msg.msg_iovlen].iov_base  = hdr;
+			iov[msg.msg_iovlen++].iov_len = sizeof(hdr);
+		}
+		iov[msg.msg_iovlen].iov_base  = (void *)buf;
+		iov[msg.msg_iovlen++].iov_len = len;
+
+		tx_begin(tx_budget(&start, stream_peek()));
+		for (i = 0; i < group_num; i++) {
+			struct gr *g = &groups[i];
+			int sd = group_socket(g);
+			uint64_t sys = 0;
+
+			if (sd < 0)
+				continue;
+
+			if (rtp) {
+				uint32_t ts;
+
+				ts = rtp_offset() + (uint32_t)(due * rtp_clock / NSEC_PER_SEC);
+				rtp_build(hdr, sizeof(hdr), rtp_pt, g->seq, ts, rtp_ssrc);
+			}
+			g->seq++;
+
+			group_dest(&msg, g);
+			if (txtime_active())
+				sys = txtime_now();
+			if (send_msg(sd, &msg) < 0) {
+				tx_error(g);
+			} else {
+				g->count++;
+				STATUS_MARK(g, '.');
+				txtime_sent(sd, &g, &due, sys, 1);
+			}
+		}
+		if (txtime_active())
+			txtime_drain();
+
+		if (count > 0 && ++sent >= count)
+			running = 0;
+	}
+
+	return 0;
+}
+
+static char batch_buf[SEND_BATCH][BUFSZ];
+static struct gr *batch_gr[SEND_BATCH];
+static struct mmsghdr batch_msgv[SEND_BATCH];
+static struct iovec batch_iov[SEND_BATCH];
+static uint64_t batch_due[SEND_BATCH];		/* Scheduled departure, for TX stamps */
+
+/* Add packet to group g as message num of the batch */
+static void batch_msg(size_t num, struct gr *g, size_t len, uint32_t ts)
+{
+	build_payload(g, batch_buf[num], len, ts);
+	batch_gr[num] = g;
+	batch_iov[num].iov_base = batch_buf[num];
+	batch_iov[num].iov_len  = len;
+	memset(&batch_msgv[num], 0, sizeof(batch_msgv[num]));
+	group_dest(&batch_msgv[num].msg_hdr, g);
+	batch_msgv[num].msg_hdr.msg_iov    = &batch_iov[num];
+	batch_msgv[num].msg_hdr.msg_iovlen = 1;
+}
+
+static void batch_send(int sd, size_t batch)
+{
+	size_t j, k;
+
+	for (k = 0; k < batch; ) {
+		uint64_t sys = 0;
+		int rc;
+
+		if (txtime_active())
+			sys = txtime_now();
+		rc = send_batch(sd, &batch_msgv[k], batch - k);
+		if (rc <= 0) {
+			DEBUG("Failed sending mcast packet: %s", strerror(errno));
+			if (!tx_busy(errno))
+				txq.errors++;
+			STATUS_MARK(batch_gr[k++], 'E');
+			continue;
+		}
+
+		for (j = 0; j < (size_t)rc; j++) {
+			batch_gr[k + j]->count++;
+			STATUS_MARK(batch_gr[k + j], '.');
+		}
+		txtime_sent(sd, &batch_gr[k], &batch_due[k], sys, rc);
+		k += rc;
+	}
+}
+
+/* Min-heap of groups ordered by next departure, for the model sender */
+static uint64_t due[MAX_NUM_GROUPS];
+static size_t   heap[MAX_NUM_GROUPS];
+static size_t   heap_num;
+
+static void heap_down(size_t pos)
+{
+	while (1) {
+		size_t min = pos, l = 2 * pos + 1, r = l + 1, tmp;
+
+		if (l < heap_num && due[heap[l]] < due[heap[min]])
+			min = l;
+		if (r < heap_num && due[heap[r]] < due[heap[min]])
+			min = r;
+		if (min == pos)
+			break;
+
+		tmp       = heap[pos];
+		heap[pos] = heap[min];
+		heap[min] = tmp;
+		pos       = min;
+	}
+}
+
+/* First departure of each group, and start of the schedule */
+static void heap_init(struct timespec *start)
+{
+	size_t i;
+
+	for (i = 0; i < group_num; i++) {
+		due[i]  = model_next(i);
+		heap[i] = i;
+	}
+	heap_num = group_num;
+	for (i = heap_num / 2; i > 0; i--)
+		heap_down(i - 1);
+
+	clock_gettime(CLOCK_MONOTONIC, start);
+	if (txtime_active())
+		txtime_start(start);
+}
+
+/* Group at top of heap has departed, schedule next or retire it */
+static void heap_next(struct gr *g, size_t id)
+{
+	/* Retire group when done, last one in heap takes its place */
+	if (count > 0 && g->seq >= count)
+		heap[0] = heap[--heap_num];
+	else
+		due[id] = model_next(id);
+	heap_down(0);
+}
+
+/*
+ * Model sender with launch times: all departures within TXTIME_AHEAD
+ * are handed to the kernel in one batch, each with its launch time in
+ * an SCM_TXTIME message, and the etf or fq qdisc sends them on time.
+ */
+static int send_ahead(void)
+{
+	static struct timespec start = { 0, 0 };
+	uint64_t ahead = txtime_ahead();
+
+	if (open_sockets())
+		return 1;
+
+	if (!start.tv_sec)
+		heap_init(&start);
+
+	while (running && !winchg && !relink) {
+		size_t num = 0;
+		uint64_t now;
+		int sd = -1;
+
+		if (!heap_num) {
+			running = 0;
+			break;
+		}
+
+		now = elapsed(&start);
+		if (due[heap[0]] > now + ahead) {
+			sleep_until(&start, due[heap[0]] - ahead);
+			if (!running)
+				break;
+			now = elapsed(&start);
+		}
+
+		while (heap_num && num < SEND_BATCH && due[heap[0]] <= now + ahead) {
+			size_t id = heap[0], len;
+			struct gr *g = &groups[id];
+			uint32_t ts = 0;
+			int gsd;
+
+			gsd = group_socket(g);
+			if (gsd < 0) {
+				heap[0] = heap[--heap_num];
+				heap_down(0);
+				continue;
+			}
+			if (num && gsd != sd)
+				break;
+			sd = gsd;
+
+			if (rtp)
+				ts = rtp_offset() + (uint32_t)(due[id] * rtp_clock / NSEC_PER_SEC);
+
+			len = model_size(bytes);
+			if (rtp && len < RTP_HDR_LEN)
+				len = RTP_HDR_LEN;
+
+			batch_msg(num, g, len, ts);
+			txtime_msg(&batch_msgv[num].msg_hdr, num, due[id]);
+			batch_due[num++] = due[id];
+			heap_next(g, id);
+		}
+		if (!num)
+			continue;
+
+		tx_begin(ahead);
+		batch_send(sd, num);
+		txtime_poll(sd);
+	}
+
+	return 0;
+}
+
+/*
+ * Send synthetic payload to each group on its own schedule, as given
+ * by the traffic model: jitter, Poisson arrivals, bursts, size mix.
+ */
+static int send_model(void)
+{
+	static struct timespec start = { 0, 0 };
+	char buf[BUFSZ] = { 0 };
+
+	if (txtime_ahead())
+		return send_ahead();
+
+	if (open_sockets())
+		return 1;
+
+	if (!start.tv_sec)
+		heap_init(&start);
+
+	while (running && !winchg && !relink) {
+		uint64_t sys = 0;
+		uint32_t ts = 0;
+		struct gr *g;
+		size_t id, len;
+		int sd;
+
+		if (!heap_num) {
+			running = 0;
+			break;
+		}
+
+		id = heap[0];
+		if (due[id] > elapsed(&start)) {
+			sleep_until(&start, due[id]);
+			if (!running)
+				break;
+		}
+
+		g  = &groups[id];
+		sd = group_socket(g);
+		if (sd < 0) {
+			/* No socket for this family, retire group */
+			heap[0] = heap[--heap_num];
+			heap_down(0);
+			continue;
+		}
+
+		if (rtp)
+			ts = rtp_offset() + (uint32_t)(due[id] * rtp_clock / NSEC_PER_SEC);
+
+		len = model_size(bytes);
+		if (rtp && len < RTP_HDR_LEN)
+			len = RTP_HDR_LEN;
+
+		tx_begin((uint64_t)period * 1000);
+		build_payload(g, buf, len, ts);
+		if (txtime_active())
+			sys = txtime_now();
+		if (send_one(sd, g, buf, len) < 0) {
+			tx_error(g);
 		} else {
-			groups[i].count++;
-			groups[i].status[STATUS_POS] = '.';
+			g->count++;
+			STATUS_MARK(g, '.');
+			if (txtime_active()) {
+				txtime_sent(sd, &g, &due[id], sys, 1);
+				txtime_poll(sd);
+			}
 		}
+
+		heap_next(g, id);
 	}
 
-	plotter_show(0);
+	return 0;
+}
+
+/*
+ * Connected sockets: all rounds due, up to a batch, to one group at a
+ * time, so each sendmmsg() is full even though groups don't share a
+ * socket.  Returns number of rounds sent.
+ */
+static size_t trial_groups(size_t len, size_t rounds, uint32_t ts)
+{
+	size_t i, j;
+
+	if (rounds > SEND_BATCH)
+		rounds = SEND_BATCH;
+
+	for (i = 0; i < group_num; i++) {
+		struct gr *g = &groups[i];
+
+		if (g->sd < 0)
+			continue;
+
+		for (j = 0; j < rounds; j++)
+			batch_msg(j, g, len, ts);
+		batch_send(g->sd, rounds);
+	}
+
+	return rounds;
+}
+
+/*
+ * Send len byte packets to all groups at pps per group, for duration ns,
+ * in batches of everything that is due.  With pps 0, send as fast as
+ * possible.  Returns the number of packets attempted to each group, a
+ * packet the kernel drops is lost as well.
+ */
+size_t sender_trial(size_t len, uint64_t pps, uint64_t duration)
+{
+	struct timespec start;
+	size_t n = 0, i = 0, num;
+	uint32_t ts = 0;
+
+	if (open_sockets())
+		return 0;
+
+	num = pps ? (size_t)(duration * pps / NSEC_PER_SEC) : (size_t)-1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (running && n < num) {
+		uint64_t due = pps ? n * NSEC_PER_SEC / pps : 0, now;
+		size_t batch = 0;
+		int sd = -1;
+
+		now = elapsed(&start);
+		if (!pps && now >= duration)
+			break;
+		if (due > now) {
+			sleep_until(&start, due);
+			now = due;
+		}
+		if (rtp)
+			ts = rtp_offset() + (uint32_t)(now * rtp_clock / NSEC_PER_SEC);
+
+		/* Flat out, wait for room as long as it takes, like blocking I/O */
+		tx_begin(pps ? NSEC_PER_SEC / pps : duration);
+
+		if (connect_groups) {
+			size_t upto = pps ? (size_t)(now * pps / NSEC_PER_SEC) + 1 : num;
+
+			if (upto > num)
+				upto = num;
+			n += trial_groups(len, upto > n ? upto - n : 1, ts);
+			continue;
+		}
+
+		/* Round n, group i, onwards while due and on the same socket */
+		while (batch < SEND_BATCH && n < num && (!pps || n * NSEC_PER_SEC / pps <= now)) {
+			struct gr *g = &groups[i];
+			int gsd = group_socket(g);
+
+			if (batch && gsd != sd)
+				break;
+			sd = gsd;
+
+			if (sd >= 0)
+				batch_msg(batch++, g, len, ts);
+
+			if (++i == group_num) {
+				i = 0;
+				n++;
+			}
+			if (sd < 0)
+				break;
+		}
+
+		if (sd >= 0)
+			batch_send(sd, batch);
+	}
+
+	return n;
+}
+
+/* Paced modes sleep on absolute deadlines, reduce default 50us slack */
+static void timer_slack(void)
+{
+#ifdef PR_SET_TIMERSLACK
+	if (prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0))
+		DEBUG("Failed reducing timer slack: %s", strerror(errno));
+#endif
+}
+
+/* Wait for an address on IFACE, of a family we send to, or for Ctrl-C */
+static void wait_address(void)
+{
+	inet_addr_t addr;
+	int once = 1;
+
+	while (running) {
+		/* Started without a default route, name it once there is one */
+		if (!iface[0])
+			ifdefault(iface, IFNAMSIZ);
+
+		if ((need4 && ifinfo(iface, &addr, AF_INET) > 0) ||
+		    (need6 && ifinfo(iface, &addr, AF_INET6) > 0))
+			return;
+
+		if (once) {
+			PRINT("Waiting for an address on %s ...", iface[0] ? iface : "default interface");
+			once = 0;
+		}
+
+		/* No netlink, fail at open as before */
+		if (nl_wait(NL_WAIT_MSEC) < 0)
+			return;
+	}
 }
 
 int sender_init(void)
 {
+	size_t i;
+
+	if (latency && (search_host || pcap_file || stream_file || paced())) {
+		ERROR("Round-trip time is only supported by the periodic sender.");
+		return 1;
+	}
+
+	for (i = 0; connect_groups && i < group_num; i++)
+		groups[i].sd = -1;
+	wait_address();
+
+	if (af_xdp && xsk_init(0) < 0)
+		return 1;
+
+	if (pcap_file || stream_file || search_host || paced())
+		timer_slack();
+
+	if (search_host) {
+		if (search_init())
+			return 1;
+
+		timer_init(plotter_show);
+		return 0;
+	}
+
+	if (pcap_file) {
+		if (pcap_open(pcap_file))
+			return 1;
+
+		if (pcap_flows() > group_num)
+			PRINT("Mapping %zu flows in capture onto %zu groups", pcap_flows(), group_num);
+		timer_init(plotter_show);
+		return 0;
+	}
+
+	if (stream_file) {
+		if (stream_open(stream_file, bitrate, bytes))
+			return 1;
+
+		timer_init(plotter_show);
+		return 0;
+	}
+
+	if (paced()) {
+		if (model_init(&model, group_num, (uint64_t)period * 1000))
+			return 1;
+
+		timer_init(plotter_show);
+		return 0;
+	}
+
+	if (latency && rtt_init())
+		return 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &tick_start);
+	if (txtime_active())
+		txtime_start(&tick_start);
 	timer_init(send_mcast);
 
 	return 0;
 }
 
+/*
+ * Wait for next timer tick, or with --rtt, for echoes on the send
+ * sockets and the return group until tick or timeout (msec).
+ */
+static void sender_wait(int timeout)
+{
+	struct pollfd pfd[3];
+	int fds[3] = { sd4, sd6, rtt_sd() };
+	struct prof_mark m = { 0 };
+	size_t i, num = 0;
+	int rc;
+
+	/* Ticks interrupt the wait, their send is subtracted from it */
+	if (!latency) {
+		PROF_BEGIN(m);
+		pause();
+		PROF_END(m, PROF_WAIT);
+		return;
+	}
+
+	for (i = 0; i < NELEMS(fds); i++) {
+		if (fds[i] < 0)
+			continue;
+
+		pfd[num].fd       = fds[i];
+		pfd[num].events   = POLLIN;
+		pfd[num++].revents = 0;
+	}
+
+	PROF_BEGIN(m);
+	rc = poll(pfd, num, timeout);
+	PROF_END(m, PROF_WAIT);
+	if (rc <= 0)
+		return;
+
+	for (i = 0; i < num; i++) {
+		if (pfd[i].revents & POLLIN)
+			rtt_recv(pfd[i].fd);
+	}
+}
+
 int sender(void)
 {
-	while (running) {
+	struct timespec end = { 0, 0 };
+
+	if (search_host)
+		return search_run();
+	if (pcap_file)
+		return send_pcap();
+	if (stream_file)
+		return send_stream();
+	if (paced())
+		return send_model();
+
+	while (running && !relink) {
 		/* Let signal handler(s) do their job */
-		pause();
+		sender_wait(-1);
+
+		if (count > 0 && (size_t)ticks >= count)
+			break;
+	}
+	if (relink)
+		return 0;
+
+	/* Collect echoes of the last packets */
+	if (latency && running) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		end.tv_sec += RTT_GRACE / 1000;
+		while (running) {
+			struct timespec now;
+			long msec;
 
-		if (count > 0) {
-			if (!--count)
-				running = 0;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			msec = (end.tv_sec - now.tv_sec) * 1000 + (end.tv_nsec - now.tv_nsec) / 1000000;
+			if (msec <= 0)
+				break;
+			sender_wait((int)msec);
 		}
 	}
+	running = 0;
 
 	return 0;
 }
 
+/*
+ * Link up, new address, or sockets failed to open: open them all again,
+ * the source address may have changed.  Ticks of the periodic sender
+ * are held back meanwhile, so no packet is sent on a closed socket.
+ */
+int sender_relink(void)
+{
+	sigset_t mask, omask;
+	int ev, rc = 0;
+
+	ev = nl_recv();
+	if (ev != NL_UP && ev != NL_ADDR && (connect_groups ? connected : sd4 >= 0 || sd6 >= 0))
+		return 0;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGALRM);
+	sigprocmask(SIG_BLOCK, &mask, &omask);
+
+	close_sockets();
+	while (running) {
+		wait_address();
+		if (!open_sockets())
+			break;
+
+		if (nl_wait(NL_WAIT_MSEC) < 0) {
+			rc = 1;
+			break;
+		}
+	}
+
+	sigprocmask(SIG_SETMASK, &omask, NULL);
+
+	return rc;
+}
+
+void sender_stats(void)
+{
+	const char *bucket[] = { "<10us", "<100us", "<1ms", "<10ms", ">=10ms" };
+	char hist[128] = "";
+	size_t i, len = 0;
+
+	xsk_stats();
+
+	if (txq.deferred || txq.errors)
+		PRINT("Send backpressure: %zu deferred, %zu retried, %zu dropped on this host, %zu other errors",
+		      txq.deferred, txq.retried, txq.dropped, txq.errors);
+	txtime_stats();
+
+	if (search_host) {
+		search_stats();
+		return;
+	}
+
+	if (latency) {
+		rtt_stats();
+		return;
+	}
+
+	if (!pcap_file || !replay.packets)
+		return;
+
+	for (i = 0; i < NELEMS(replay.hist) && len < sizeof(hist); i++)
+		len += snprintf(&hist[len], sizeof(hist) - len, "%s%s %zu",
+				i ? ", " : "", bucket[i], replay.hist[i]);
+
+	PRINT("Replayed %zu packets in %.3f sec, capture %.3f sec at speed %g",
+	      replay.packets, (double)replay.duration / NSEC_PER_SEC,
+	      (double)pcap_pkt(pcap_num() - 1)->ts / NSEC_PER_SEC, speed);
+	PRINT("Lateness avg %.1f us, max %.1f us; %s",
+	      replay.late_sum / 1000.0 / replay.packets, replay.late_max / 1000.0, hist);
+}
+
 /**
  * Local Variables:
  *  indent-tabs-mode: t
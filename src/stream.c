@@ -0,0 +1,294 @@
+/* File-backed stream source, raw payload or MPEG-TS, for the sender
+ *
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mcjoin.h"
+#include "stream.h"
+
+#define PCR_MAX_GAP   NSEC_PER_SEC	/* Larger gap => discontinuity */
+
+/* Time line of the stream, from PCRs on the first PCR PID found */
+struct pcr_pt {
+	size_t   pkt;		/* TS packet number */
+	int64_t  ns;		/* Time since first PCR */
+};
+
+static void          *map_base;	/* File mapping */
+static size_t         map_len;	/* Length of mapping */
+static const uint8_t *map;	/* Start of stream in mapping */
+static size_t         len;	/* Length of stream, in full datagrams for TS */
+static size_t         pos;	/* Offset to next datagram */
+static size_t         dgram_len;
+static int            is_ts;
+
+static uint64_t       rate;	/* Bits/s, or 0 for PCR timing */
+static uint64_t       duration;	/* Time for one pass, ns */
+static uint64_t       loop_ns;	/* Time of all previous passes */
+
+static struct pcr_pt *pcrs;
+static size_t         pcr_max;
+static size_t         pcr_num;
+static size_t         pcr_cur;
+static int64_t        pcr_t0;	/* Extrapolated time of first packet */
+
+/* Find sync, allows for a capture starting mid-packet */
+static int ts_detect(const uint8_t *buf, size_t buflen)
+{
+	size_t off;
+
+	if (buflen < 3 * TS_PACKET_LEN)
+		return -1;
+
+	for (off = 0; off < TS_PACKET_LEN; off++) {
+		if (buf[off] == TS_SYNC_BYTE &&
+		    buf[off + TS_PACKET_LEN] == TS_SYNC_BYTE &&
+		    buf[off + 2 * TS_PACKET_LEN] == TS_SYNC_BYTE)
+			return (int)off;
+	}
+
+	return -1;
+}
+
+static int pcr_add(size_t pkt, int64_t ns)
+{
+	if (pcr_num == pcr_max) {
+		struct pcr_pt *tmp;
+
+		pcr_max = pcr_max ? pcr_max * 2 : 1024;
+		tmp = realloc(pcrs, pcr_max * sizeof(*pcrs));
+		if (!tmp)
+			return -1;
+		pcrs = tmp;
+	}
+
+	pcrs[pcr_num].pkt  = pkt;
+	pcrs[pcr_num++].ns = ns;
+
+	return 0;
+}
+
+/*
+ * Build a time line from all PCRs of the first PID carrying PCR.  On
+ * discontinuities, or wrap, the average rate so far is used to bridge
+ * the gap.
+ */
+static int pcr_scan(void)
+{
+	size_t i, num = len / TS_PACKET_LEN;
+	uint64_t prev = 0;
+	int pcr_pid = -1;
+	int64_t t = 0;
+
+	for (i = 0; i < num; i++) {
+		const uint8_t *pkt = &map[i * TS_PACKET_LEN];
+		uint64_t pcr, delta;
+		int pid;
+
+		if (pkt[0] != TS_SYNC_BYTE || ts_getpcr(pkt, &pcr))
+			continue;
+
+		pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+		if (pcr_pid < 0)
+			pcr_pid = pid;
+		else if (pid != pcr_pid)
+			continue;
+
+		if (pcr_num) {
+			struct pcr_pt *last = &pcrs[pcr_num - 1];
+
+			delta = ts_pcr_ns(prev, pcr);
+			if (!delta || delta > PCR_MAX_GAP || (pkt[5] & 0x80)) {
+				if (pcr_num < 2)
+					return -1;
+
+				DEBUG("PCR discontinuity at TS packet %zu", i);
+				delta = (uint64_t)(last->ns - pcrs[0].ns) * (i - last->pkt) /
+					(last->pkt - pcrs[0].pkt);
+			}
+			t += (int64_t)delta;
+		}
+
+		if (pcr_add(i, t))
+			return -1;
+		prev = pcr;
+	}
+
+	if (pcr_num < 2)
+		return -1;
+
+	DEBUG("Found %zu PCRs on PID %d", pcr_num, pcr_pid);
+	return 0;
+}
+
+/* Time of TS packet, linear interpolation between PCRs around it */
+static int64_t pcr_time(size_t pkt)
+{
+	struct pcr_pt *a, *b;
+
+	if (pcr_cur && pkt < pcrs[pcr_cur].pkt)
+		pcr_cur = 0;
+	while (pcr_cur + 2 < pcr_num && pcrs[pcr_cur + 1].pkt <= pkt)
+		pcr_cur++;
+
+	a = &pcrs[pcr_cur];
+	b = &pcrs[pcr_cur + 1];
+
+	return a->ns + ((int64_t)pkt - (int64_t)a->pkt) * (b->ns - a->ns) /
+		(int64_t)(b->pkt - a->pkt);
+}
+
+static uint64_t stream_time(size_t off)
+{
+	if (rate)
+		return (uint64_t)((double)off * 8 * NSEC_PER_SEC / rate);
+
+	return (uint64_t)(pcr_time(off / TS_PACKET_LEN) - pcr_t0);
+}
+
+/*
+ * Map file and set up timing, either constant bitrate or, for MPEG-TS
+ * without a given bitrate, from the PCR.  MPEG-TS is always sent as
+ * 7 x 188 byte datagrams, other files are sliced in dgram sized bits.
+ */
+int stream_open(const char *file, uint64_t bitrate, size_t dgram)
+{
+	struct stat st;
+	void *ptr;
+	int fd, off;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		ERROR("Failed opening %s: %s", file, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) || st.st_size <= 0) {
+		ERROR("Cannot use %s, empty or not a regular file", file);
+		close(fd);
+		return -1;
+	}
+
+	ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		ERROR("Failed mapping %s: %s", file, strerror(errno));
+		return -1;
+	}
+#ifdef MADV_SEQUENTIAL
+	madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+	map_base = ptr;
+	map_len  = st.st_size;
+	map      = ptr;
+	len      = map_len;
+	rate     = bitrate;
+
+	off = ts_detect(map, map_len);
+	if (off >= 0) {
+		is_ts     = 1;
+		map      += off;
+		len       = (map_len - off) / TS_PACKET_LEN * TS_PACKET_LEN;
+		dgram_len = STREAM_TS_PACKETS * TS_PACKET_LEN;
+	} else
+		dgram_len = dgram;
+
+	if (!rate) {
+		if (!is_ts) {
+			ERROR("%s is not an MPEG-TS file, need --bitrate", file);
+			goto fail;
+		}
+		if (pcr_scan()) {
+			ERROR("%s has too few PCRs for timing, need --bitrate", file);
+			goto fail;
+		}
+		pcr_t0 = pcr_time(0);
+	}
+	duration = stream_time(len);
+
+	PRINT("Streaming %s, %s %zu bytes, %s, %.3f sec/loop", file,
+	      is_ts ? "MPEG-TS" : "raw", len, rate ? "constant bitrate" : "PCR timing",
+	      (double)duration / NSEC_PER_SEC);
+
+	return 0;
+fail:
+	stream_close();
+	return -1;
+}
+
+void stream_close(void)
+{
+	if (map_base)
+		munmap(map_base, map_len);
+	map_base = NULL;
+	map = NULL;
+
+	free(pcrs);
+	pcrs = NULL;
+	pcr_max = 0;
+	pcr_num = 0;
+}
+
+/*
+ * Next datagram, zero copy, and its send time in ns from the start.
+ * Wraps around at end of file.
+ */
+size_t stream_next(const uint8_t **buf, uint64_t *due)
+{
+	size_t num;
+
+	if (pos >= len) {
+		pos      = 0;
+		pcr_cur  = 0;
+		loop_ns += duration;
+	}
+
+	num = len - pos;
+	if (num > dgram_len)
+		num = dgram_len;
+
+	*buf = &map[pos];
+	*due = loop_ns + stream_time(pos);
+	pos += num;
+
+	return num;
+}
+
+/* Send time of the datagram after the one from stream_next() */
+uint64_t stream_peek(void)
+{
+	if (pos >= len)
+		return loop_ns + duration + stream_time(0);
+
+	return loop_ns + stream_time(pos);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
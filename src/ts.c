@@ -0,0 +1,250 @@
+/* MPEG-TS continuity counter and PCR analysis, basic TR 101 290 checks
+ *
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ts.h"
+
+struct ts *ts_alloc(void)
+{
+	return calloc(1, sizeof(struct ts));
+}
+
+/* Check sync byte of all packets, a branch-free OR in one pass */
+static int ts_sync(const uint8_t *buf, size_t num)
+{
+	uint8_t diff = 0;
+	size_t i;
+
+	for (i = 0; i < num; i++)
+		diff |= buf[i * TS_PACKET_LEN] ^ TS_SYNC_BYTE;
+
+	return diff == 0;
+}
+
+static uint64_t pcr_ns(uint64_t pcr)
+{
+	return pcr * 1000 / (TS_PCR_HZ / 1000000);
+}
+
+static uint64_t pcr_delta(uint64_t from, uint64_t to)
+{
+	return (to + TS_PCR_WRAP - from) % TS_PCR_WRAP;
+}
+
+/*
+ * Extract PCR from adaptation field of a TS packet, returns 0 if the
+ * packet carries a PCR, otherwise -1.
+ */
+int ts_getpcr(const uint8_t *pkt, uint64_t *pcr)
+{
+	const uint8_t *p = &pkt[6];
+	uint64_t base, ext;
+
+	if (!(pkt[3] & 0x20) || pkt[4] < 7 || !(pkt[5] & 0x10))
+		return -1;
+
+	base = ((uint64_t)p[0] << 25) | ((uint64_t)p[1] << 17) |
+	       ((uint64_t)p[2] << 9) | ((uint64_t)p[3] << 1) | (p[4] >> 7);
+	ext  = ((uint64_t)(p[4] & 0x01) << 8) | p[5];
+	*pcr = base * 300 + ext;
+
+	return 0;
+}
+
+/* Time between two PCR values, in nanoseconds, handles wrap-around */
+uint64_t ts_pcr_ns(uint64_t from, uint64_t to)
+{
+	return pcr_ns(pcr_delta(from, to));
+}
+
+static struct ts_pid *ts_pid(struct ts *ts, uint16_t pid)
+{
+	struct ts_pid *st;
+	uint8_t idx;
+
+	idx = ts->map[pid];
+	if (idx)
+		return &ts->pid[idx - 1];
+
+	if (ts->num >= TS_MAX_PIDS)
+		return NULL;
+
+	st = &ts->pid[ts->num++];
+	st->pid = pid;
+	ts->map[pid] = (uint8_t)ts->num;
+
+	return st;
+}
+
+static void ts_pcr(struct ts_pid *st, uint64_t pcr, uint64_t pos, uint64_t rx)
+{
+	if (st->pcr_count) {
+		uint64_t interval = rx - st->pcr_rx;
+		uint64_t elapsed = pcr_ns(pcr_delta(st->pcr, pcr));
+		uint64_t jitter;
+
+		/* Unsignalled discontinuity, e.g. looped file, restart */
+		if (elapsed > TS_PCR_DISC_NS) {
+			st->pcr_disc++;
+			st->pcr_count = 0;
+			goto done;
+		}
+
+		/* Network induced jitter, PCR vs. arrival time */
+		jitter = interval > elapsed ? interval - elapsed : elapsed - interval;
+		if (jitter > st->pcr_jit_max)
+			st->pcr_jit_max = jitter;
+		st->pcr_jit_sum += jitter;
+		st->pcr_jit_num++;
+
+		if (elapsed > st->pcr_int_max)
+			st->pcr_int_max = elapsed;
+		if (elapsed > TS_PCR_MAX_NS)
+			st->pcr_errors++;
+	}
+
+	/*
+	 * PCR accuracy, the previous PCR vs. its expected value from
+	 * a linear interpolation of the two PCRs around it, assuming a
+	 * constant bitrate between them.
+	 */
+	if (st->pcr_count > 1 && pos > st->prev_pos) {
+		uint64_t span = pcr_delta(st->prev_pcr, pcr);
+		uint64_t expect, error;
+
+		expect = (st->prev_pcr + span * (st->pcr_pos - st->prev_pos) /
+			  (pos - st->prev_pos)) % TS_PCR_WRAP;
+		error  = pcr_delta(expect, st->pcr);
+		if (error > TS_PCR_WRAP / 2)
+			error = TS_PCR_WRAP - error;
+		error  = pcr_ns(error);
+		if (error > st->pcr_ac_max)
+			st->pcr_ac_max = error;
+	}
+
+done:
+	st->prev_pcr = st->pcr;
+	st->prev_pos = st->pcr_pos;
+	st->pcr      = pcr;
+	st->pcr_pos  = pos;
+	st->pcr_rx   = rx;
+	st->pcr_count++;
+}
+
+/*
+ * Walk all 188 byte TS packets in a datagram, check continuity counter
+ * per PID, TR 101 290 1.4, and PCR interval/jitter/accuracy, 1.5/2.3.
+ * The arrival time, rx, is in nanoseconds.
+ *
+ * Returns number of continuity errors, or -1 if not a valid datagram.
+ */
+int ts_parse(struct ts *ts, const uint8_t *buf, size_t len, uint64_t rx)
+{
+	size_t i, num;
+	int errors = 0;
+
+	num = len / TS_PACKET_LEN;
+	if (!num || len % TS_PACKET_LEN || !ts_sync(buf, num)) {
+		ts->sync_errors++;
+		return -1;
+	}
+
+	if (!ts->first)
+		ts->first = rx;
+	ts->last = rx;
+
+	for (i = 0; i < num; i++, buf += TS_PACKET_LEN) {
+		uint16_t pid = ((buf[1] & 0x1f) << 8) | buf[2];
+		uint8_t afc = (buf[3] >> 4) & 0x3;
+		uint8_t cc = buf[3] & 0x0f;
+		uint8_t disc = 0;
+		struct ts_pid *st;
+
+		ts->packets++;
+		st = ts_pid(ts, pid);
+		if (!st) {
+			ts->untracked++;
+			continue;
+		}
+
+		/* Adaptation field: discontinuity indicator and PCR */
+		if ((afc & 0x2) && buf[4] > 0) {
+			uint64_t pcr;
+
+			disc = buf[5] & 0x80;
+			if (disc)
+				st->pcr_count = 0;
+
+			if (!ts_getpcr(buf, &pcr))
+				ts_pcr(st, pcr, ts->packets, rx);
+		}
+
+		if (st->packets++ == 0 || disc || pid == TS_NULL_PID) {
+			st->cc  = cc;
+			st->dup = 0;
+			continue;
+		}
+
+		if (!(afc & 0x1)) {
+			/* No payload, counter shall not increment */
+			if (cc != st->cc)
+				goto error;
+			continue;
+		}
+
+		if (cc == st->cc) {
+			/* One duplicate packet is allowed */
+			if (st->dup++)
+				goto error;
+			continue;
+		}
+
+		st->dup = 0;
+		if (cc != ((st->cc + 1) & 0x0f))
+			goto error;
+		st->cc = cc;
+		continue;
+	error:
+		st->cc  = cc;
+		st->dup = 0;
+		st->cc_errors++;
+		ts->cc_errors++;
+		errors++;
+	}
+
+	return errors;
+}
+
+/* Average bitrate, in bits/s, of the given number of TS packets */
+double ts_bitrate(struct ts *ts, size_t packets)
+{
+	uint64_t elapsed = ts->last - ts->first;
+
+	if (!elapsed)
+		return 0.0;
+
+	return (double)packets * TS_PACKET_LEN * 8 * 1000000000.0 / elapsed;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
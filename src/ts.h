@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MCJOIN_TS_H_
+#define MCJOIN_TS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TS_PACKET_LEN     188
+#define TS_SYNC_BYTE      0x47
+#define TS_NULL_PID       0x1fff
+#define TS_NUM_PID        8192
+#define TS_MAX_PIDS       64		/* Tracked PIDs per group */
+#define TS_PCR_HZ         27000000
+#define TS_PCR_MAX_NS     40000000	/* TR 101 290, PCR_repetition_error */
+#define TS_PCR_DISC_NS    100000000	/* TR 101 290, PCR_discontinuity_indicator_error */
+#define TS_PCR_WRAP       ((1ULL << 33) * 300)
+
+/* Per-PID state */
+struct ts_pid {
+	uint16_t  pid;
+	uint8_t   cc;		/* Last continuity counter */
+	uint8_t   dup;		/* Seen duplicate of last packet */
+	size_t    packets;
+	size_t    cc_errors;
+
+	/* PCR state, only for PIDs carrying PCR */
+	size_t    pcr_count;
+	size_t    pcr_errors;	/* Interval > TS_PCR_MAX_NS */
+	size_t    pcr_disc;	/* Jump > TS_PCR_DISC_NS, or backwards */
+	uint64_t  pcr;		/* Last PCR value, 27 MHz */
+	uint64_t  pcr_rx;	/* Arrival of last PCR, ns */
+	uint64_t  pcr_pos;	/* TS packet number of last PCR */
+	uint64_t  pcr_int_max;	/* Max PCR interval, ns */
+	uint64_t  pcr_jit_max;	/* Max PCR vs. arrival jitter, ns */
+	uint64_t  pcr_jit_sum;	/* For average PCR jitter, ns */
+	size_t    pcr_jit_num;
+	uint64_t  pcr_ac_max;	/* Max PCR accuracy error, ns */
+	uint64_t  prev_pcr;	/* Second to last PCR, for accuracy */
+	uint64_t  prev_pos;
+};
+
+/* Per-group state, allocated on demand */
+struct ts {
+	uint8_t        map[TS_NUM_PID];	/* PID -> index + 1 */
+	struct ts_pid  pid[TS_MAX_PIDS];
+	size_t         num;		/* Number of PIDs in pid[] */
+
+	size_t         packets;		/* Total TS packets */
+	size_t         sync_errors;	/* Bad datagrams, len or sync byte */
+	size_t         cc_errors;	/* Sum of all PIDs */
+	size_t         untracked;	/* Packets on PIDs beyond TS_MAX_PIDS */
+
+	uint64_t       first;		/* Arrival of first/last datagram, ns */
+	uint64_t       last;
+};
+
+struct ts *ts_alloc   (void);
+int        ts_getpcr  (const uint8_t *pkt, uint64_t *pcr);
+uint64_t   ts_pcr_ns  (uint64_t from, uint64_t to);
+
+int        ts_parse   (struct ts *ts, const uint8_t *buf, size_t len, uint64_t rx);
+double     ts_bitrate (struct ts *ts, size_t packets);
+
+#endif /* MCJOIN_TS_H_ */
@@ -0,0 +1,550 @@
+/* Launch time scheduled transmission, SO_TXTIME, and TX timestamps
+ *
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+#include "mcjoin.h"
+#include "rtt.h"
+#include "txtime.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
+#ifdef HAVE_LINUX_NET_TSTAMP_H
+#include <linux/net_tstamp.h>
+#endif
+#include <linux/sockios.h>		/* SIOCSHWTSTAMP */
+
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(HAVE_LINUX_NET_TSTAMP_H) && defined(SO_TIMESTAMPING)
+#define HAVE_TX_TIMESTAMPS 1
+#endif
+
+/* Packet in flight, times in ns since start, CLOCK_MONOTONIC */
+struct txpkt {
+	uint32_t  id;
+	uint32_t  gid;		/* Index in groups[] */
+	uint64_t  due;		/* Scheduled departure */
+	uint64_t  sys;		/* Send syscall */
+	uint64_t  sched;	/* TX_SCHED stamp, entering qdisc, CLOCK_REALTIME */
+};
+
+/*
+ * Packets in flight on a socket, by the id the kernel gives their TX
+ * timestamps, SOF_TIMESTAMPING_OPT_ID.
+ */
+struct txsock {
+	uint32_t      next;	/* Id of next packet sent */
+	struct txpkt  pkt[TXTIME_RING];
+};
+
+/* Host transmit latency of a group, with --tx-stamps */
+struct txlat {
+	struct hist   sched;	/* Schedule to syscall */
+	struct hist   wire;	/* Syscall to driver, or NIC */
+	uint64_t      qdisc;	/* Sum of time in qdisc */
+	size_t        nqdisc;
+	size_t        hw;	/* Stamps from NIC */
+};
+
+#define TXTIME_SOCKS (MAX_NUM_GROUPS + 16)
+static struct txsock *socks[TXTIME_SOCKS];
+
+static struct txlat  *lat;
+static int           hwstamps;
+
+/* Start of schedule, on CLOCK_MONOTONIC, CLOCK_REALTIME of the stamps, and the launch clock */
+static uint64_t mono_origin;
+static uint64_t real_origin;
+static uint64_t tx_origin;
+
+/* SCM_TXTIME control message of each message in a send batch */
+static union {
+	char            buf[CMSG_SPACE(sizeof(uint64_t))];
+	struct cmsghdr  align;
+} ctrl[SEND_BATCH];
+
+/* Launch error, stamp vs. deadline */
+static struct {
+	size_t    stamps;
+	int64_t   min;
+	int64_t   max;
+	double    sum;
+	double    sumsq;
+	size_t    hist[TXTIME_BUCKETS];	/* |err| < 1us, 10us, 100us, 1ms, above */
+	size_t    unmatched;		/* Stamps without a packet in flight */
+	size_t    missed;		/* Dropped by qdisc, deadline passed */
+	size_t    invalid;		/* Dropped by qdisc, bad launch time */
+} acc;
+
+static uint64_t ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static clockid_t tx_clock(void)
+{
+#ifdef CLOCK_TAI
+	if (txtime == TXTIME_ETF)
+		return CLOCK_TAI;
+#endif
+	return CLOCK_MONOTONIC;
+}
+
+static const char *name(void)
+{
+	switch (txtime) {
+	case TXTIME_ETF:
+		return "etf";
+	case TXTIME_FQ:
+		return "fq";
+	default:
+		break;
+	}
+
+	return "userspace";
+}
+
+/* etf (default), fq, or user */
+int txtime_parse(const char *arg)
+{
+	if (!arg || !strcmp(arg, "etf"))
+		return TXTIME_ETF;
+	if (!strcmp(arg, "fq"))
+		return TXTIME_FQ;
+	if (!strcmp(arg, "user"))
+		return TXTIME_USER;
+
+	return -1;
+}
+
+/* Sockets need TX timestamps, for --txtime or --tx-stamps */
+int txtime_active(void)
+{
+	return txtime || tx_stamps;
+}
+
+/* How far ahead of its launch time a packet may be sent */
+uint64_t txtime_ahead(void)
+{
+	if (txtime == TXTIME_ETF || txtime == TXTIME_FQ)
+		return TXTIME_AHEAD;
+
+	return 0;
+}
+
+#ifdef HAVE_TX_TIMESTAMPS
+/*
+ * Turn on TX stamps in the NIC of IFACE, keeping its RX filter.  Needs
+ * CAP_NET_ADMIN and a driver with hardware timestamping, otherwise we
+ * use the software stamps taken by the driver.
+ */
+static int hw_init(int sd)
+{
+#if defined(SIOCSHWTSTAMP) && defined(SIOCGHWTSTAMP)
+	struct hwtstamp_config cfg = { 0 };
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, iface, sizeof(ifr.ifr_name));
+	ifr.ifr_data = (void *)&cfg;
+	if (ioctl(sd, SIOCGHWTSTAMP, &ifr))
+		cfg.rx_filter = HWTSTAMP_FILTER_NONE;
+
+	cfg.tx_type = HWTSTAMP_TX_ON;
+	if (ioctl(sd, SIOCSHWTSTAMP, &ifr)) {
+		DEBUG("No hardware TX timestamps on %s: %s", iface, strerror(errno));
+		return 0;
+	}
+
+	PRINT("Hardware TX timestamps enabled on %s", iface);
+	return 1;
+#else
+	(void)sd;
+	return 0;
+#endif
+}
+#endif
+
+/*
+ * Launch time on the socket, except for userspace pacing, and TX
+ * timestamps, entering the qdisc and leaving the driver, and from the
+ * NIC where available.  The stamps are only ids and times, the packet
+ * is not looped back.
+ */
+int txtime_socket(int sd)
+{
+#ifdef HAVE_TX_TIMESTAMPS
+	static int once = 0;
+	int val = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+		  SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+
+	if (sd < 0 || sd >= TXTIME_SOCKS || socks[sd])
+		return 0;
+
+	if (tx_stamps) {
+		if (!once) {
+			once = 1;
+			hwstamps = hw_init(sd);
+			lat = calloc(group_num, sizeof(struct txlat));
+			if (!lat) {
+				ERROR("Failed allocating TX latency: %s", strerror(errno));
+				return -1;
+			}
+		}
+
+		val |= SOF_TIMESTAMPING_TX_SCHED;
+		if (hwstamps)
+			val |= SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+#ifdef SOF_TIMESTAMPING_OPT_TX_SWHW
+		if (hwstamps)
+			val |= SOF_TIMESTAMPING_OPT_TX_SWHW;
+#endif
+	}
+
+#ifdef SO_TXTIME
+	if (txtime_ahead()) {
+		struct sock_txtime cfg = {
+			.clockid = tx_clock(),
+			.flags   = SOF_TXTIME_REPORT_ERRORS,
+		};
+
+		if (setsockopt(sd, SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg))) {
+			ERROR("Failed enabling SO_TXTIME: %s", strerror(errno));
+			return -1;
+		}
+	}
+#else
+	if (txtime_ahead()) {
+		ERROR("Launch time, SO_TXTIME, not supported on this system.");
+		return -1;
+	}
+#endif
+
+	if (setsockopt(sd, SOL_SOCKET, SO_TIMESTAMPING, &val, sizeof(val)))
+		DEBUG("Failed enabling TX timestamps: %s", strerror(errno));
+
+	socks[sd] = calloc(1, sizeof(struct txsock));
+	if (!socks[sd]) {
+		ERROR("Failed allocating TX timestamp ring: %s", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+#else
+	(void)sd;
+	ERROR("Launch time and TX timestamps not supported on this system.");
+	return -1;
+#endif
+}
+
+/* Schedule starts at start, on CLOCK_MONOTONIC, as used by the sender */
+void txtime_start(struct timespec *start)
+{
+	uint64_t mono = ns(CLOCK_MONOTONIC);
+	uint64_t since;
+
+	since = mono - ((uint64_t)start->tv_sec * NSEC_PER_SEC + start->tv_nsec);
+	mono_origin = mono - since;
+	real_origin = ns(CLOCK_REALTIME) - since;
+	tx_origin   = ns(tx_clock()) - since;
+	acc.min     = INT64_MAX;
+	acc.max     = INT64_MIN;
+}
+
+/* Now, in ns since start of schedule, for the send syscall */
+uint64_t txtime_now(void)
+{
+	return ns(CLOCK_MONOTONIC) - mono_origin;
+}
+
+/* Launch time, due ns since start, on message in slot of a send batch */
+void txtime_msg(struct msghdr *msg, size_t slot, uint64_t due)
+{
+#ifdef SO_TXTIME
+	struct cmsghdr *cmsg;
+	uint64_t when;
+
+	if (!txtime_ahead() || slot >= SEND_BATCH)
+		return;
+
+	msg->msg_control    = ctrl[slot].buf;
+	msg->msg_controllen = sizeof(ctrl[slot].buf);
+
+	when = tx_origin + due;
+	cmsg = CMSG_FIRSTHDR(msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type  = SCM_TXTIME;
+	cmsg->cmsg_len   = CMSG_LEN(sizeof(when));
+	memcpy(CMSG_DATA(cmsg), &when, sizeof(when));
+#else
+	(void)msg;
+	(void)slot;
+	(void)due;
+#endif
+}
+
+/* First num packets of a batch sent on sd at sys, to gv, each due at due */
+void txtime_sent(int sd, struct gr **gv, uint64_t *due, uint64_t sys, size_t num)
+{
+	struct txsock *s;
+	size_t i;
+
+	if (sd < 0 || sd >= TXTIME_SOCKS || !socks[sd])
+		return;
+
+	s = socks[sd];
+	for (i = 0; i < num; i++) {
+		struct txpkt *p = &s->pkt[s->next & (TXTIME_RING - 1)];
+
+		p->id    = s->next++;
+		p->gid   = (uint32_t)(gv[i] - groups);
+		p->due   = due[i];
+		p->sys   = sys;
+		p->sched = 0;
+	}
+}
+
+static void account(int64_t err)
+{
+	uint64_t mag = err < 0 ? -err : err;
+	uint64_t limit = 1000;
+	size_t i;
+
+	acc.stamps++;
+	acc.sum   += err;
+	acc.sumsq += (double)err * err;
+	if (err < acc.min)
+		acc.min = err;
+	if (err > acc.max)
+		acc.max = err;
+
+	for (i = 0; i < TXTIME_BUCKETS - 1; i++, limit *= 10) {
+		if (mag < limit)
+			break;
+	}
+	acc.hist[i]++;
+}
+
+#ifdef HAVE_TX_TIMESTAMPS
+/* One message from the error queue: a TX timestamp, or a qdisc drop */
+static void errmsg(struct txsock *s, struct msghdr *msg)
+{
+	struct sock_extended_err *ee = NULL;
+	struct scm_timestamping *tss = NULL;
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
+			tss = (struct scm_timestamping *)CMSG_DATA(cmsg);
+		else if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+			 (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+			ee = (struct sock_extended_err *)CMSG_DATA(cmsg);
+	}
+
+	if (!ee)
+		return;
+
+#ifdef SO_EE_ORIGIN_TXTIME
+	if (ee->ee_origin == SO_EE_ORIGIN_TXTIME) {
+		if (ee->ee_code == SO_EE_CODE_TXTIME_MISSED)
+			acc.missed++;
+		else
+			acc.invalid++;
+		return;
+	}
+#endif
+
+	if (ee->ee_origin == SO_EE_ORIGIN_TIMESTAMPING && tss) {
+		struct txpkt *p = &s->pkt[ee->ee_data & (TXTIME_RING - 1)];
+		uint64_t stamp;
+		int hw = 0;
+
+		if (p->id != ee->ee_data) {
+			acc.unmatched++;
+			return;
+		}
+
+		stamp = (uint64_t)tss->ts[0].tv_sec * NSEC_PER_SEC + tss->ts[0].tv_nsec;
+		if (ee->ee_info == SCM_TSTAMP_SCHED) {
+			p->sched = stamp;
+			return;
+		}
+		if (tss->ts[2].tv_sec || tss->ts[2].tv_nsec) {
+			stamp = (uint64_t)tss->ts[2].tv_sec * NSEC_PER_SEC + tss->ts[2].tv_nsec;
+			hw = 1;
+		}
+
+		if (txtime)
+			account((int64_t)(stamp - (real_origin + p->due)));
+		if (lat && p->gid < group_num) {
+			struct txlat *l = &lat[p->gid];
+
+			hist_add(&l->sched, p->sys > p->due ? p->sys - p->due : 0);
+			hist_add(&l->wire, stamp > real_origin + p->sys ? stamp - (real_origin + p->sys) : 0);
+			if (p->sched && !hw) {
+				l->qdisc += stamp - p->sched;
+				l->nqdisc++;
+			}
+			l->hw += hw;
+		}
+		p->id++;		/* Consumed, never matches again */
+	}
+}
+#endif
+
+/* Read all TX timestamps and qdisc drop reports queued on sd */
+void txtime_poll(int sd)
+{
+#ifdef HAVE_TX_TIMESTAMPS
+	struct mmsghdr msgv[RECV_BATCH];
+	char cbuf[RECV_BATCH][256];
+	struct txsock *s;
+	int i, num;
+
+	if (sd < 0 || sd >= TXTIME_SOCKS || !socks[sd])
+		return;
+	s = socks[sd];
+
+	do {
+		memset(msgv, 0, sizeof(msgv));
+		for (i = 0; i < RECV_BATCH; i++) {
+			msgv[i].msg_hdr.msg_control    = cbuf[i];
+			msgv[i].msg_hdr.msg_controllen = sizeof(cbuf[i]);
+		}
+
+#ifdef HAVE_RECVMMSG
+		num = recvmmsg(sd, msgv, RECV_BATCH, MSG_ERRQUEUE | MSG_DONTWAIT, NULL);
+#else
+		for (num = 0; num < RECV_BATCH; num++) {
+			if (recvmsg(sd, &msgv[num].msg_hdr, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+				break;
+		}
+		if (!num)
+			num = -1;
+#endif
+		for (i = 0; i < num; i++)
+			errmsg(s, &msgv[i].msg_hdr);
+	} while (num == RECV_BATCH);
+#else
+	(void)sd;
+#endif
+}
+
+/* Socket about to be closed, read what is left and forget it */
+void txtime_close(int sd)
+{
+	if (sd < 0 || sd >= TXTIME_SOCKS || !socks[sd])
+		return;
+
+	txtime_poll(sd);
+	free(socks[sd]);
+	socks[sd] = NULL;
+}
+
+/* Read TX timestamps queued on all sockets */
+void txtime_drain(void)
+{
+	int sd;
+
+	for (sd = 0; sd < TXTIME_SOCKS; sd++)
+		txtime_poll(sd);
+}
+
+/* Per group, time from schedule to send syscall, and on to the wire */
+static void lat_stats(void)
+{
+	size_t i;
+
+	if (!lat)
+		return;
+
+	PRINT("\nHost transmit latency per group:");
+	for (i = 0; i < group_num; i++) {
+		struct txlat *l = &lat[i];
+		char name[80];
+
+		snprintf(name, sizeof(name), "Group %s", groups[i].group);
+		if (!l->wire.num) {
+			PRINT("%s: no TX timestamps of %zu sent", name, groups[i].count);
+			continue;
+		}
+
+		hist_show(&l->sched, "schedule to syscall", name);
+		hist_show(&l->wire, l->hw ? "syscall to wire, NIC" : "syscall to wire, driver", name);
+		if (l->nqdisc)
+			PRINT("  in qdisc avg %.3f ms", (double)l->qdisc / l->nqdisc / 1000000.0);
+	}
+}
+
+/* Collect stamps of the packets still in flight, then show accuracy */
+void txtime_stats(void)
+{
+	const char *bucket[] = { "<1us", "<10us", "<100us", "<1ms", ">=1ms" };
+	struct timespec ts = { 0, 0 };
+	char hist[128] = "";
+	size_t i, len = 0;
+	double mean, sd;
+
+	if (!txtime_active())
+		return;
+
+	ts.tv_nsec = txtime_ahead() + 10000000;
+	nanosleep(&ts, NULL);
+	txtime_drain();
+
+	lat_stats();
+	if (!txtime)
+		return;
+
+	if (!acc.stamps) {
+		PRINT("Launch accuracy, %s: no TX timestamps, %zu missed and %zu invalid launch times",
+		      name(), acc.missed, acc.invalid);
+		return;
+	}
+
+	for (i = 0; i < NELEMS(acc.hist) && len < sizeof(hist); i++)
+		len += snprintf(&hist[len], sizeof(hist) - len, "%s%s %zu",
+				i ? ", " : "", bucket[i], acc.hist[i]);
+
+	mean = acc.sum / acc.stamps;
+	sd   = sqrt(fabs(acc.sumsq / acc.stamps - mean * mean));
+	PRINT("Launch accuracy, %s: %zu packets, mean %+.1f us, stddev %.1f us, min %+.1f us, max %+.1f us",
+	      name(), acc.stamps, mean / 1000.0, sd / 1000.0, acc.min / 1000.0, acc.max / 1000.0);
+	PRINT("Launch error %s; missed %zu, invalid %zu, unmatched %zu",
+	      hist, acc.missed, acc.invalid, acc.unmatched);
+	if (txtime_ahead() && mean < -(double)txtime_ahead() / 2)
+		PRINT("Packets left before their launch time, is the %s qdisc set up on %s?",
+		      name(), iface);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
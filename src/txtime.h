@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MCJOIN_TXTIME_H_
+#define MCJOIN_TXTIME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "mcjoin.h"
+
+#define TXTIME_AHEAD   2000000	/* ns, packets handed to the kernel ahead of launch */
+#define TXTIME_RING    1024	/* Packets in flight kept per socket, power of 2 */
+#define TXTIME_BUCKETS 5
+
+/* How the sender paces with --txtime */
+enum {
+	TXTIME_OFF = 0,
+	TXTIME_USER,		/* Userspace sleeps, for comparison */
+	TXTIME_ETF,		/* SO_TXTIME on CLOCK_TAI, etf qdisc */
+	TXTIME_FQ,		/* SO_TXTIME on CLOCK_MONOTONIC, fq qdisc */
+};
+
+int      txtime_parse  (const char *arg);
+int      txtime_active (void);
+uint64_t txtime_ahead  (void);
+
+int      txtime_socket (int sd);
+void     txtime_start  (struct timespec *start);
+uint64_t txtime_now    (void);
+
+void     txtime_msg    (struct msghdr *msg, size_t slot, uint64_t due);
+void     txtime_sent   (int sd, struct gr **gv, uint64_t *due, uint64_t sys, size_t num);
+void     txtime_poll   (int sd);
+void     txtime_close  (int sd);
+void     txtime_drain  (void);
+
+void     txtime_stats  (void);
+
+#endif /* MCJOIN_TXTIME_H_ */
@@ -0,0 +1,561 @@
+/* In-kernel per-group counting with XDP, --xdp
+ *
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+#include "mcjoin.h"
+#include "xdp.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+
+#ifdef HAVE_LINUX_BPF_H
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <sys/syscall.h>
+
+/*
+ * The program is assembled here, no compiler for the BPF target or
+ * library is needed.  Jumps are to labels, resolved when done.
+ */
+#define XDP_INSNS   96
+#define XDP_FIXUPS  32
+
+enum { L_IP4 = 0, L_IP6, L_UDP, L_SEQ, L_DROP, L_PASS, L_LABELS };
+
+struct xdp_asm {
+	struct bpf_insn insn[XDP_INSNS];
+	int             pc;
+	int             label[L_LABELS];
+	struct {
+		int     pc;
+		int     label;
+	}               fixup[XDP_FIXUPS];
+	int             num;
+};
+
+#define INSN(c, d, s, o, i) \
+	((struct bpf_insn){ .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) })
+
+#define MOV_REG(d, s)       INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define MOV_IMM(d, i)       INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define ALU_IMM(op, d, i)   INSN(BPF_ALU64 | (op) | BPF_K, d, 0, 0, i)
+#define ALU_REG(op, d, s)   INSN(BPF_ALU64 | (op) | BPF_X, d, s, 0, 0)
+#define BE16(d)             INSN(BPF_ALU | BPF_END | BPF_TO_BE, d, 0, 0, 16)
+#define LDX(sz, d, s, o)    INSN(BPF_LDX | (sz) | BPF_MEM, d, s, o, 0)
+#define STX(sz, d, s, o)    INSN(BPF_STX | (sz) | BPF_MEM, d, s, o, 0)
+#define ST(sz, d, o, i)     INSN(BPF_ST | (sz) | BPF_MEM, d, 0, o, i)
+#define CALL(fn)            INSN(BPF_JMP | BPF_CALL, 0, 0, 0, fn)
+#define EXIT()              INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+/* Per group and CPU, summed by xdp_read() */
+struct xdp_cnt {
+	uint64_t count;
+	uint64_t bytes;
+	uint64_t gaps;
+};
+
+static int map_grp = -1;		/* Group address -> index */
+static int map_cnt = -1;		/* Index -> per-CPU counters */
+static int map_seq = -1;		/* Index -> next RTP seq, bit 16 valid */
+static int map_xsk = -1;		/* Queue -> AF_XDP socket */
+static int prog_fd = -1;
+static int link_fd = -1;
+static int ncpus;
+
+static long sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static void emit(struct xdp_asm *a, struct bpf_insn insn)
+{
+	if (a->pc < XDP_INSNS)
+		a->insn[a->pc] = insn;
+	a->pc++;
+}
+
+static void label(struct xdp_asm *a, int id)
+{
+	a->label[id] = a->pc;
+}
+
+/* Conditional jump on immediate, or with op BPF_JA always */
+static void jump(struct xdp_asm *a, int op, int reg, int32_t imm, int id)
+{
+	if (a->num < XDP_FIXUPS) {
+		a->fixup[a->num].pc    = a->pc;
+		a->fixup[a->num].label = id;
+	}
+	a->num++;
+	emit(a, INSN(BPF_JMP | op | BPF_K, reg, 0, 0, imm));
+}
+
+/* Jump to label when reg (packet pointer) + len is beyond data_end (r8) */
+static void bounds(struct xdp_asm *a, int reg, int len, int id)
+{
+	emit(a, MOV_REG(BPF_REG_2, reg));
+	emit(a, ALU_IMM(BPF_ADD, BPF_REG_2, len));
+	if (a->num < XDP_FIXUPS) {
+		a->fixup[a->num].pc    = a->pc;
+		a->fixup[a->num].label = id;
+	}
+	a->num++;
+	emit(a, INSN(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_2, BPF_REG_8, 0, 0));
+}
+
+static void map_fd(struct xdp_asm *a, int reg, int fd)
+{
+	emit(a, INSN(BPF_LD | BPF_DW | BPF_IMM, reg, BPF_PSEUDO_MAP_FD, 0, fd));
+	emit(a, INSN(0, 0, 0, 0, 0));
+}
+
+static int resolve(struct xdp_asm *a)
+{
+	int i;
+
+	if (a->pc > XDP_INSNS || a->num > XDP_FIXUPS)
+		return -1;
+
+	for (i = 0; i < a->num; i++)
+		a->insn[a->fixup[i].pc].off = a->label[a->fixup[i].label] - a->fixup[i].pc - 1;
+
+	return 0;
+}
+
+/*
+ * Count the packet per CPU and drop it, group index at fp-20 and r7 is
+ * the UDP header.  With --rtp, sequence gaps are counted too.
+ */
+static void counter(struct xdp_asm *a)
+{
+	map_fd(a, BPF_REG_1, map_cnt);
+	emit(a, MOV_REG(BPF_REG_2, BPF_REG_10));
+	emit(a, ALU_IMM(BPF_ADD, BPF_REG_2, -20));
+	emit(a, CALL(BPF_FUNC_map_lookup_elem));
+	jump(a, BPF_JEQ, BPF_REG_0, 0, L_PASS);
+	emit(a, MOV_REG(BPF_REG_9, BPF_REG_0));
+
+	emit(a, LDX(BPF_DW, BPF_REG_3, BPF_REG_9, offsetof(struct xdp_cnt, count)));
+	emit(a, ALU_IMM(BPF_ADD, BPF_REG_3, 1));
+	emit(a, STX(BPF_DW, BPF_REG_9, BPF_REG_3, offsetof(struct xdp_cnt, count)));
+	emit(a, LDX(BPF_H, BPF_REG_3, BPF_REG_7, 4));
+	emit(a, BE16(BPF_REG_3));
+	emit(a, ALU_IMM(BPF_SUB, BPF_REG_3, 8));
+	emit(a, LDX(BPF_DW, BPF_REG_4, BPF_REG_9, offsetof(struct xdp_cnt, bytes)));
+	emit(a, ALU_REG(BPF_ADD, BPF_REG_4, BPF_REG_3));
+	emit(a, STX(BPF_DW, BPF_REG_9, BPF_REG_4, offsetof(struct xdp_cnt, bytes)));
+
+	/* Text payloads are only counted, RTP has a binary sequence number */
+	if (rtp) {
+		bounds(a, BPF_REG_7, 8 + RTP_HDR_LEN, L_DROP);
+		map_fd(a, BPF_REG_1, map_seq);
+		emit(a, MOV_REG(BPF_REG_2, BPF_REG_10));
+		emit(a, ALU_IMM(BPF_ADD, BPF_REG_2, -20));
+		emit(a, CALL(BPF_FUNC_map_lookup_elem));
+		jump(a, BPF_JEQ, BPF_REG_0, 0, L_DROP);
+
+		emit(a, LDX(BPF_B, BPF_REG_3, BPF_REG_7, 8 + 2));
+		emit(a, ALU_IMM(BPF_LSH, BPF_REG_3, 8));
+		emit(a, LDX(BPF_B, BPF_REG_4, BPF_REG_7, 8 + 3));
+		emit(a, ALU_REG(BPF_OR, BPF_REG_3, BPF_REG_4));
+		emit(a, LDX(BPF_DW, BPF_REG_4, BPF_REG_0, 0));
+		emit(a, MOV_REG(BPF_REG_5, BPF_REG_4));
+		emit(a, ALU_IMM(BPF_AND, BPF_REG_5, 0x10000));
+		jump(a, BPF_JEQ, BPF_REG_5, 0, L_SEQ);
+		emit(a, ALU_IMM(BPF_AND, BPF_REG_4, 0xffff));
+		emit(a, INSN(BPF_JMP | BPF_JEQ | BPF_X, BPF_REG_4, BPF_REG_3, 3, 0));
+		emit(a, LDX(BPF_DW, BPF_REG_5, BPF_REG_9, offsetof(struct xdp_cnt, gaps)));
+		emit(a, ALU_IMM(BPF_ADD, BPF_REG_5, 1));
+		emit(a, STX(BPF_DW, BPF_REG_9, BPF_REG_5, offsetof(struct xdp_cnt, gaps)));
+		label(a, L_SEQ);
+		emit(a, ALU_IMM(BPF_ADD, BPF_REG_3, 1));
+		emit(a, ALU_IMM(BPF_AND, BPF_REG_3, 0xffff));
+		emit(a, ALU_IMM(BPF_OR, BPF_REG_3, 0x10000));
+		emit(a, STX(BPF_DW, BPF_REG_0, BPF_REG_3, 0));
+	}
+
+	label(a, L_DROP);
+	emit(a, MOV_IMM(BPF_REG_0, XDP_DROP));
+	emit(a, EXIT());
+}
+
+/* To the AF_XDP socket of the receive queue, or passed on if none */
+static void redirect(struct xdp_asm *a)
+{
+	map_fd(a, BPF_REG_1, map_xsk);
+	emit(a, LDX(BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index)));
+	emit(a, MOV_IMM(BPF_REG_3, XDP_PASS));
+	emit(a, CALL(BPF_FUNC_redirect_map));
+	emit(a, EXIT());
+}
+
+/*
+ * UDP to our port and one of our groups is counted per CPU and dropped,
+ * or with --af-xdp redirected, everything else is passed on.  Registers:
+ * r6 ctx, r7 packet, r8 end of packet, r9 counters.  The group address
+ * is the map key, at fp-16, with IPv4 in the first four bytes, and the
+ * group index is at fp-20.
+ */
+static void assemble(struct xdp_asm *a)
+{
+	memset(a, 0, sizeof(*a));
+
+	emit(a, MOV_REG(BPF_REG_6, BPF_REG_1));
+	emit(a, LDX(BPF_W, BPF_REG_7, BPF_REG_6, offsetof(struct xdp_md, data)));
+	emit(a, LDX(BPF_W, BPF_REG_8, BPF_REG_6, offsetof(struct xdp_md, data_end)));
+	emit(a, ST(BPF_DW, BPF_REG_10, -16, 0));
+	emit(a, ST(BPF_DW, BPF_REG_10, -8, 0));
+
+	bounds(a, BPF_REG_7, ETH_HLEN, L_PASS);
+	emit(a, LDX(BPF_H, BPF_REG_3, BPF_REG_7, 12));
+	jump(a, BPF_JEQ, BPF_REG_3, htons(ETH_P_IP), L_IP4);
+	jump(a, BPF_JEQ, BPF_REG_3, htons(ETH_P_IPV6), L_IP6);
+	jump(a, BPF_JA, 0, 0, L_PASS);
+
+	/* IPv4 without options */
+	label(a, L_IP4);
+	bounds(a, BPF_REG_7, ETH_HLEN + 20 + 8, L_PASS);
+	emit(a, LDX(BPF_B, BPF_REG_3, BPF_REG_7, ETH_HLEN));
+	jump(a, BPF_JNE, BPF_REG_3, 0x45, L_PASS);
+	emit(a, LDX(BPF_B, BPF_REG_3, BPF_REG_7, ETH_HLEN + 9));
+	jump(a, BPF_JNE, BPF_REG_3, IPPROTO_UDP, L_PASS);
+	emit(a, LDX(BPF_W, BPF_REG_3, BPF_REG_7, ETH_HLEN + 16));
+	emit(a, STX(BPF_W, BPF_REG_10, BPF_REG_3, -16));
+	emit(a, ALU_IMM(BPF_ADD, BPF_REG_7, ETH_HLEN + 20));
+	jump(a, BPF_JA, 0, 0, L_UDP);
+
+	/* IPv6 without extension headers */
+	label(a, L_IP6);
+	bounds(a, BPF_REG_7, ETH_HLEN + 40 + 8, L_PASS);
+	emit(a, LDX(BPF_B, BPF_REG_3, BPF_REG_7, ETH_HLEN + 6));
+	jump(a, BPF_JNE, BPF_REG_3, IPPROTO_UDP, L_PASS);
+	emit(a, LDX(BPF_DW, BPF_REG_3, BPF_REG_7, ETH_HLEN + 24));
+	emit(a, STX(BPF_DW, BPF_REG_10, BPF_REG_3, -16));
+	emit(a, LDX(BPF_DW, BPF_REG_3, BPF_REG_7, ETH_HLEN + 32));
+	emit(a, STX(BPF_DW, BPF_REG_10, BPF_REG_3, -8));
+	emit(a, ALU_IMM(BPF_ADD, BPF_REG_7, ETH_HLEN + 40));
+
+	/* r7 is the UDP header, 8 bytes checked */
+	label(a, L_UDP);
+	emit(a, LDX(BPF_H, BPF_REG_3, BPF_REG_7, 2));
+	jump(a, BPF_JNE, BPF_REG_3, htons(port), L_PASS);
+
+	map_fd(a, BPF_REG_1, map_grp);
+	emit(a, MOV_REG(BPF_REG_2, BPF_REG_10));
+	emit(a, ALU_IMM(BPF_ADD, BPF_REG_2, -16));
+	emit(a, CALL(BPF_FUNC_map_lookup_elem));
+	jump(a, BPF_JEQ, BPF_REG_0, 0, L_PASS);
+	emit(a, LDX(BPF_W, BPF_REG_3, BPF_REG_0, 0));
+	emit(a, STX(BPF_W, BPF_REG_10, BPF_REG_3, -20));
+
+	if (map_xsk >= 0)
+		redirect(a);
+	else
+		counter(a);
+
+	label(a, L_PASS);
+	emit(a, MOV_IMM(BPF_REG_0, XDP_PASS));
+	emit(a, EXIT());
+}
+
+static int map_create(int type, const char *name, int key, int val, int num)
+{
+	union bpf_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type    = type;
+	attr.key_size    = key;
+	attr.value_size  = val;
+	attr.max_entries = num;
+	strlcpy(attr.map_name, name, sizeof(attr.map_name));
+
+	fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (fd < 0)
+		ERROR("Failed creating BPF map %s: %s", name, strerror(errno));
+
+	return fd;
+}
+
+static int map_update(int fd, const void *key, const void *val)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = fd;
+	attr.key    = (uintptr_t)key;
+	attr.value  = (uintptr_t)val;
+
+	return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+static int map_lookup(int fd, const void *key, void *val)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = fd;
+	attr.key    = (uintptr_t)key;
+	attr.value  = (uintptr_t)val;
+
+	return sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr);
+}
+
+/* Per-CPU maps have a value for each possible CPU, not only online */
+static int possible_cpus(void)
+{
+	char buf[128], *ptr;
+	FILE *fp;
+
+	fp = fopen("/sys/devices/system/cpu/possible", "r");
+	if (!fp)
+		return 0;
+	ptr = fgets(buf, sizeof(buf), fp);
+	fclose(fp);
+	if (!ptr)
+		return 0;
+
+	/* E.g., 0-7 or 0,2-3, the last CPU is the last number */
+	ptr = buf + strcspn(buf, "\n");
+	while (ptr > buf && strchr("0123456789", ptr[-1]))
+		ptr--;
+
+	return atoi(ptr) + 1;
+}
+
+/* Verifier log only on failure, with -l debug */
+static int prog_load(struct xdp_asm *a, char *log, size_t len)
+{
+	union bpf_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type            = BPF_PROG_TYPE_XDP;
+	attr.expected_attach_type = BPF_XDP;
+	attr.insns                = (uintptr_t)a->insn;
+	attr.insn_cnt             = a->pc;
+	attr.license              = (uintptr_t)"ISC";
+	if (log) {
+		attr.log_buf      = (uintptr_t)log;
+		attr.log_size     = len;
+		attr.log_level    = 1;
+	}
+	strlcpy(attr.prog_name, "mcjoin", sizeof(attr.prog_name));
+
+	fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (fd < 0 && !log) {
+		ERROR("Failed loading XDP program: %s", strerror(errno));
+		if (log_level(NULL) == LOG_DEBUG) {
+			static char buf[65536];
+
+			if (prog_load(a, buf, sizeof(buf)) < 0)
+				DEBUG("Verifier: %s", buf);
+		}
+	}
+
+	return fd;
+}
+
+/* Native XDP if the driver has it, otherwise generic, e.g., veth peer */
+static int prog_attach(int ifindex)
+{
+	const uint32_t modes[] = { 0, XDP_FLAGS_SKB_MODE };
+	union bpf_attr attr;
+	size_t i;
+	int fd = -1;
+
+	for (i = 0; i < NELEMS(modes) && fd < 0; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.link_create.prog_fd        = prog_fd;
+		attr.link_create.target_ifindex = ifindex;
+		attr.link_create.attach_type    = BPF_XDP;
+		attr.link_create.flags          = modes[i];
+
+		fd = sys_bpf(BPF_LINK_CREATE, &attr);
+		if (fd < 0)
+			DEBUG("Failed attaching XDP program, flags 0x%x: %s", modes[i], strerror(errno));
+	}
+
+	if (fd < 0)
+		ERROR("Failed attaching XDP program to %s: %s", iface, strerror(errno));
+
+	return fd;
+}
+
+/*
+ * Load and attach the counting program to --iface, with the index in
+ * groups[] of each group address, or with an AF_XDP socket, xsk >= 0,
+ * the program redirecting to it.  The program is detached when the
+ * link is closed, at the latest when mcjoin exits.
+ */
+int xdp_init(int xsk)
+{
+	struct xdp_asm a;
+	uint32_t i;
+	int ifindex;
+
+	ifindex = if_nametoindex(iface);
+	if (!ifindex) {
+		ERROR("invalid interface: %s", iface);
+		return 1;
+	}
+
+	ncpus = possible_cpus();
+	if (ncpus <= 0) {
+		ERROR("Failed reading number of possible CPUs");
+		return 1;
+	}
+
+	map_grp = map_create(BPF_MAP_TYPE_HASH, "mcjoin_grp", 16, sizeof(uint32_t), group_num);
+	if (map_grp < 0)
+		goto fail;
+	if (xsk >= 0) {
+		uint32_t queue = af_xdp_queue;
+
+		map_xsk = map_create(BPF_MAP_TYPE_XSKMAP, "mcjoin_xsk", sizeof(uint32_t),
+				     sizeof(uint32_t), queue + 1);
+		if (map_xsk < 0)
+			goto fail;
+		if (map_update(map_xsk, &queue, &xsk)) {
+			ERROR("Failed adding AF_XDP socket to BPF map: %s", strerror(errno));
+			goto fail;
+		}
+	} else {
+		map_cnt = map_create(BPF_MAP_TYPE_PERCPU_ARRAY, "mcjoin_cnt", sizeof(uint32_t),
+				     sizeof(struct xdp_cnt), group_num);
+		if (map_cnt < 0)
+			goto fail;
+		map_seq = map_create(BPF_MAP_TYPE_ARRAY, "mcjoin_seq", sizeof(uint32_t),
+				     sizeof(uint64_t), group_num);
+		if (map_seq < 0)
+			goto fail;
+	}
+
+	for (i = 0; i < group_num; i++) {
+		uint8_t key[16] = { 0 };
+		struct gr *g = &groups[i];
+
+		if (g->grp.ss_family == AF_INET6)
+			memcpy(key, &((struct sockaddr_in6 *)&g->grp)->sin6_addr, 16);
+		else
+			memcpy(key, &((struct sockaddr_in *)&g->grp)->sin_addr, 4);
+
+		if (map_update(map_grp, key, &i)) {
+			ERROR("Failed adding group %s to BPF map: %s", g->group, strerror(errno));
+			goto fail;
+		}
+	}
+
+	assemble(&a);
+	if (resolve(&a)) {
+		ERROR("XDP program too large, max %d instructions", XDP_INSNS);
+		goto fail;
+	}
+
+	prog_fd = prog_load(&a, NULL, 0);
+	if (prog_fd < 0)
+		goto fail;
+
+	link_fd = prog_attach(ifindex);
+	if (link_fd < 0)
+		goto fail;
+
+	if (xsk >= 0)
+		PRINT("Redirecting %zu group(s) with XDP on %s to AF_XDP", group_num, iface);
+	else
+		PRINT("Counting %zu group(s) with XDP on %s%s", group_num, iface,
+		      rtp ? ", RTP sequence gaps" : "");
+
+	return 0;
+fail:
+	xdp_exit();
+	return 1;
+}
+
+/* Sum per-CPU counters into the group table */
+void xdp_read(void)
+{
+	struct xdp_cnt cnt[ncpus > 0 ? ncpus : 1];
+	uint32_t i;
+	int j;
+
+	if (map_cnt < 0)
+		return;
+
+	for (i = 0; i < group_num; i++) {
+		struct gr *g = &groups[i];
+		struct xdp_cnt sum = { 0 };
+
+		if (map_lookup(map_cnt, &i, cnt))
+			continue;
+
+		for (j = 0; j < ncpus; j++) {
+			sum.count += cnt[j].count;
+			sum.bytes += cnt[j].bytes;
+			sum.gaps  += cnt[j].gaps;
+		}
+
+		if (sum.count != g->count)
+			STATUS_MARK(g, '.');
+		g->count     = sum.count;
+		g->gaps      = sum.gaps;
+		g->rxq.bytes = sum.bytes;
+	}
+}
+
+void xdp_exit(void)
+{
+	int *fds[] = { &link_fd, &prog_fd, &map_xsk, &map_seq, &map_cnt, &map_grp };
+	size_t i;
+
+	for (i = 0; i < NELEMS(fds); i++) {
+		if (*fds[i] >= 0)
+			close(*fds[i]);
+		*fds[i] = -1;
+	}
+}
+
+#else /* !HAVE_LINUX_BPF_H */
+
+int xdp_init(int xsk)
+{
+	(void)xsk;
+	ERROR("XDP not supported on this system.");
+	return 1;
+}
+
+void xdp_read(void)
+{
+}
+
+void xdp_exit(void)
+{
+}
+
+#endif /* HAVE_LINUX_BPF_H */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
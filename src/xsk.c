@@ -0,0 +1,723 @@
+/* AF_XDP receive and transmit engine, --af-xdp
+ *
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+#include "mcjoin.h"
+#include "xsk.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_IF_XDP_H
+#include <linux/if_ether.h>
+#include <linux/if_xdp.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#ifndef AF_XDP
+#define AF_XDP  44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define XSK_MASK  (XSK_RING_SIZE - 1)
+#define XSK_HASH  (2 * MAX_NUM_GROUPS)
+
+/* Producer/consumer ring shared with the kernel */
+struct xsk_ring {
+	uint32_t *producer;
+	uint32_t *consumer;
+	uint32_t *flags;
+	void     *desc;
+	void     *map;
+	size_t    len;
+};
+
+static int             xsk_sd = -1;
+static int             wakeup;		/* XDP_USE_NEED_WAKEUP */
+static int             zerocopy;
+static uint8_t        *umem;
+static struct xsk_ring rx, tx, fq, cq;
+
+/* Sender, frames not in the TX or completion ring */
+static uint64_t        frames[XSK_FRAMES];
+static size_t          frame_num;
+static uint8_t         mac[ETH_ALEN];
+static uint16_t        ip_id;
+
+/* Receiver, group index + 1 by address, open addressing */
+static uint16_t        hash[XSK_HASH];
+
+static uint32_t load_acquire(uint32_t *ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static void store_release(uint32_t *ptr, uint32_t val)
+{
+	__atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+
+static const void *addr_of(inet_addr_t *ss, size_t *len)
+{
+	if (ss->ss_family == AF_INET6) {
+		*len = sizeof(struct in6_addr);
+		return &((struct sockaddr_in6 *)ss)->sin6_addr;
+	}
+
+	*len = sizeof(struct in_addr);
+	return &((struct sockaddr_in *)ss)->sin_addr;
+}
+
+/* Last 32 bits of the address, where groups in a range differ */
+static size_t hash_key(const void *addr, size_t len)
+{
+	uint32_t key;
+
+	memcpy(&key, (const uint8_t *)addr + len - sizeof(key), sizeof(key));
+
+	return (key * 2654435761u) % XSK_HASH;
+}
+
+static void hash_init(void)
+{
+	size_t i;
+
+	memset(hash, 0, sizeof(hash));
+	for (i = 0; i < group_num; i++) {
+		const void *addr;
+		size_t len, pos;
+
+		addr = addr_of(&groups[i].grp, &len);
+		pos  = hash_key(addr, len);
+		while (hash[pos])
+			pos = (pos + 1) % XSK_HASH;
+		hash[pos] = i + 1;
+	}
+}
+
+static struct gr *find_group(int family, const void *addr, size_t len)
+{
+	size_t pos = hash_key(addr, len);
+
+	while (hash[pos]) {
+		struct gr *g = &groups[hash[pos] - 1];
+		const void *ga;
+		size_t glen;
+
+		ga = addr_of(&g->grp, &glen);
+		if (g->grp.ss_family == family && !memcmp(ga, addr, len))
+			return g;
+		pos = (pos + 1) % XSK_HASH;
+	}
+
+	return NULL;
+}
+
+static int ring_map(struct xsk_ring *r, struct xdp_ring_offset *off, size_t size, off_t pgoff)
+{
+	r->len = off->desc + XSK_RING_SIZE * size;
+	r->map = mmap(NULL, r->len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		      xsk_sd, pgoff);
+	if (r->map == MAP_FAILED) {
+		ERROR("Failed mapping AF_XDP ring: %s", strerror(errno));
+		r->map = NULL;
+		return -1;
+	}
+
+	r->producer = (uint32_t *)((char *)r->map + off->producer);
+	r->consumer = (uint32_t *)((char *)r->map + off->consumer);
+	r->flags    = (uint32_t *)((char *)r->map + off->flags);
+	r->desc     = (char *)r->map + off->desc;
+
+	return 0;
+}
+
+static void ring_unmap(struct xsk_ring *r)
+{
+	if (r->map)
+		munmap(r->map, r->len);
+	memset(r, 0, sizeof(*r));
+}
+
+static int ring_size(int opt, const char *name)
+{
+	int num = XSK_RING_SIZE;
+
+	if (setsockopt(xsk_sd, SOL_XDP, opt, &num, sizeof(num))) {
+		ERROR("Failed setting AF_XDP %s ring size: %s", name, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Zero-copy if the driver has it, otherwise copy mode, e.g., veth */
+static int xsk_bind(int ifindex)
+{
+	const uint16_t modes[] = { XDP_ZEROCOPY, XDP_COPY };
+	struct sockaddr_xdp sxdp;
+	size_t i;
+	int rc = -1;
+
+	for (i = 0; i < NELEMS(modes) && rc; i++) {
+		memset(&sxdp, 0, sizeof(sxdp));
+		sxdp.sxdp_family   = AF_XDP;
+		sxdp.sxdp_ifindex  = ifindex;
+		sxdp.sxdp_queue_id = af_xdp_queue;
+		sxdp.sxdp_flags    = modes[i];
+#ifdef XDP_USE_NEED_WAKEUP
+		sxdp.sxdp_flags   |= XDP_USE_NEED_WAKEUP;
+#endif
+
+		rc = bind(xsk_sd, (struct sockaddr *)&sxdp, sizeof(sxdp));
+		if (rc)
+			DEBUG("Failed binding AF_XDP socket, flags 0x%x: %s", sxdp.sxdp_flags,
+			      strerror(errno));
+		else
+			zerocopy = modes[i] == XDP_ZEROCOPY;
+	}
+
+	if (rc) {
+		ERROR("Failed binding AF_XDP socket to %s queue %d: %s", iface, af_xdp_queue,
+		      strerror(errno));
+		return -1;
+	}
+
+#ifdef XDP_USE_NEED_WAKEUP
+	wakeup = 1;
+#endif
+
+	return 0;
+}
+
+/* AF_XDP sockets have no ioctls, ask an inet socket */
+static int mac_addr(void)
+{
+	struct ifreq ifr;
+	int sd, rc;
+
+	sd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sd < 0) {
+		ERROR("Failed opening socket(): %s", strerror(errno));
+		return -1;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, iface, sizeof(ifr.ifr_name));
+	rc = ioctl(sd, SIOCGIFHWADDR, &ifr);
+	if (rc)
+		ERROR("Failed reading MAC address of %s: %s", iface, strerror(errno));
+	else
+		memcpy(mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+	close(sd);
+
+	return rc;
+}
+
+/*
+ * Open an AF_XDP socket on --iface and queue, with a UMEM of fixed size
+ * frames shared with the kernel.  The receiver hands all frames to the
+ * fill ring, the sender keeps them until sent.  Returns the socket, for
+ * poll() and the XDP program redirecting packets to it.
+ */
+int xsk_init(int rx_mode)
+{
+	struct xdp_mmap_offsets off;
+	struct xdp_umem_reg reg;
+	socklen_t len = sizeof(off);
+	int ifindex;
+	uint32_t i;
+
+	ifindex = if_nametoindex(iface);
+	if (!ifindex) {
+		ERROR("invalid interface: %s", iface);
+		return -1;
+	}
+
+	xsk_sd = socket(AF_XDP, SOCK_RAW, 0);
+	if (xsk_sd < 0) {
+		ERROR("Failed opening AF_XDP socket: %s", strerror(errno));
+		return -1;
+	}
+
+	umem = mmap(NULL, XSK_FRAMES * XSK_FRAME_SIZE, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (umem == MAP_FAILED) {
+		ERROR("Failed allocating AF_XDP UMEM: %s", strerror(errno));
+		umem = NULL;
+		goto fail;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.addr       = (uintptr_t)umem;
+	reg.len        = XSK_FRAMES * XSK_FRAME_SIZE;
+	reg.chunk_size = XSK_FRAME_SIZE;
+	if (setsockopt(xsk_sd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg))) {
+		ERROR("Failed registering AF_XDP UMEM: %s", strerror(errno));
+		goto fail;
+	}
+
+	/* Fill and completion rings are required, even if one is unused */
+	if (ring_size(XDP_UMEM_FILL_RING, "fill") ||
+	    ring_size(XDP_UMEM_COMPLETION_RING, "completion") ||
+	    ring_size(rx_mode ? XDP_RX_RING : XDP_TX_RING, rx_mode ? "RX" : "TX"))
+		goto fail;
+
+	if (getsockopt(xsk_sd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &len)) {
+		ERROR("Failed reading AF_XDP ring offsets: %s", strerror(errno));
+		goto fail;
+	}
+
+	if (ring_map(&fq, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) ||
+	    ring_map(&cq, &off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING))
+		goto fail;
+	if (rx_mode) {
+		if (ring_map(&rx, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING))
+			goto fail;
+	} else {
+		if (ring_map(&tx, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING))
+			goto fail;
+	}
+
+	if (rx_mode) {
+		uint64_t *addr = fq.desc;
+
+		for (i = 0; i < XSK_RING_SIZE; i++)
+			addr[i] = (uint64_t)i * XSK_FRAME_SIZE;
+		store_release(fq.producer, XSK_RING_SIZE);
+		hash_init();
+	} else {
+		for (i = 0; i < XSK_FRAMES; i++)
+			frames[i] = (uint64_t)i * XSK_FRAME_SIZE;
+		frame_num = XSK_FRAMES;
+		if (mac_addr())
+			goto fail;
+	}
+
+	if (xsk_bind(ifindex))
+		goto fail;
+
+	PRINT("%s with AF_XDP on %s queue %d, %s mode", rx_mode ? "Receiving" : "Sending",
+	      iface, af_xdp_queue, zerocopy ? "zero-copy" : "copy");
+
+	return xsk_sd;
+fail:
+	xsk_exit();
+	return -1;
+}
+
+/* Ethernet, IPv4 or IPv6, and UDP to our port and one of our groups */
+static void rx_frame(uint8_t *frame, size_t len, xsk_cb *cb)
+{
+	struct ethhdr *eth = (struct ethhdr *)frame;
+	const void *src, *dst;
+	struct udphdr *uh;
+	size_t alen, hlen, ulen;
+	struct gr *g;
+	int family;
+
+	if (len < ETH_HLEN)
+		return;
+
+	switch (ntohs(eth->h_proto)) {
+	case ETH_P_IP: {
+		struct iphdr *ip = (struct iphdr *)(frame + ETH_HLEN);
+
+		if (len < ETH_HLEN + sizeof(*ip) || ip->protocol != IPPROTO_UDP)
+			return;
+		hlen   = ETH_HLEN + ip->ihl * 4;
+		src    = &ip->saddr;
+		dst    = &ip->daddr;
+		alen   = sizeof(struct in_addr);
+		family = AF_INET;
+		break;
+	}
+
+	case ETH_P_IPV6: {
+		struct ip6_hdr *ip6 = (struct ip6_hdr *)(frame + ETH_HLEN);
+
+		if (len < ETH_HLEN + sizeof(*ip6) || ip6->ip6_nxt != IPPROTO_UDP)
+			return;
+		hlen   = ETH_HLEN + sizeof(*ip6);
+		src    = &ip6->ip6_src;
+		dst    = &ip6->ip6_dst;
+		alen   = sizeof(struct in6_addr);
+		family = AF_INET6;
+		break;
+	}
+
+	default:
+		return;
+	}
+
+	if (len < hlen + sizeof(*uh))
+		return;
+	uh = (struct udphdr *)(frame + hlen);
+	ulen = ntohs(uh->len);
+	if (ntohs(uh->dest) != port || ulen < sizeof(*uh) || hlen + ulen > len)
+		return;
+
+	g = find_group(family, dst, alen);
+	if (!g)
+		return;
+
+	/* The kernel filters on source for SSM, now we have to */
+	if (g->source) {
+		const void *ss;
+		size_t sslen;
+
+		ss = addr_of(&g->src, &sslen);
+		if (memcmp(ss, src, alen))
+			return;
+	}
+
+	cb(g, (char *)uh + sizeof(*uh), ulen - sizeof(*uh));
+}
+
+/*
+ * Hand at most one ring of received frames to cb, and the frames back
+ * to the fill ring.  Returns number of frames, any protocol.
+ */
+int xsk_recv(xsk_cb *cb)
+{
+	struct xdp_desc *desc = rx.desc;
+	uint64_t *addr = fq.desc;
+	uint32_t cons, prod, fill, num, i;
+
+	cons = *rx.consumer;
+	prod = load_acquire(rx.producer);
+	num  = prod - cons;
+	if (!num)
+		return 0;
+
+	for (i = 0; i < num; i++) {
+		struct xdp_desc *d = &desc[(cons + i) & XSK_MASK];
+
+		rx_frame(&umem[d->addr], d->len, cb);
+	}
+
+	/* Frames back, in aligned mode to the start of their chunk */
+	fill = *fq.producer;
+	for (i = 0; i < num; i++)
+		addr[(fill + i) & XSK_MASK] = desc[(cons + i) & XSK_MASK].addr & ~(uint64_t)(XSK_FRAME_SIZE - 1);
+	store_release(rx.consumer, cons + num);
+	store_release(fq.producer, fill + num);
+
+	if (wakeup && (*fq.flags & XDP_RING_NEED_WAKEUP))
+		recvfrom(xsk_sd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+
+	return num;
+}
+
+/* Sent frames back to the free list */
+static void tx_reap(void)
+{
+	uint64_t *addr = cq.desc;
+	uint32_t cons, prod;
+
+	cons = *cq.consumer;
+	prod = load_acquire(cq.producer);
+	while (cons != prod)
+		frames[frame_num++] = addr[cons++ & XSK_MASK];
+	store_release(cq.consumer, cons);
+}
+
+/* In copy mode each call sends at most a small batch, until EAGAIN stops */
+static void tx_kick(void)
+{
+	if (wakeup && !(*tx.flags & XDP_RING_NEED_WAKEUP))
+		return;
+
+	while (running && sendto(xsk_sd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0) {
+		if (errno == EAGAIN)
+			continue;
+		if (errno != EBUSY && errno != ENOBUFS)
+			DEBUG("Failed waking up AF_XDP TX: %s", strerror(errno));
+		break;
+	}
+}
+
+static uint32_t csum_add(uint32_t sum, const void *buf, size_t len)
+{
+	const uint8_t *ptr = buf;
+
+	while (len > 1) {
+		sum += ptr[0] << 8 | ptr[1];
+		ptr += 2;
+		len -= 2;
+	}
+	if (len)
+		sum += ptr[0] << 8;
+
+	return sum;
+}
+
+static uint16_t csum_fold(uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return htons(~sum & 0xffff);
+}
+
+/*
+ * Ethernet, IP, and UDP headers in front of the payload, from the send
+ * socket's address and port to the group's multicast MAC and address.
+ * Returns frame length, or 0 if the payload does not fit.
+ */
+static size_t tx_frame(uint8_t *frame, inet_addr_t *src, struct msghdr *msgh)
+{
+	inet_addr_t *dst = msgh->msg_name;
+	struct ethhdr *eth = (struct ethhdr *)frame;
+	const uint8_t *ga;
+	struct udphdr *uh;
+	size_t hlen, len = 0, alen, i;
+
+	ga = addr_of(dst, &alen);
+	memcpy(eth->h_source, mac, ETH_ALEN);
+	if (dst->ss_family == AF_INET) {
+		const uint8_t dmac[ETH_ALEN] = { 0x01, 0x00, 0x5e, ga[1] & 0x7f, ga[2], ga[3] };
+
+		memcpy(eth->h_dest, dmac, ETH_ALEN);
+		eth->h_proto = htons(ETH_P_IP);
+		hlen = ETH_HLEN + sizeof(struct iphdr);
+	} else {
+		const uint8_t dmac[ETH_ALEN] = { 0x33, 0x33, ga[12], ga[13], ga[14], ga[15] };
+
+		memcpy(eth->h_dest, dmac, ETH_ALEN);
+		eth->h_proto = htons(ETH_P_IPV6);
+		hlen = ETH_HLEN + sizeof(struct ip6_hdr);
+	}
+
+	uh = (struct udphdr *)(frame + hlen);
+	for (i = 0; i < msgh->msg_iovlen; i++) {
+		struct iovec *iov = &msgh->msg_iov[i];
+
+		if (hlen + sizeof(*uh) + len + iov->iov_len > XSK_FRAME_SIZE)
+			return 0;
+		memcpy((uint8_t *)(uh + 1) + len, iov->iov_base, iov->iov_len);
+		len += iov->iov_len;
+	}
+
+	len += sizeof(*uh);
+	uh->source = ((struct sockaddr_in *)src)->sin_port;
+	uh->dest   = htons(port);
+	uh->len    = htons(len);
+	uh->check  = 0;
+
+	if (dst->ss_family == AF_INET) {
+		struct iphdr *ip = (struct iphdr *)(frame + ETH_HLEN);
+
+		memset(ip, 0, sizeof(*ip));
+		ip->version  = 4;
+		ip->ihl      = sizeof(*ip) / 4;
+		ip->tot_len  = htons(sizeof(*ip) + len);
+		ip->id       = htons(ip_id++);
+		ip->ttl      = ttl;
+		ip->protocol = IPPROTO_UDP;
+		ip->saddr    = ((struct sockaddr_in *)src)->sin_addr.s_addr;
+		ip->daddr    = ((struct sockaddr_in *)dst)->sin_addr.s_addr;
+		ip->check    = csum_fold(csum_add(0, ip, sizeof(*ip)));
+	} else {
+		struct ip6_hdr *ip6 = (struct ip6_hdr *)(frame + ETH_HLEN);
+		uint32_t sum;
+
+		memset(ip6, 0, sizeof(*ip6));
+		ip6->ip6_flow = htonl(6 << 28);
+		ip6->ip6_plen = htons(len);
+		ip6->ip6_nxt  = IPPROTO_UDP;
+		ip6->ip6_hlim = ttl;
+		ip6->ip6_src  = ((struct sockaddr_in6 *)src)->sin6_addr;
+		ip6->ip6_dst  = ((struct sockaddr_in6 *)dst)->sin6_addr;
+
+		/* Mandatory for IPv6, over pseudo header and datagram */
+		sum = csum_add(0, &ip6->ip6_src, 2 * sizeof(struct in6_addr));
+		sum += len + IPPROTO_UDP;
+		sum = csum_add(sum, uh, len);
+		uh->check = csum_fold(sum);
+		if (!uh->check)
+			uh->check = 0xffff;
+	}
+
+	return hlen + len;
+}
+
+/* Source of frames is the address and port of the send socket */
+static inet_addr_t *src_addr(int sd)
+{
+	static struct {
+		int         sd;
+		inet_addr_t addr;
+	} cache[2] = { { .sd = -1 }, { .sd = -1 } };
+	size_t i;
+
+	for (i = 0; i < NELEMS(cache); i++) {
+		socklen_t len = sizeof(cache[i].addr);
+
+		if (cache[i].sd == sd)
+			return &cache[i].addr;
+		if (cache[i].sd != -1)
+			continue;
+
+		if (getsockname(sd, (struct sockaddr *)&cache[i].addr, &len))
+			return NULL;
+		cache[i].sd = sd;
+
+		return &cache[i].addr;
+	}
+
+	return NULL;
+}
+
+/*
+ * Drop-in for sendmmsg() on the sd, but built as frames in the UMEM and
+ * queued on the TX ring.  Waits for completions when out of frames, as
+ * a blocking socket would.  Returns number of packets queued.
+ */
+int xsk_send(int sd, struct mmsghdr *msgv, size_t num)
+{
+	struct xdp_desc *desc = tx.desc;
+	inet_addr_t *src;
+	uint32_t prod;
+	size_t i;
+
+	src = src_addr(sd);
+	if (!src) {
+		errno = EBADF;
+		return -1;
+	}
+
+	tx_reap();
+	while (running && !frame_num) {
+		tx_kick();
+		tx_reap();
+	}
+
+	prod = *tx.producer;
+	for (i = 0; i < num && frame_num; i++) {
+		uint64_t addr = frames[--frame_num];
+		size_t len;
+
+		len = tx_frame(&umem[addr], src, &msgv[i].msg_hdr);
+		if (!len) {
+			frames[frame_num++] = addr;
+			if (!i) {
+				errno = EMSGSIZE;
+				return -1;
+			}
+			break;
+		}
+
+		desc[prod & XSK_MASK].addr = addr;
+		desc[prod & XSK_MASK].len  = len;
+		desc[prod & XSK_MASK].options = 0;
+		msgv[i].msg_len = len;
+		prod++;
+	}
+	store_release(tx.producer, prod);
+	tx_kick();
+
+	return i;
+}
+
+void xsk_stats(void)
+{
+	struct xdp_statistics st;
+	socklen_t len = sizeof(st);
+
+	if (xsk_sd < 0)
+		return;
+
+	memset(&st, 0, sizeof(st));
+	if (getsockopt(xsk_sd, SOL_XDP, XDP_STATISTICS, &st, &len)) {
+		DEBUG("Failed reading AF_XDP statistics: %s", strerror(errno));
+		return;
+	}
+
+	if (rx.map)
+		PRINT("AF_XDP: %s mode, dropped %llu, RX ring full %llu, fill ring empty %llu",
+		      zerocopy ? "zero-copy" : "copy", st.rx_dropped, st.rx_ring_full,
+		      st.rx_fill_ring_empty_descs);
+	else
+		PRINT("AF_XDP: %s mode, invalid TX descriptors %llu, TX ring empty %llu",
+		      zerocopy ? "zero-copy" : "copy", st.tx_invalid_descs,
+		      st.tx_ring_empty_descs);
+}
+
+void xsk_exit(void)
+{
+	ring_unmap(&rx);
+	ring_unmap(&tx);
+	ring_unmap(&fq);
+	ring_unmap(&cq);
+
+	if (xsk_sd >= 0)
+		close(xsk_sd);
+	xsk_sd = -1;
+
+	if (umem)
+		munmap(umem, XSK_FRAMES * XSK_FRAME_SIZE);
+	umem = NULL;
+}
+
+#else /* !HAVE_LINUX_IF_XDP_H */
+
+int xsk_init(int rx)
+{
+	(void)rx;
+	ERROR("AF_XDP not supported on this system.");
+	return -1;
+}
+
+int xsk_recv(xsk_cb *cb)
+{
+	(void)cb;
+	return 0;
+}
+
+int xsk_send(int sd, struct mmsghdr *msgv, size_t num)
+{
+	(void)sd;
+	(void)msgv;
+	(void)num;
+	errno = ENOSYS;
+	return -1;
+}
+
+void xsk_stats(void)
+{
+}
+
+void xsk_exit(void)
+{
+}
+
+#endif /* HAVE_LINUX_IF_XDP_H */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
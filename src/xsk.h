@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2020  Joachim Wiberg <troglobit()gmail!com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef MCJOIN_XSK_H_
+#define MCJOIN_XSK_H_
+
+#include "mcjoin.h"
+
+#define XSK_RING_SIZE   2048	/* Descriptors in each ring, power of 2 */
+#define XSK_FRAMES      (2 * XSK_RING_SIZE)
+#define XSK_FRAME_SIZE  2048	/* UMEM chunk, one frame each */
+
+/* Called for each received frame to one of our groups */
+typedef void (xsk_cb)(struct gr *g, char *buf, size_t len);
+
+int  xsk_init (int rx);
+int  xsk_recv (xsk_cb *cb);
+int  xsk_send (int sd, struct mmsghdr *msgv, size_t num);
+void xsk_stats(void);
+void xsk_exit (void);
+
+#endif /* MCJOIN_XSK_H_ */
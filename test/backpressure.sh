@@ -0,0 +1,22 @@
+#!/bin/sh
+# Sender on a slow link, full interface queue is retried within the
+# period, and the sender reports what it had to drop on this host
+. "${srcdir:-.}/lib.sh"
+
+node snd 1
+node rcv 2
+
+tc -n snd qdisc add dev eth0 root tbf rate 2mbit burst 4k limit 8k 2>/dev/null || skip "tbf not available"
+
+start rcv 10 225.1.2.3+50
+settle
+run snd -s -c 20 -f 20 225.1.2.3+50
+stop
+
+# Send backpressure: NUM deferred, NUM retried, NUM dropped on this host, ...
+line=$(sed -n 's/^.*Send backpressure:/Send backpressure:/p' "$WORK/snd.log")
+[ -n "$line" ] || fail "no send backpressure reported"
+set -- $line
+[ "$5" -gt 0 ] || fail "no deferred send was retried: $line"
+echo "$line"
+exit 0
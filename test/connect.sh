@@ -0,0 +1,17 @@
+#!/bin/sh
+# Connected sender sockets, one per group, IPv4 and IPv6
+. "${srcdir:-.}/lib.sh"
+
+node snd 1
+node rcv 2
+
+for grp in 225.1.2.3 ff2e::1:1; do
+	start rcv 10 -c 20 "$grp+4"
+	settle
+	run snd -s -c 20 -f 20 --connect "$grp+4"
+	finish
+
+	[ "$(received rcv)" -eq 80 ] || fail "$grp: received $(received rcv) of 80 packets"
+	[ "$(gaps rcv)" -eq 0 ]      || fail "$grp: $(gaps rcv) gaps"
+done
+exit 0
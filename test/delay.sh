@@ -0,0 +1,18 @@
+#!/bin/sh
+# Round-trip time through a reflector includes the network delay
+. "${srcdir:-.}/lib.sh"
+
+node snd 1
+node rcv 2
+netem snd delay 20ms
+
+start rcv 10 --reflect 225.1.2.3
+settle
+run snd -s --rtt -c 20 -f 20 225.1.2.3
+stop
+
+# Group 225.1.2.3: RTT min/avg/max 20.1/20.3/20.9 ms, 20 samples
+min=$(awk -F'[ /]' '/min\/avg\/max/ { print int($7) }' "$WORK/snd.log")
+[ -n "$min" ]     || fail "no RTT reported"
+[ "$min" -ge 20 ] || fail "RTT min $min ms, below the 20 ms delay"
+exit 0
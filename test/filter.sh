@@ -0,0 +1,18 @@
+#!/bin/sh
+# Groups on the same port, IPv4 and IPv6, each socket only gets its own
+# group, stray packets are dropped by the socket filter in the kernel
+. "${srcdir:-.}/lib.sh"
+
+node snd 1
+node rcv 2
+
+for grp in 225.1.2.3 ff2e::1:1; do
+	start rcv 10 -c 20 "$grp+2"
+	settle
+	run snd -s -c 20 -f 20 "$grp+2"
+	finish
+
+	[ "$(received rcv)" -eq 40 ] || fail "$grp: received $(received rcv) of 40 packets"
+	grep -q "wrong socket" "$WORK/rcv.log" && fail "$grp: packets received on wrong socket"
+done
+exit 0
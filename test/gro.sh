@@ -0,0 +1,16 @@
+#!/bin/sh
+# UDP GRO receive, coalesced or not, every packet counted in order
+. "${srcdir:-.}/lib.sh"
+
+node snd 1
+node rcv 2
+
+start rcv 10 --gro -c 640 225.1.2.3
+settle
+run snd -s -c 640 -f 10 --burst 64 225.1.2.3
+finish
+
+[ "$(received rcv)" -eq 640 ]  || fail "received $(received rcv) of 640 packets"
+[ "$(gaps rcv)" -eq 0 ]        || fail "$(gaps rcv) gaps"
+grep -q "^UDP GRO: " "$WORK/rcv.log" || fail "no UDP GRO summary"
+exit 0
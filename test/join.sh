@@ -0,0 +1,15 @@
+#!/bin/sh
+# ASM join, all packets arrive in order
+. "${srcdir:-.}/lib.sh"
+
+node snd 1
+node rcv 2
+
+start rcv 10 -c 20 225.1.2.3
+settle
+run snd -s -c 20 -f 20 225.1.2.3
+finish
+
+[ "$(received rcv)" -eq 20 ] || fail "received $(received rcv) of 20 packets"
+[ "$(gaps rcv)" -eq 0 ]      || fail "$(gaps rcv) gaps"
+exit 0
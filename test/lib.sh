@@ -0,0 +1,126 @@
+# Helpers for mcjoin tests, sourced by each test.  A test re-executes
+# itself in a new user, network, and mount namespace, so no root or
+# network access is needed.  As root, no user namespace, for --xdp.
+# Nodes are network namespaces, each with an eth0 connected to bridge
+# br0: node NAME NUM gets 10.0.0.NUM/24 and fc00::NUM/64.  Exit code 77
+# tells automake a test was skipped.
+
+MCJOIN=${MCJOIN:-$(pwd)/../src/mcjoin}
+
+skip()
+{
+	echo "SKIP: $*"
+	exit 77
+}
+
+fail()
+{
+	echo "FAIL: $*"
+	for log in "$WORK"/*.log; do
+		[ -f "$log" ] || continue
+		echo "--- $(basename "$log")"
+		cat "$log"
+	done
+	exit 1
+}
+
+if [ -z "$MCJOIN_TEST_NS" ]; then
+	[ -x "$MCJOIN" ] || skip "no mcjoin binary at $MCJOIN"
+	userns=-r
+	[ "$(id -u)" -eq 0 ] && userns=
+	unshare $userns -n -m true 2>/dev/null || skip "cannot create user and network namespaces"
+	export MCJOIN MCJOIN_TEST_NS=1
+	exec unshare $userns -n -m "$0" "$@"
+fi
+
+WORK=$(mktemp -d)
+PIDS=
+cleanup()
+{
+	[ -n "$PIDS" ] && kill $PIDS 2>/dev/null
+	rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+# Private /run for `ip netns`, and a bridge without IGMP snooping
+mount -t tmpfs tmpfs /run || skip "cannot mount /run for ip netns"
+ip link set lo up
+ip link add br0 type bridge mcast_snooping 0 || skip "no bridge support"
+ip link set br0 up
+
+node()
+{
+	ip netns add "$1"
+	ip link add eth0 netns "$1" type veth peer name "$1"
+	ip link set dev "$1" master br0 up
+	ip -n "$1" link set lo up
+	ip -n "$1" addr add "10.0.0.$2/24" dev eth0
+	ip -n "$1" addr add "fc00::$2/64" dev eth0 nodad
+	ip -n "$1" link set eth0 up
+}
+
+# Traffic control on egress of node's eth0, e.g., netem loss 10%
+netem()
+{
+	node=$1
+	shift
+	tc -n "$node" qdisc add dev eth0 root netem "$@" 2>/dev/null || skip "netem not available"
+}
+
+# Run mcjoin on node in background, output in $WORK/NODE.log, stopped
+# after at most SEC seconds with SIGTERM so it still shows its stats
+start()
+{
+	node=$1
+	sec=$2
+	shift 2
+	ip netns exec "$node" timeout "$sec" "$MCJOIN" -o -i eth0 "$@" >"$WORK/$node.log" 2>&1 &
+	PIDS="$PIDS $!"
+}
+
+# Wait for all background mcjoin to finish
+finish()
+{
+	wait
+	PIDS=
+}
+
+# Stop all background mcjoin, e.g., receivers without -c COUNT
+stop()
+{
+	[ -n "$PIDS" ] && kill $PIDS 2>/dev/null
+	wait
+	PIDS=
+}
+
+# Run mcjoin on node in foreground
+run()
+{
+	node=$1
+	shift
+	ip netns exec "$node" "$MCJOIN" -o -i eth0 "$@" >"$WORK/$node.log" 2>&1 || fail "mcjoin on $node failed"
+}
+
+# Receiver stats at exit: Group GROUP received NUM packets, gaps: NUM
+# The first line may follow the progress output of -o
+stats()
+{
+	awk -v f="$2" 'sub(/^.*Group /, "Group ") && / received / { n += $f } END { print n + 0 }' \
+	    "$WORK/$1.log"
+}
+
+received()
+{
+	stats "$1" 4
+}
+
+gaps()
+{
+	stats "$1" 7
+}
+
+# Let receivers join before starting senders
+settle()
+{
+	sleep 1
+}
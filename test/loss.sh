@@ -0,0 +1,18 @@
+#!/bin/sh
+# Network loss is detected as gaps and attributed to the network
+. "${srcdir:-.}/lib.sh"
+
+node snd 1
+node rcv 2
+netem snd loss 20%
+
+start rcv 5 225.1.2.3
+settle
+run snd -s -c 200 -f 5 225.1.2.3
+finish
+
+num=$(received rcv)
+[ "$num" -gt 0 ] && [ "$num" -lt 200 ] || fail "received $num of 200 packets with 20% loss"
+[ "$(gaps rcv)" -gt 0 ]                || fail "no gaps detected"
+grep -q "local overflow 0," "$WORK/rcv.log" || fail "loss not attributed to network"
+exit 0
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Flow entropy: groups spread over a destination port range, sent from
+# a source port range, and where each group arrives on the receiver
+. "${srcdir:-.}/lib.sh"
+
+node snd 1
+node rcv 2
+
+# Receiver on the first port only gets every other group
+start rcv 10 -c 20 -p 2000 225.1.2.3+4
+settle
+run snd -s -c 20 -f 20 -p 2000-2001 225.1.2.3+4
+finish
+[ "$(received rcv)" -eq 40 ] || fail "one port: received $(received rcv) of 40 packets"
+
+# Shared socket, all groups from the same source port
+start rcv 10 -c 20 --incoming 225.1.2.3+2
+settle
+run snd -s -c 20 -f 20 --sport 3000 225.1.2.3+2
+finish
+[ "$(grep -c "from .*:3000 .* CPU" "$WORK/rcv.log")" -eq 2 ] || fail "one source port: not used by both groups"
+
+for grp in 225.1.2.3 ff2e::1:1; do
+	start rcv 10 -c 20 -p 2000-2001 --incoming "$grp+4"
+	settle
+	run snd -s -c 20 -f 20 -p 2000-2001 --sport 3000-3003 "$grp+4"
+	finish
+
+	[ "$(received rcv)" -eq 80 ] || fail "$grp: received $(received rcv) of 80 packets"
+	[ "$(gaps rcv)" -eq 0 ]      || fail "$grp: $(gaps rcv) gaps"
+	for sp in 3000 3001 3002 3003; do
+		grep -q "from .*:$sp .* CPU" "$WORK/rcv.log" || fail "$grp: no group from source port $sp"
+	done
+	grep -q "Groups arrived on [1-9][0-9]* CPUs" "$WORK/rcv.log" || fail "$grp: no incoming CPU"
+done
+exit 0
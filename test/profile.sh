@@ -0,0 +1,24 @@
+#!/bin/sh
+# Per-stage profile at exit, one send and parse per packet
+. "${srcdir:-.}/lib.sh"
+
+# Calls of stage in profile table at exit
+calls()
+{
+	awk -v s="$2" '$1 == s && NF == 6 { print $3 }' "$WORK/$1.log"
+}
+
+node snd 1
+node rcv 2
+
+start rcv 10 --profile -c 20 225.1.2.3
+settle
+run snd --profile -s -c 20 -f 20 225.1.2.3
+finish
+
+[ "$(received rcv)" -eq 20 ]         || fail "received $(received rcv) of 20 packets"
+[ "$(calls snd send)" = 20 ]         || fail "sender profile: $(calls snd send) sends"
+[ "$(calls rcv parse)" = 20 ]        || fail "receiver profile: $(calls rcv parse) parsed"
+[ "$(calls rcv recv)" -ge 1 ]        || fail "receiver profile: no recv calls"
+grep -q "^Syscalls [0-9]*/s" "$WORK/rcv.log" || fail "receiver profile: no syscall rate"
+exit 0
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Sender waits for an address on its interface, and the receiver joins
+# its groups again after a link flap, timestamped in the summary
+. "${srcdir:-.}/lib.sh"
+
+node snd 1
+node rcv 2
+
+# No address yet, sender waits for it instead of giving up
+ip -n snd addr flush dev eth0
+start rcv 10 -c 20 225.1.2.3+2
+start snd 10 -s -c 10 -f 20 225.1.2.3+2
+sleep 1
+ip -n snd addr add 10.0.0.1/24 dev eth0
+finish
+
+grep -q "Waiting for an address on eth0" "$WORK/snd.log" || fail "sender did not wait for address"
+[ "$(received rcv)" -eq 20 ] || fail "no address: received $(received rcv) of 20 packets"
+
+# Link flap on the receiver, packets flow again after it
+start rcv 10 225.1.2.3+2
+start snd 10 -s -c 150 -f 20 225.1.2.3+2
+sleep 2
+ip -n rcv link set eth0 down
+sleep 0.2
+ip -n rcv link set eth0 up
+sleep 2
+stop
+
+grep -q "link down" "$WORK/rcv.log" || fail "no link down event"
+grep -q "link up" "$WORK/rcv.log"   || fail "no link up event"
+grep -q "Recovered 1 of 1 times" "$WORK/rcv.log" || fail "receiver did not recover after link up"
+exit 0
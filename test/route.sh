@@ -0,0 +1,32 @@
+#!/bin/sh
+# Default interface from the netlink cache: an IPv6 only default route,
+# and a sender started before there is any default route at all
+. "${srcdir:-.}/lib.sh"
+
+node snd 1
+node rcv 2
+
+# Without -i, IPv6 default route only
+ip -n snd -6 route add default via fc00::2 dev eth0
+start rcv 10 -c 10 ff05::1:2:3
+settle
+ip netns exec snd timeout 10 "$MCJOIN" -o -l debug -s -c 10 -f 20 ff05::1:2:3 >"$WORK/snd.log" 2>&1
+finish
+
+grep -q "Found default interface eth0" "$WORK/snd.log" || fail "no default interface from IPv6 route"
+[ "$(received rcv)" -eq 10 ] || fail "IPv6 default: received $(received rcv) of 10 packets"
+
+# No default route yet, sender waits for the route event
+ip -n snd -6 route flush default
+start rcv 10 -c 10 225.1.2.3
+settle
+ip netns exec snd timeout 10 "$MCJOIN" -o -s -c 10 -f 20 225.1.2.3 >"$WORK/snd.log" 2>&1 &
+PIDS="$PIDS $!"
+sleep 1
+ip -n snd route add default via 10.0.0.2
+finish
+
+grep -q "Waiting for an address on default interface" "$WORK/snd.log" || fail "sender did not wait for a default route"
+grep -q "multicast on eth0" "$WORK/snd.log" || fail "sender did not resolve eth0 from route event"
+[ "$(received rcv)" -eq 10 ] || fail "late default: received $(received rcv) of 10 packets"
+exit 0
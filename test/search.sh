@@ -0,0 +1,19 @@
+#!/bin/sh
+# Max lossless rate search over the bridge, set MIN_PPS to catch
+# throughput regressions, e.g., MIN_PPS=10000 make check
+. "${srcdir:-.}/lib.sh"
+
+node snd 1
+node rcv 2
+
+start rcv 120 --control 225.1.2.3
+settle
+run snd --search 10.0.0.2 --trial 0.1 225.1.2.3
+stop
+
+#    Bytes    pps/group   Mbps/group   Mbps total   Trials
+pps=$(awk '/Bytes +pps\/group/ { getline; print $2 }' "$WORK/snd.log")
+[ -n "$pps" ] && [ "$pps" -gt 0 ]      || fail "no lossless rate found"
+[ "$pps" -ge "${MIN_PPS:-0}" ]         || fail "max lossless rate $pps pps, below $MIN_PPS"
+echo "Max lossless rate $pps pps"
+exit 0
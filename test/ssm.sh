@@ -0,0 +1,23 @@
+#!/bin/sh
+# SSM join, IPv4 and IPv6, only packets from the joined source arrive
+. "${srcdir:-.}/lib.sh"
+
+node snd1 1
+node snd2 3
+node rcv 2
+
+for grp in 232.1.2.3 ff3e::8000:1; do
+	case $grp in
+	*:*)	src=fc00::1 ;;
+	*)	src=10.0.0.1 ;;
+	esac
+
+	start rcv 4 "$src,$grp"
+	settle
+	start snd2 3 -s -c 20 -f 20 "$grp"
+	run snd1 -s -c 20 -f 20 "$grp"
+	finish
+
+	[ "$(received rcv)" -eq 20 ] || fail "$grp: received $(received rcv), expected 20 from $src"
+done
+exit 0
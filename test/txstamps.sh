@@ -0,0 +1,19 @@
+#!/bin/sh
+# Host transmit latency per group from TX timestamps, every packet sent
+# is stamped, periodic and traffic model sender
+. "${srcdir:-.}/lib.sh"
+
+node snd 1
+node rcv 2
+
+for model in "" --poisson; do
+	start rcv 10 -c 20 225.1.2.3+2
+	settle
+	run snd -s -c 20 -f 20 --tx-stamps $model 225.1.2.3+2
+	finish
+
+	[ "$(received rcv)" -eq 40 ] || fail "${model:-periodic}: received $(received rcv) of 40 packets"
+	num=$(grep -c "syscall to wire, .* 20 samples" "$WORK/snd.log")
+	[ "$num" -eq 2 ] || fail "${model:-periodic}: TX timestamps for $num of 2 groups"
+done
+exit 0
@@ -0,0 +1,29 @@
+#!/bin/sh
+# Launch accuracy from TX timestamps, userspace pacing and, if the etf
+# qdisc is available, launch time set by the kernel
+. "${srcdir:-.}/lib.sh"
+
+node snd 1
+node rcv 2
+
+check()
+{
+	mode=$1
+	shift
+
+	start rcv 10 -c 20 225.1.2.3
+	settle
+	run snd -s -c 20 -f 20 "$@" 225.1.2.3
+	finish
+
+	[ "$(received rcv)" -eq 20 ] || fail "$mode: received $(received rcv) of 20 packets"
+	grep -q "Launch accuracy, $mode: 20 packets" "$WORK/snd.log" || fail "$mode: no launch accuracy"
+}
+
+check userspace --txtime=user
+if tc -n snd qdisc add dev eth0 root etf clockid CLOCK_TAI delta 500000 2>/dev/null; then
+	check etf --txtime
+else
+	echo "etf qdisc not available, skipping launch time"
+fi
+exit 0
@@ -0,0 +1,19 @@
+#!/bin/sh
+# XDP counting in the kernel, IPv4 and IPv6, RTP sequence gaps
+. "${srcdir:-.}/lib.sh"
+
+node snd 1
+node rcv 2
+
+start rcv 10 --xdp --rtp -c 20 225.1.2.3 ff0e::1
+settle
+if grep -Eq "Failed .*(BPF|XDP).*(not permitted|not implemented|not supported)" "$WORK/rcv.log"; then
+	skip "$(grep -E -m1 "Failed .*(BPF|XDP)" "$WORK/rcv.log")"
+fi
+run snd -s --rtp -c 20 -f 20 225.1.2.3 ff0e::1
+finish
+
+grep -q "with XDP on eth0" "$WORK/rcv.log" || fail "XDP not attached"
+[ "$(received rcv)" -eq 40 ] || fail "received $(received rcv) of 40 packets"
+[ "$(gaps rcv)" -eq 0 ]      || fail "$(gaps rcv) gaps"
+exit 0
@@ -0,0 +1,20 @@
+#!/bin/sh
+# AF_XDP sender and receiver, IPv4 and IPv6, RTP sequence gaps
+. "${srcdir:-.}/lib.sh"
+
+node snd 1
+node rcv 2
+
+start rcv 10 --af-xdp --rtp -c 50 225.1.2.3 ff0e::1
+settle
+if grep -Eq "Failed .*(AF_XDP|BPF|XDP).*(not permitted|not implemented|not supported)" "$WORK/rcv.log"; then
+	skip "$(grep -E -m1 "Failed .*(AF_XDP|BPF|XDP)" "$WORK/rcv.log")"
+fi
+run snd -s --af-xdp --rtp -c 50 -f 20 225.1.2.3 ff0e::1
+finish
+
+grep -q "Sending with AF_XDP on eth0" "$WORK/snd.log" || fail "sender not on AF_XDP"
+grep -q "Receiving with AF_XDP on eth0" "$WORK/rcv.log" || fail "receiver not on AF_XDP"
+[ "$(received rcv)" -eq 100 ] || fail "received $(received rcv) of 100 packets"
+[ "$(gaps rcv)" -eq 0 ]       || fail "$(gaps rcv) gaps"
+exit 0